@@ -6,10 +6,26 @@ out vec4 FragColor;
 uniform sampler2D ourTexture;
 uniform vec3 camPos;
 uniform float brightness;
+//Atlas layout, as in textureface.hpp
+const float onePixel = 1.0 / 544.0;
+const float textureWidth = 1.0 / 17.0;
+const float oneOver16 = 1.0 / 16.0;
+//Greedy quads' coordinates are -(1 + tile * tileStride + blocks along the
+//face); their tile repeats once per block
+const float tileStride = 128.0;
+
 void main()
 {
+    vec2 uv = TexCoord;
+    if(uv.x < 0.0) {
+        vec2 packed = -uv - 1.0;
+        vec2 tile = floor(packed / tileStride);
+        vec2 local = fract(packed - tile * tileStride);
+        uv = vec2(onePixel + tile.x * oneOver16 + local.x * textureWidth,
+            1.0 - tile.y * oneOver16 - onePixel - local.y * textureWidth);
+    }
 
-    vec4 texColor = texture(ourTexture, TexCoord);
+    vec4 texColor = texture(ourTexture, uv);
 
 
 
@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#define CPU_DISPATCH_IMP
+#include "cpu_dispatch.hpp"
+
+#define PERLIN_IMP
+#include "perlin.h"
+
+#define FRACTAL_IMP
+#include "fractal.hpp"
+
+#define BIOME_IMP
+#include "biome.hpp"
+
+#define EROSION_IMP
+#include "erosion.hpp"
+
+#define WORLDGEN_IMP
+#include "worldgen.hpp"
+
+#define TERRAIN_IMP
+#include "terrain.hpp"
+
+//Offline erosion baking, see erosion.hpp. Run from the repository root:
+//
+//    bake_erosion [--seed N] [--x0 X] [--z0 Z] [--size CELLS] [--spacing BLOCKS]
+//                 [--droplets PER_CELL] [--threads N] [--out file]
+//
+//samples the terrain graph over a size x size grid from (x0, z0), erodes it
+//and writes the height change to EROSION_MAP_PATH (or --out) for the game to
+//load. Rebake whenever the terrain graph or the seed changes.
+//
+//    bake_erosion --bench [--threads 1,2,4] [--size CELLS]
+//
+//erodes the same grid at each thread count without saving and prints JSON
+//with cells/sec and cells/sec per core (threads, up to the hardware's). The checksum is the same at every
+//thread count, since the result doesn't depend on it.
+
+//Deltas ramp up from 0 over this many cells in from the edge, so the baked
+//region meets the unbaked terrain around it without a step
+const int EROSION_FADE_CELLS = 32;
+
+//heights[x * size + z] = terrain height at (x0 + x * spacing, z0 + z * spacing), on threads threads
+void sample_region(std::vector<float> &heights, float x0, float z0, int size, float spacing, int threads) {
+    heights.resize(static_cast<size_t>(size) * size);
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            std::vector<float> xs(size);
+            std::vector<float> zs(size);
+            for(int z = 0; z < size; ++z) {
+                zs[z] = z0 + z * spacing;
+            }
+            for(int x = t; x < size; x += threads) {
+                std::fill(xs.begin(), xs.end(), x0 + x * spacing);
+                noise_wrap_batch(xs.data(), zs.data(), heights.data() + static_cast<size_t>(x) * size, size);
+            }
+        });
+    }
+    for(std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+float heights_checksum(const std::vector<float> &heights) {
+    double sum = 0.0;
+    for(size_t i = 0; i < heights.size(); ++i) {
+        sum += heights[i] * static_cast<double>(i % 97 + 1);
+    }
+    return static_cast<float>(sum / heights.size());
+}
+
+std::vector<int> parse_thread_counts(const char* list) {
+    std::vector<int> counts;
+    for(const char* c = list; *c != '\0';) {
+        int count = std::atoi(c);
+        if(count > 0) {
+            counts.push_back(count);
+        }
+        const char* comma = std::strchr(c, ',');
+        c = comma ? comma + 1 : c + std::strlen(c);
+    }
+    return counts;
+}
+
+int main(int argc, char **argv) {
+    int hardware_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    std::vector<int> thread_counts(1, hardware_threads);
+    bool bench = false;
+    bool size_given = false;
+    float x0 = -1024.0f;
+    float z0 = -1024.0f;
+    int size = 2048;
+    float spacing = 1.0f;
+    const char* out_path = EROSION_MAP_PATH;
+    ErosionSettings settings;
+
+    for(int a = 1; a < argc; ++a) {
+        if(std::strcmp(argv[a], "--bench") == 0) {
+            bench = true;
+        } else if(std::strcmp(argv[a], "--seed") == 0 && a + 1 < argc) {
+            set_world_seed(std::strtoull(argv[++a], NULL, 10));
+        } else if(std::strcmp(argv[a], "--x0") == 0 && a + 1 < argc) {
+            x0 = std::strtof(argv[++a], NULL);
+        } else if(std::strcmp(argv[a], "--z0") == 0 && a + 1 < argc) {
+            z0 = std::strtof(argv[++a], NULL);
+        } else if(std::strcmp(argv[a], "--size") == 0 && a + 1 < argc) {
+            size = std::atoi(argv[++a]);
+            size_given = true;
+        } else if(std::strcmp(argv[a], "--spacing") == 0 && a + 1 < argc) {
+            spacing = std::strtof(argv[++a], NULL);
+        } else if(std::strcmp(argv[a], "--droplets") == 0 && a + 1 < argc) {
+            settings.droplets_per_cell = std::strtof(argv[++a], NULL);
+        } else if(std::strcmp(argv[a], "--threads") == 0 && a + 1 < argc) {
+            thread_counts = parse_thread_counts(argv[++a]);
+        } else if(std::strcmp(argv[a], "--out") == 0 && a + 1 < argc) {
+            out_path = argv[++a];
+        } else {
+            std::fprintf(stderr, "usage: bake_erosion [--seed N] [--x0 X] [--z0 Z] [--size CELLS] [--spacing BLOCKS] "
+                "[--droplets PER_CELL] [--threads N] [--out file]\n"
+                "       bake_erosion --bench [--threads 1,2,4] [--size CELLS]\n");
+            return EXIT_FAILURE;
+        }
+    }
+    if(thread_counts.empty() || size < 2 * EROSION_FADE_CELLS || !(spacing > 0.0f)) {
+        std::fprintf(stderr, "Need at least one thread, a size of at least %d and a positive spacing\n", 2 * EROSION_FADE_CELLS);
+        return EXIT_FAILURE;
+    }
+    if(!load_terrain_graph(TERRAIN_GRAPH_PATH)) {
+        return EXIT_FAILURE;
+    }
+    int max_threads = *std::max_element(thread_counts.begin(), thread_counts.end());
+
+    if(bench) {
+        if(!size_given) {
+            size = 1024;
+        }
+        std::vector<float> start;
+        sample_region(start, x0, z0, size, spacing, max_threads);
+        double cells = static_cast<double>(size) * size;
+        double droplets = cells * settings.droplets_per_cell;
+        std::printf("{\n");
+        std::printf("  \"hardware_threads\": %d,\n", hardware_threads);
+        std::printf("  \"cells\": %.0f,\n", cells);
+        std::printf("  \"droplets\": %.0f,\n", droplets);
+        std::printf("  \"lifetime\": %d,\n", settings.lifetime);
+        std::printf("  \"results\": [\n");
+        for(size_t t = 0; t < thread_counts.size(); ++t) {
+            int threads = thread_counts[t];
+            std::vector<float> heights = start;
+            auto began = std::chrono::steady_clock::now();
+            erode_heightfield(heights, size, size, spacing, settings, WORLD_SEED, threads);
+            double seconds = seconds_since(began);
+            int cores = std::min(threads, hardware_threads);
+            std::printf("    {\"kernel\": \"erosion\", \"threads\": %d, \"seconds\": %.3f, \"cells_per_sec\": %.0f, "
+                "\"cells_per_sec_per_core\": %.0f, \"droplets_per_sec\": %.0f, \"checksum\": %.6f}%s\n",
+                threads, seconds, cells / seconds, cells / seconds / cores, droplets / seconds,
+                heights_checksum(heights), t + 1 < thread_counts.size() ? "," : "");
+        }
+        std::printf("  ]\n}\n");
+        return EXIT_SUCCESS;
+    }
+
+    auto began = std::chrono::steady_clock::now();
+    std::vector<float> heights;
+    sample_region(heights, x0, z0, size, spacing, max_threads);
+    double sampled = seconds_since(began);
+    std::vector<float> eroded = heights;
+    erode_heightfield(eroded, size, size, spacing, settings, WORLD_SEED, max_threads);
+    double seconds = seconds_since(began) - sampled;
+
+    ErosionMap map;
+    map.seed = WORLD_SEED;
+    map.x0 = x0;
+    map.z0 = z0;
+    map.spacing = spacing;
+    map.width = size;
+    map.depth = size;
+    map.deltas.resize(heights.size());
+    float deepest = 0.0f;
+    float highest = 0.0f;
+    for(int x = 0; x < size; ++x) {
+        for(int z = 0; z < size; ++z) {
+            int edge = std::min(std::min(x, size - 1 - x), std::min(z, size - 1 - z));
+            float t = std::min(1.0f, static_cast<float>(edge) / EROSION_FADE_CELLS);
+            size_t i = static_cast<size_t>(x) * size + z;
+            map.deltas[i] = (eroded[i] - heights[i]) * t * t * (3.0f - 2.0f * t);
+            deepest = std::min(deepest, map.deltas[i]);
+            highest = std::max(highest, map.deltas[i]);
+        }
+    }
+    if(!save_erosion_map(map, out_path)) {
+        return EXIT_FAILURE;
+    }
+    double cells = static_cast<double>(size) * size;
+    int cores = std::min(max_threads, hardware_threads);
+    std::printf("Baked %d x %d cells for seed %llu in %.2f s sampling + %.2f s eroding on %d threads "
+        "(%.0f cells/sec, %.0f per core); deltas from %.2f to %.2f, wrote %s\n",
+        size, size, static_cast<unsigned long long>(WORLD_SEED), sampled, seconds, max_threads,
+        cells / seconds, cells / seconds / cores, deepest, highest, out_path);
+    return EXIT_SUCCESS;
+}
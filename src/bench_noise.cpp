@@ -0,0 +1,449 @@
+#include <algorithm>
+#include <barrier>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CPU_DISPATCH_IMP
+#include "cpu_dispatch.hpp"
+
+#define PERLIN_IMP
+#include "perlin.h"
+
+#define FRACTAL_IMP
+#include "fractal.hpp"
+
+#define BIOME_IMP
+#include "biome.hpp"
+
+#define EROSION_IMP
+#include "erosion.hpp"
+
+#define WORLDGEN_IMP
+#include "worldgen.hpp"
+
+#define TERRAIN_IMP
+#include "terrain.hpp"
+
+#define HEIGHT_CACHE_IMP
+#include "heightcache.hpp"
+
+#define HEIGHT_QUERY_IMP
+#include "heightquery.hpp"
+
+#define DENSITY_IMP
+#include "density.hpp"
+
+#define WFC_IMP
+#include "wfc.hpp"
+
+#define VOXELS_IMP
+#include "voxels.hpp"
+
+#define GREEDY_MESH_IMP
+#include "greedymesh.hpp"
+
+//Noise and height sampling microbenchmarks, written as JSON to stdout.
+//
+//Every kernel is timed at each thread count, with warm caches (the same
+//inputs again, already resident) and cold ones (every thread streams through
+//EVICT_BYTES first). Batch kernels are also timed at every SIMD level this
+//CPU runs. Each thread works on its own SAMPLES_PER_THREAD samples, so
+//ns/sample is wall time over all threads' samples, and the best of REPEATS
+//runs is reported.
+//
+//    bench_noise [--threads 1,2,4] [--simd avx2] [--out results.json]
+
+const size_t SAMPLES_PER_THREAD = 16384;
+const int REPEATS = 5;
+const size_t EVICT_BYTES = 64u << 20;
+
+//Inputs and outputs owned by one thread
+struct BenchBuffers {
+    std::vector<float> xs, ys, zs, out, dxs, dzs;
+    std::vector<double> xd, yd, zd, outd;
+    DensityVolume volume;
+    WfcGrid grid;
+    ChunkVoxels voxels;
+    std::vector<GreedyQuad> quads;
+    float checksum;
+};
+
+struct BenchKernel {
+    const char* kernel;
+    const char* variant;
+    bool dispatched;    //runs through NoiseKernels, so is timed at each SIMD level
+    std::function<void(BenchBuffers &)> run;
+};
+
+struct BenchResult {
+    std::string kernel;
+    std::string variant;
+    std::string simd;
+    int threads;
+    const char* cache;
+    int octaves;
+    double ns_per_sample;
+};
+
+std::vector<char> EVICT_BUFFER;
+
+//Reads the whole eviction buffer, pushing everything else out of the caches
+float evict_caches() {
+    unsigned int sum = 0;
+    for(size_t i = 0; i < EVICT_BUFFER.size(); i += 64) {
+        sum += static_cast<unsigned char>(EVICT_BUFFER[i]);
+    }
+    return static_cast<float>(sum);
+}
+
+void fill_buffers(BenchBuffers &b, int thread) {
+    size_t n = SAMPLES_PER_THREAD;
+    b.xs.resize(n);
+    b.ys.resize(n);
+    b.zs.resize(n);
+    b.out.resize(n);
+    b.dxs.resize(n);
+    b.dzs.resize(n);
+    b.xd.resize(n);
+    b.yd.resize(n);
+    b.zd.resize(n);
+    b.outd.resize(n);
+    b.checksum = 0.0f;
+    //A 128 x 128 patch of half-block steps at a few heights, one patch per thread
+    for(size_t i = 0; i < n; ++i) {
+        b.xs[i] = (i % 128) * 0.5f + thread * 64.0f;
+        b.zs[i] = (i / 128 % 128) * 0.5f - 256.0f;
+        b.ys[i] = (i % 7) * 1.25f;
+        b.xd[i] = b.xs[i];
+        b.yd[i] = b.ys[i];
+        b.zd[i] = b.zs[i];
+    }
+
+    //One 16 x 64 x 16 section of the terrain under the thread's patch,
+    //stone with a grass top, its surface moved to half way up
+    std::vector<float> xs, zs, heights(16 * 16);
+    for(int x = 0; x < 16; ++x) {
+        for(int z = 0; z < 16; ++z) {
+            xs.push_back(thread * 64.0f + x);
+            zs.push_back(z - 256.0f);
+        }
+    }
+    noise_wrap_batch(xs.data(), zs.data(), heights.data(), heights.size());
+    b.voxels.reset(16, 64, 16, 0, 0);
+    for(int c = 0; c < 16 * 16; ++c) {
+        int top = std::clamp(32 + static_cast<int>(std::floor(heights[c] - heights[0])), 1, 62);
+        b.voxels.fill_column(c / 16, c % 16, 0, top, STONE);
+        b.voxels.set(c / 16, top, c % 16, GRASS);
+    }
+}
+
+//Runs kernel on threads threads at once, best of REPEATS, in ns per sample
+double time_kernel(const BenchKernel &kernel, std::vector<BenchBuffers> &buffers, int threads, bool cold) {
+    double best = 1e30;
+    for(int r = 0; r < REPEATS + 1; ++r) {
+        std::vector<std::chrono::steady_clock::time_point> starts(threads);
+        std::vector<std::chrono::steady_clock::time_point> ends(threads);
+        std::barrier sync(threads);
+        std::vector<std::thread> workers;
+        for(int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t]() {
+                if(cold) {
+                    buffers[t].checksum += evict_caches() * 0.0f;
+                } else {
+                    kernel.run(buffers[t]);
+                }
+                sync.arrive_and_wait();
+                starts[t] = std::chrono::steady_clock::now();
+                kernel.run(buffers[t]);
+                ends[t] = std::chrono::steady_clock::now();
+                buffers[t].checksum += buffers[t].out[SAMPLES_PER_THREAD / 2] +
+                    static_cast<float>(buffers[t].outd[SAMPLES_PER_THREAD / 3]);
+            });
+        }
+        for(std::thread &worker : workers) {
+            worker.join();
+        }
+        //The first round only faults pages in and spins threads up
+        if(r == 0) {
+            continue;
+        }
+        double seconds = std::chrono::duration<double>(*std::max_element(ends.begin(), ends.end()) -
+            *std::min_element(starts.begin(), starts.end())).count();
+        best = std::min(best, seconds);
+    }
+    return best * 1e9 / (SAMPLES_PER_THREAD * threads);
+}
+
+//Ground layers for the WFC kernel: stone under grass under air, with the odd
+//stone pillar standing on the grass
+WfcRules make_layer_rules() {
+    WfcRules rules;
+    int stone = rules.add_tile(STONE, 1.0f);
+    int grass = rules.add_tile(GRASS, 1.0f);
+    int air = rules.add_tile(WFC_EMPTY, 1.0f);
+    int pillar = rules.add_tile(STONE, 0.3f);
+    rules.allow_sides(stone, stone);
+    rules.allow_sides(stone, grass);
+    rules.allow_sides(stone, air);
+    rules.allow_sides(grass, grass);
+    rules.allow_sides(grass, air);
+    rules.allow_sides(air, air);
+    rules.allow_sides(pillar, air);
+    rules.allow_sides(pillar, grass);
+    rules.allow(stone, stone, WFC_UP);
+    rules.allow(stone, grass, WFC_UP);
+    rules.allow(grass, air, WFC_UP);
+    rules.allow(grass, pillar, WFC_UP);
+    rules.allow(pillar, pillar, WFC_UP);
+    rules.allow(pillar, air, WFC_UP);
+    rules.allow(air, air, WFC_UP);
+    return rules;
+}
+
+const WfcRules WFC_LAYER_RULES = make_layer_rules();
+
+std::vector<BenchKernel> make_kernels(PerlinF &perlinf, Perlin &perlind) {
+    size_t n = SAMPLES_PER_THREAD;
+    int ni = static_cast<int>(n);
+    std::vector<BenchKernel> kernels;
+    kernels.push_back({ "perlin2d", "float", false, [&perlinf, n](BenchBuffers &b) {
+        for(size_t i = 0; i < n; ++i) {
+            b.out[i] = perlinf.noise(b.xs[i], b.zs[i]);
+        }
+    }});
+    kernels.push_back({ "perlin2d", "float_batch", true, [&perlinf, ni](BenchBuffers &b) {
+        perlinf.noise_batch(b.xs.data(), b.zs.data(), b.out.data(), ni);
+    }});
+    kernels.push_back({ "perlin2d", "double", false, [&perlind, n](BenchBuffers &b) {
+        for(size_t i = 0; i < n; ++i) {
+            b.outd[i] = perlind.noise(b.xd[i], b.zd[i]);
+        }
+    }});
+    kernels.push_back({ "perlin2d", "double_batch", true, [&perlind, ni](BenchBuffers &b) {
+        perlind.noise_batch(b.xd.data(), b.zd.data(), b.outd.data(), ni);
+    }});
+    kernels.push_back({ "perlin3d", "float", false, [&perlinf, n](BenchBuffers &b) {
+        for(size_t i = 0; i < n; ++i) {
+            b.out[i] = perlinf.noise(b.xs[i], b.ys[i], b.zs[i]);
+        }
+    }});
+    kernels.push_back({ "perlin3d", "float_batch", true, [&perlinf, ni](BenchBuffers &b) {
+        perlinf.noise_batch(b.xs.data(), b.ys.data(), b.zs.data(), b.out.data(), ni);
+    }});
+    kernels.push_back({ "perlin3d", "double", false, [&perlind, n](BenchBuffers &b) {
+        for(size_t i = 0; i < n; ++i) {
+            b.outd[i] = perlind.noise(b.xd[i], b.yd[i], b.zd[i]);
+        }
+    }});
+    kernels.push_back({ "perlin3d", "double_batch", true, [&perlind, ni](BenchBuffers &b) {
+        perlind.noise_batch(b.xd.data(), b.yd.data(), b.zd.data(), b.outd.data(), ni);
+    }});
+    kernels.push_back({ "noise_wrap", "scalar", false, [n](BenchBuffers &b) {
+        for(size_t i = 0; i < n; ++i) {
+            b.out[i] = noise_wrap(b.xs[i], b.zs[i]);
+        }
+    }});
+    //The two hill layers noise_wrap summed by hand before the worldgen graph,
+    //to hold the scalar variant's per-sample overhead against
+    kernels.push_back({ "noise_wrap", "baseline", false, [&perlinf, n](BenchBuffers &b) {
+        for(size_t i = 0; i < n; ++i) {
+            float big = perlinf.noise(b.xs[i] / (50.3f * 3.0f), b.zs[i] / (50.3f * 3.0f)) * 90.0f;
+            b.out[i] = perlinf.noise(b.xs[i] / 50.3f, b.zs[i] / 50.3f) * 30.0f + big;
+        }
+    }});
+    kernels.push_back({ "noise_wrap", "batch", true, [n](BenchBuffers &b) {
+        noise_wrap_batch(b.xs.data(), b.zs.data(), b.out.data(), n);
+    }});
+    kernels.push_back({ "noise_wrap", "deriv_batch", true, [n](BenchBuffers &b) {
+        noise_wrap_deriv_batch(b.xs.data(), b.zs.data(), b.out.data(), b.dxs.data(), b.dzs.data(), n);
+    }});
+    //The inputs are on the half-block lattice, so after the warm-up round these read cached tiles
+    kernels.push_back({ "height_query", "exact", false, [n](BenchBuffers &b) {
+        for(size_t i = 0; i < n; ++i) {
+            b.out[i] = height_at(b.xs[i], b.zs[i]);
+        }
+    }});
+    kernels.push_back({ "height_query", "bilinear", false, [n](BenchBuffers &b) {
+        for(size_t i = 0; i < n; ++i) {
+            b.out[i] = height_at_bilinear(b.xs[i] + 0.25f, b.zs[i] + 0.25f);
+        }
+    }});
+    kernels.push_back({ "height_query", "exact_batch", true, [n](BenchBuffers &b) {
+        heights_at(b.xs.data(), b.zs.data(), b.out.data(), n);
+    }});
+    kernels.push_back({ "height_query", "bilinear_batch", false, [n](BenchBuffers &b) {
+        heights_at_bilinear(b.xs.data(), b.zs.data(), b.out.data(), n);
+    }});
+    //One 16 x 64 x 16 chunk is exactly SAMPLES_PER_THREAD voxels
+    kernels.push_back({ "density", "chunk_fill", true, [](BenchBuffers &b) {
+        fill_density(b.volume, static_cast<int>(b.xs[0]), 0, -256, 16, 64);
+        b.out[SAMPLES_PER_THREAD / 2] = b.volume.density[SAMPLES_PER_THREAD / 2];
+    }});
+    //A chunk-sized 16 x 64 x 16 grid is SAMPLES_PER_THREAD cells, bedrock stone and open sky
+    kernels.push_back({ "wfc", "chunk_solve", false, [](BenchBuffers &b) {
+        const WfcRules &rules = WFC_LAYER_RULES;
+        b.grid.reset(rules, 16, 64, 16);
+        for(int x = 0; x < 16; ++x) {
+            for(int z = 0; z < 16; ++z) {
+                b.grid.restrict(x, 0, z, WfcDomain::only(0));
+                b.grid.restrict(x, 63, z, WfcDomain::only(2));
+            }
+        }
+        wfc_solve(rules, b.grid, static_cast<uint64_t>(b.xs[0]));
+        b.out[SAMPLES_PER_THREAD / 2] = static_cast<float>(b.grid.tiles[SAMPLES_PER_THREAD / 2]);
+    }});
+    //The section is SAMPLES_PER_THREAD voxels, meshed with no neighbours
+    kernels.push_back({ "mesh", "greedy_section", false, [](BenchBuffers &b) {
+        b.quads.clear();
+        greedy_mesh(b.voxels, GreedyNeighbours{ { NULL, NULL, NULL, NULL } }, b.quads);
+        b.out[SAMPLES_PER_THREAD / 2] = static_cast<float>(b.quads.size());
+    }});
+    return kernels;
+}
+
+std::vector<int> parse_thread_counts(const char* list) {
+    std::vector<int> counts;
+    for(const char* c = list; *c != '\0';) {
+        int count = std::atoi(c);
+        if(count > 0) {
+            counts.push_back(count);
+        }
+        const char* comma = std::strchr(c, ',');
+        c = comma ? comma + 1 : c + std::strlen(c);
+    }
+    return counts;
+}
+
+int main(int argc, char **argv) {
+    int hardware_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    std::vector<int> thread_counts;
+    for(int t = 1; t < hardware_threads; t *= 2) {
+        thread_counts.push_back(t);
+    }
+    thread_counts.push_back(hardware_threads);
+
+    std::vector<SimdLevel> levels;
+    for(int l = SIMD_SCALAR; l <= detect_simd_level(); ++l) {
+        levels.push_back(static_cast<SimdLevel>(l));
+    }
+    const char* out_path = NULL;
+
+    for(int a = 1; a < argc; ++a) {
+        if(std::strcmp(argv[a], "--threads") == 0 && a + 1 < argc) {
+            thread_counts = parse_thread_counts(argv[++a]);
+        } else if(std::strcmp(argv[a], "--simd") == 0 && a + 1 < argc) {
+            SimdLevel level;
+            if(!parse_simd_level(argv[++a], level) || level > detect_simd_level()) {
+                std::fprintf(stderr, "SIMD level %s is unknown or not supported here\n", argv[a]);
+                return EXIT_FAILURE;
+            }
+            levels.assign(1, level);
+        } else if(std::strcmp(argv[a], "--out") == 0 && a + 1 < argc) {
+            out_path = argv[++a];
+        } else {
+            std::fprintf(stderr, "usage: bench_noise [--threads 1,2,4] [--simd scalar|sse41|avx2|avx512] [--out file]\n");
+            return EXIT_FAILURE;
+        }
+    }
+    if(thread_counts.empty()) {
+        std::fprintf(stderr, "No thread counts given\n");
+        return EXIT_FAILURE;
+    }
+
+    EVICT_BUFFER.assign(EVICT_BYTES, 1);
+    int max_threads = *std::max_element(thread_counts.begin(), thread_counts.end());
+    std::vector<BenchBuffers> buffers(max_threads);
+    for(int t = 0; t < max_threads; ++t) {
+        fill_buffers(buffers[t], t);
+    }
+
+    PerlinF perlinf;
+    Perlin perlind;
+    std::vector<BenchKernel> kernels = make_kernels(perlinf, perlind);
+    std::vector<BenchResult> results;
+
+    for(const BenchKernel &kernel : kernels) {
+        std::vector<SimdLevel> kernel_levels = kernel.dispatched ? levels : std::vector<SimdLevel>(1, levels.back());
+        for(SimdLevel level : kernel_levels) {
+            force_simd_level(level);
+            for(int threads : thread_counts) {
+                for(int cold = 0; cold < 2; ++cold) {
+                    double ns = time_kernel(kernel, buffers, threads, cold != 0);
+                    results.push_back({ kernel.kernel, kernel.variant, kernel.dispatched ? simd_level_name(level) : "none",
+                        threads, cold ? "cold" : "warm", 0, ns });
+                }
+            }
+        }
+    }
+
+    //Fused multi-octave fBm against one noise_batch pass per octave (what
+    //noise_wrap used to do), single thread, warm, best SIMD level
+    force_simd_level(levels.back());
+    std::vector<float> scaledx(SAMPLES_PER_THREAD);
+    std::vector<float> scaledz(SAMPLES_PER_THREAD);
+    std::vector<float> layer(SAMPLES_PER_THREAD);
+    for(int octaves = 1; octaves <= 8; ++octaves) {
+        FractalNoise fractal = FractalNoise::fbm(octaves, 1.0f/50.3f, 30.0f, 2.0f, 0.5f);
+        BenchKernel fused = { "fractal2d", "fused", true, [&](BenchBuffers &b) {
+            fractal.sample_batch(perlinf, b.xs.data(), b.zs.data(), b.out.data(), SAMPLES_PER_THREAD);
+        }};
+        BenchKernel passes = { "fractal2d", "passes", true, [&](BenchBuffers &b) {
+            std::fill(b.out.begin(), b.out.end(), 0.0f);
+            for(int o = 0; o < octaves; ++o) {
+                float frequency = fractal.octaves[o].frequency;
+                for(size_t i = 0; i < SAMPLES_PER_THREAD; ++i) {
+                    scaledx[i] = b.xs[i] * frequency;
+                    scaledz[i] = b.zs[i] * frequency;
+                }
+                perlinf.noise_batch(scaledx.data(), scaledz.data(), layer.data(), static_cast<int>(SAMPLES_PER_THREAD));
+                for(size_t i = 0; i < SAMPLES_PER_THREAD; ++i) {
+                    b.out[i] += layer[i] * fractal.octaves[o].amplitude;
+                }
+            }
+        }};
+        for(const BenchKernel *kernel : { &fused, &passes }) {
+            double ns = time_kernel(*kernel, buffers, 1, false);
+            results.push_back({ kernel->kernel, kernel->variant, simd_level_name(levels.back()), 1, "warm", octaves, ns });
+        }
+    }
+
+    float checksum = 0.0f;
+    for(const BenchBuffers &b : buffers) {
+        checksum += b.checksum;
+    }
+
+    FILE* out = out_path ? std::fopen(out_path, "w") : stdout;
+    if(out == NULL) {
+        std::fprintf(stderr, "Couldn't open %s\n", out_path);
+        return EXIT_FAILURE;
+    }
+    std::fprintf(out, "{\n");
+    std::fprintf(out, "  \"detected_simd\": \"%s\",\n", simd_level_name(detect_simd_level()));
+    std::fprintf(out, "  \"hardware_threads\": %d,\n", hardware_threads);
+    std::fprintf(out, "  \"samples_per_thread\": %zu,\n", SAMPLES_PER_THREAD);
+    std::fprintf(out, "  \"repeats\": %d,\n", REPEATS);
+    std::fprintf(out, "  \"checksum\": %g,\n", checksum);
+    std::fprintf(out, "  \"results\": [\n");
+    for(size_t r = 0; r < results.size(); ++r) {
+        const BenchResult &result = results[r];
+        std::fprintf(out, "    {\"kernel\": \"%s\", \"variant\": \"%s\", \"simd\": \"%s\", \"threads\": %d, \"cache\": \"%s\", ",
+            result.kernel.c_str(), result.variant.c_str(), result.simd.c_str(), result.threads, result.cache);
+        if(result.octaves > 0) {
+            std::fprintf(out, "\"octaves\": %d, ", result.octaves);
+        }
+        std::fprintf(out, "\"ns_per_sample\": %.3f, \"samples_per_sec\": %.0f}%s\n",
+            result.ns_per_sample, 1e9 / result.ns_per_sample, r + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(out, "  ]\n}\n");
+    if(out != stdout) {
+        std::fclose(out);
+    }
+    return 0;
+}
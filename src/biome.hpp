@@ -0,0 +1,343 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "hashrng.hpp"
+
+//Biomes on jittered Voronoi cells. The world is cut into BIOME_CELL_SIZE
+//squares, each with one site at a random spot inside it and a random biome;
+//a point belongs to the biome of its nearest site. Within BIOME_BLEND blocks
+//of being as near to another site, the two biomes' parameters are blended,
+//so the terrain built from them has no seams.
+//
+//Which sites can matter anywhere in a BIOME_TILE_SIZE square is worked out
+//once per square and kept in a small per-thread cache, so a sample costs a
+//distance check against each of those few sites instead of hashing and
+//searching the neighbouring cells.
+
+const float BIOME_CELL_SIZE = 256.0f;
+const float BIOME_TILE_SIZE = 32.0f;
+const float BIOME_BLEND = 48.0f;
+
+//Sites that can matter in one tile, at most
+#define BIOME_MAX_CANDIDATES 16
+//Tiles each thread keeps, a power of two
+#define BIOME_TILE_CACHE 256
+//Points blended together in one pass
+#define BIOME_RUN 64
+
+//What a biome feeds the worldgen graph (see the biome op in worldgen.hpp)
+enum BiomeParam {
+    BIOME_OFFSET,       //added to the surface height
+    BIOME_SCALE,        //multiplies the hills
+    BIOME_STONE_LINE,   //surface turns to stone above this height
+    BIOME_PARAM_COUNT
+};
+
+struct Biome {
+    const char* name;
+    float chance;       //relative to the other biomes
+    float params[BIOME_PARAM_COUNT];
+};
+
+extern const Biome BIOMES[];
+extern const int BIOME_COUNT;
+
+bool parse_biome_param(const char* name, int &param);
+
+//params[p][i] = blended parameter p at (xs[i], zs[i]); entries of params may be NULL
+void biome_sample_batch(uint64_t seed, const float* xs, const float* zs, float* const* params, size_t n);
+
+//Index into BIOMES of the nearest site to (x, z)
+int biome_at(uint64_t seed, float x, float z);
+
+//One blended parameter at one point, in double, for WorldGraph::reference
+double biome_param_reference(uint64_t seed, double x, double z, int param);
+
+#ifdef BIOME_IMP
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+const Biome BIOMES[] = {
+    //name         chance   offset  scale  stone line
+    { "plains",    0.35f, {  -4.0f, 0.35f, 14.0f } },
+    { "hills",     0.45f, {   0.0f, 1.0f,   6.0f } },
+    { "mountains", 0.20f, {  18.0f, 1.8f,   2.0f } }
+};
+const int BIOME_COUNT = sizeof(BIOMES) / sizeof(BIOMES[0]);
+
+const char* BIOME_PARAM_NAMES[BIOME_PARAM_COUNT] = { "offset", "scale", "stone_line" };
+
+//Sites that can be nearest, or within BIOME_BLEND of nearest, somewhere in one tile
+struct BiomeTile {
+    uint64_t seed;
+    int tx, tz;
+    bool filled;
+    int count;
+    float xs[BIOME_MAX_CANDIDATES];
+    float zs[BIOME_MAX_CANDIDATES];
+    int biomes[BIOME_MAX_CANDIDATES];
+};
+
+thread_local BiomeTile BIOME_TILES[BIOME_TILE_CACHE];
+
+bool parse_biome_param(const char* name, int &param) {
+    for(int p = 0; p < BIOME_PARAM_COUNT; ++p) {
+        if(std::strcmp(name, BIOME_PARAM_NAMES[p]) == 0) {
+            param = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+//Site and biome of Voronoi cell (cx, cz). Sites stay off the outer tenth of
+//their cell, so a neighbouring cell's site is never right on the border.
+void biome_site(uint64_t seed, int cx, int cz, float &x, float &z, int &biome) {
+    x = (cx + 0.1f + 0.8f * cell_random(seed, cx, cz, RNG_STREAM_BIOME_SITE_X)) * BIOME_CELL_SIZE;
+    z = (cz + 0.1f + 0.8f * cell_random(seed, cx, cz, RNG_STREAM_BIOME_SITE_Z)) * BIOME_CELL_SIZE;
+    float total = 0.0f;
+    for(int b = 0; b < BIOME_COUNT; ++b) {
+        total += BIOMES[b].chance;
+    }
+    float pick = cell_random(seed, cx, cz, RNG_STREAM_BIOME_TYPE) * total;
+    biome = BIOME_COUNT - 1;
+    for(int b = 0; b < BIOME_COUNT; ++b) {
+        if(pick < BIOMES[b].chance) {
+            biome = b;
+            break;
+        }
+        pick -= BIOMES[b].chance;
+    }
+}
+
+//Distance from (x, z) to the nearest and farthest points of [x0, x1] x [z0, z1]
+float biome_min_distance(float x, float z, float x0, float z0, float x1, float z1) {
+    float dx = x < x0 ? x0 - x : (x > x1 ? x - x1 : 0.0f);
+    float dz = z < z0 ? z0 - z : (z > z1 ? z - z1 : 0.0f);
+    return std::sqrt(dx * dx + dz * dz);
+}
+
+float biome_max_distance(float x, float z, float x0, float z0, float x1, float z1) {
+    float dx = std::max(std::fabs(x - x0), std::fabs(x - x1));
+    float dz = std::max(std::fabs(z - z0), std::fabs(z - z1));
+    return std::sqrt(dx * dx + dz * dz);
+}
+
+//Fills tile with the sites within reach of it, nearest to the tile first.
+//Returns how many there were; past BIOME_MAX_CANDIDATES only the nearest
+//are kept, which check_terrain makes sure does not happen.
+int fill_biome_tile(BiomeTile &tile, uint64_t seed, int tx, int tz) {
+    tile.seed = seed;
+    tile.tx = tx;
+    tile.tz = tz;
+    tile.filled = true;
+    tile.count = 0;
+    float x0 = tx * BIOME_TILE_SIZE;
+    float z0 = tz * BIOME_TILE_SIZE;
+    float x1 = x0 + BIOME_TILE_SIZE;
+    float z1 = z0 + BIOME_TILE_SIZE;
+
+    //Every point of the tile is within reach of its own cell's site, so no
+    //site farther than that plus BIOME_BLEND from the whole tile can matter
+    int cx = static_cast<int>(std::floor(x0 / BIOME_CELL_SIZE));
+    int cz = static_cast<int>(std::floor(z0 / BIOME_CELL_SIZE));
+    float sx, sz;
+    int biome;
+    biome_site(seed, cx, cz, sx, sz, biome);
+    float reach = biome_max_distance(sx, sz, x0, z0, x1, z1) + BIOME_BLEND;
+
+    int cx0 = static_cast<int>(std::floor((x0 - reach) / BIOME_CELL_SIZE));
+    int cz0 = static_cast<int>(std::floor((z0 - reach) / BIOME_CELL_SIZE));
+    int cx1 = static_cast<int>(std::floor((x1 + reach) / BIOME_CELL_SIZE));
+    int cz1 = static_cast<int>(std::floor((z1 + reach) / BIOME_CELL_SIZE));
+    for(int x = cx0; x <= cx1; ++x) {
+        for(int z = cz0; z <= cz1; ++z) {
+            biome_site(seed, x, z, sx, sz, biome);
+            reach = std::min(reach, biome_max_distance(sx, sz, x0, z0, x1, z1) + BIOME_BLEND);
+        }
+    }
+    float distances[BIOME_MAX_CANDIDATES];
+    int found = 0;
+    for(int x = cx0; x <= cx1; ++x) {
+        for(int z = cz0; z <= cz1; ++z) {
+            biome_site(seed, x, z, sx, sz, biome);
+            float distance = biome_min_distance(sx, sz, x0, z0, x1, z1);
+            if(distance > reach) {
+                continue;
+            }
+            found++;
+            if(tile.count == BIOME_MAX_CANDIDATES && distance >= distances[tile.count - 1]) {
+                continue;
+            }
+            //Insertion sort, dropping the farthest site when full
+            int c = std::min(tile.count, BIOME_MAX_CANDIDATES - 1);
+            for(; c > 0 && distances[c - 1] > distance; --c) {
+                distances[c] = distances[c - 1];
+                tile.xs[c] = tile.xs[c - 1];
+                tile.zs[c] = tile.zs[c - 1];
+                tile.biomes[c] = tile.biomes[c - 1];
+            }
+            distances[c] = distance;
+            tile.xs[c] = sx;
+            tile.zs[c] = sz;
+            tile.biomes[c] = biome;
+            tile.count = std::min(tile.count + 1, BIOME_MAX_CANDIDATES);
+        }
+    }
+    return found;
+}
+
+const BiomeTile &biome_tile(uint64_t seed, float x, float z) {
+    int tx = static_cast<int>(std::floor(x / BIOME_TILE_SIZE));
+    int tz = static_cast<int>(std::floor(z / BIOME_TILE_SIZE));
+    BiomeTile &tile = BIOME_TILES[cell_hash(seed, tx, tz, 0) & (BIOME_TILE_CACHE - 1)];
+    if(!tile.filled || tile.tx != tx || tile.tz != tz || tile.seed != seed) {
+        fill_biome_tile(tile, seed, tx, tz);
+    }
+    return tile;
+}
+
+//Blend weight of each candidate at (x, z), summing to 1. T is float for
+//sampling and double for the reference.
+template <typename T>
+void biome_weights(const BiomeTile &tile, T x, T z, T* weights) {
+    //Squared distances first; away from borders only the nearest needs a square root
+    T nearest2 = 1e30;
+    for(int c = 0; c < tile.count; ++c) {
+        T dx = x - tile.xs[c];
+        T dz = z - tile.zs[c];
+        weights[c] = dx * dx + dz * dz;
+        nearest2 = weights[c] < nearest2 ? weights[c] : nearest2;
+    }
+    T nearest = std::sqrt(nearest2);
+    T cutoff2 = (nearest + BIOME_BLEND) * (nearest + BIOME_BLEND);
+    T total = 0;
+    for(int c = 0; c < tile.count; ++c) {
+        if(weights[c] >= cutoff2) {
+            weights[c] = 0;
+            continue;
+        }
+        T t = 1 - (std::sqrt(weights[c]) - nearest) / BIOME_BLEND;
+        weights[c] = t * t;
+        total += weights[c];
+    }
+    for(int c = 0; c < tile.count; ++c) {
+        weights[c] /= total;
+    }
+}
+
+//biome_weights for a run of points in one tile, candidate by candidate so
+//the loops over points vectorize, then straight into the parameters
+void biome_blend_run(const BiomeTile &tile, const float* xs, const float* zs, float* const* params, size_t n) {
+    float weights[BIOME_MAX_CANDIDATES][BIOME_RUN];
+    float nearest[BIOME_RUN];
+    float total[BIOME_RUN];
+    for(size_t i = 0; i < n; ++i) {
+        nearest[i] = 1e30f;
+        total[i] = 0.0f;
+    }
+    for(int c = 0; c < tile.count; ++c) {
+        float* w = weights[c];
+        for(size_t i = 0; i < n; ++i) {
+            float dx = xs[i] - tile.xs[c];
+            float dz = zs[i] - tile.zs[c];
+            w[i] = dx * dx + dz * dz;
+            nearest[i] = std::min(nearest[i], w[i]);
+        }
+    }
+    for(size_t i = 0; i < n; ++i) {
+        nearest[i] = std::sqrt(nearest[i]);
+    }
+    for(int c = 0; c < tile.count; ++c) {
+        float* w = weights[c];
+        for(size_t i = 0; i < n; ++i) {
+            float t = std::max(0.0f, 1.0f - (std::sqrt(w[i]) - nearest[i]) * (1.0f / BIOME_BLEND));
+            w[i] = t * t;
+            total[i] += w[i];
+        }
+    }
+    for(size_t i = 0; i < n; ++i) {
+        total[i] = 1.0f / total[i];
+    }
+    for(int p = 0; p < BIOME_PARAM_COUNT; ++p) {
+        if(params[p] == NULL) {
+            continue;
+        }
+        float* out = params[p];
+        for(size_t i = 0; i < n; ++i) {
+            out[i] = 0.0f;
+        }
+        for(int c = 0; c < tile.count; ++c) {
+            const float* w = weights[c];
+            float value = BIOMES[tile.biomes[c]].params[p];
+            for(size_t i = 0; i < n; ++i) {
+                out[i] += w[i] * value;
+            }
+        }
+        for(size_t i = 0; i < n; ++i) {
+            out[i] *= total[i];
+        }
+    }
+}
+
+void biome_sample_batch(uint64_t seed, const float* xs, const float* zs, float* const* params, size_t n) {
+    float* run_params[BIOME_PARAM_COUNT];
+    size_t i = 0;
+    while(i < n) {
+        //Batches are mostly rows of nearby points, so take as many as stay in this tile
+        const BiomeTile &tile = biome_tile(seed, xs[i], zs[i]);
+        float x0 = tile.tx * BIOME_TILE_SIZE;
+        float z0 = tile.tz * BIOME_TILE_SIZE;
+        size_t end = i + 1;
+        while(end < n && end - i < BIOME_RUN && xs[end] >= x0 && xs[end] < x0 + BIOME_TILE_SIZE &&
+            zs[end] >= z0 && zs[end] < z0 + BIOME_TILE_SIZE) {
+            end++;
+        }
+        for(int p = 0; p < BIOME_PARAM_COUNT; ++p) {
+            run_params[p] = params[p] != NULL ? params[p] + i : NULL;
+        }
+        if(tile.count == 1) {
+            //About a third of tiles lie away from every blend band
+            for(int p = 0; p < BIOME_PARAM_COUNT; ++p) {
+                if(run_params[p] != NULL) {
+                    std::fill(run_params[p], run_params[p] + (end - i), BIOMES[tile.biomes[0]].params[p]);
+                }
+            }
+        } else {
+            biome_blend_run(tile, xs + i, zs + i, run_params, end - i);
+        }
+        i = end;
+    }
+}
+
+int biome_at(uint64_t seed, float x, float z) {
+    const BiomeTile &tile = biome_tile(seed, x, z);
+    int nearest = 0;
+    float best = 1e30f;
+    for(int c = 0; c < tile.count; ++c) {
+        float dx = x - tile.xs[c];
+        float dz = z - tile.zs[c];
+        if(dx * dx + dz * dz < best) {
+            best = dx * dx + dz * dz;
+            nearest = c;
+        }
+    }
+    return tile.biomes[nearest];
+}
+
+double biome_param_reference(uint64_t seed, double x, double z, int param) {
+    const BiomeTile &tile = biome_tile(seed, static_cast<float>(x), static_cast<float>(z));
+    double weights[BIOME_MAX_CANDIDATES];
+    biome_weights(tile, x, z, weights);
+    double value = 0.0;
+    for(int c = 0; c < tile.count; ++c) {
+        value += weights[c] * BIOMES[tile.biomes[c]].params[param];
+    }
+    return value;
+}
+
+#endif
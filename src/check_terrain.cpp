@@ -0,0 +1,688 @@
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <tuple>
+#include <vector>
+
+#define CPU_DISPATCH_IMP
+#include "cpu_dispatch.hpp"
+
+#define PERLIN_IMP
+#include "perlin.h"
+
+#define FRACTAL_IMP
+#include "fractal.hpp"
+
+#define BIOME_IMP
+#include "biome.hpp"
+
+#define EROSION_IMP
+#include "erosion.hpp"
+
+#define WORLDGEN_IMP
+#include "worldgen.hpp"
+
+#define TERRAIN_IMP
+#include "terrain.hpp"
+
+#define HEIGHT_CACHE_IMP
+#include "heightcache.hpp"
+
+#define HEIGHT_QUERY_IMP
+#include "heightquery.hpp"
+
+#define VOXELS_IMP
+#include "voxels.hpp"
+
+#define WFC_IMP
+#include "wfc.hpp"
+
+#define STRUCTURES_IMP
+#include "structures.hpp"
+
+#define GREEDY_MESH_IMP
+#include "greedymesh.hpp"
+
+#define COLUMN_MESH_IMP
+#include "columnmesh.hpp"
+
+#define HEIGHT_MESH_IMP
+#include "heightmesh.hpp"
+
+//Checks the promises the terrain code makes about itself. Prints each
+//failure and exits non-zero if there were any.
+//
+//The float heightfield stays within NOISE_WRAP_TOLERANCE of the double formula.
+//The 2D Perlin kernel gives what the 3D one does at z = 0.
+//Seed 0 gives Ken Perlin's classic permutation.
+//At every SIMD level this CPU runs, the batched kernels give bit for bit
+//what the scalar code does, and the heights what the scalar level's do.
+//Bilinear height lookups stay within HEIGHT_BILINEAR_TOLERANCE of noise_wrap.
+//HeightCache::bounds agrees with a brute-force scan, edits and clears included.
+//No biome tile has more sites within reach than it has room for.
+//PaletteVoxels keeps its blocks as its indices widen and entries are reused.
+//Solved WFC grids break none of their rules, and solve alike on any thread count.
+//The greedy mesher's quads cover each block face against air exactly once,
+//and so do the column mesher's for a chunk of solid columns.
+//Merged heightfield polygons cover each cell once and share every vertex
+//along their common edges, so no T-junction can crack.
+//
+//    check_terrain        (from the repository root, for TERRAIN_GRAPH_PATH)
+
+int FAILURES = 0;
+
+void check(bool ok, const char* what) {
+    if(!ok) {
+        std::fprintf(stderr, "FAILED: %s\n", what);
+        FAILURES++;
+    }
+}
+
+bool same_bits(float a, float b) {
+    return std::memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+bool same_bits(double a, double b) {
+    return std::memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+//Points spread over a few thousand blocks, including negative ones and
+//lattice-aligned ones; n isn't a multiple of any register width so the tails run too
+void fill_points(std::vector<float> &xs, std::vector<float> &zs, size_t n) {
+    xs.resize(n);
+    zs.resize(n);
+    for(size_t i = 0; i < n; ++i) {
+        xs[i] = static_cast<float>(static_cast<int64_t>(cell_hash(1, static_cast<int>(i), 0, 0) % 800000) - 400000) * 0.01f;
+        zs[i] = i % 5 == 0 ? std::floor(xs[i]) * 0.5f : static_cast<float>(static_cast<int64_t>(cell_hash(2, static_cast<int>(i), 0, 0) % 800000) - 400000) * 0.01f;
+    }
+}
+
+void check_precision() {
+    float error = noise_wrap_precision_error(2000.0f, 200);
+    std::printf("noise_wrap precision error %g (tolerance %g)\n", error, NOISE_WRAP_TOLERANCE);
+    check(error <= NOISE_WRAP_TOLERANCE, "noise_wrap_precision_error <= NOISE_WRAP_TOLERANCE");
+}
+
+//The 2D kernel is the 3D one at z = 0 with its dead layer left out
+void check_flat_noise() {
+    std::vector<float> xs, zs;
+    fill_points(xs, zs, 1031);
+    PerlinF perlinf(1234);
+    Perlin perlind(1234);
+    bool flatf = true, flatd = true;
+    for(size_t i = 0; i < xs.size(); ++i) {
+        double x = xs[i];
+        double z = zs[i];
+        flatf = flatf && same_bits(perlinf.noise(xs[i], zs[i]), perlinf.noise(xs[i], zs[i], 0.0f));
+        flatd = flatd && same_bits(perlind.noise(x, z), perlind.noise(x, z, 0.0));
+    }
+    check(flatf && flatd, "noise(x, y) == noise(x, y, 0)");
+}
+
+void check_permutation() {
+    //The start of Ken Perlin's reference table
+    const uint8_t classic[16] = { 151, 160, 137, 91, 90, 15, 131, 13, 201, 95, 96, 53, 194, 233, 7, 225 };
+    PermutationTable table = make_permutation(PERLIN_DEFAULT_SEED);
+    bool same = true;
+    for(int i = 0; i < 16; ++i) {
+        same = same && table.p[i] == classic[i] && table.p[256 + i] == classic[i];
+    }
+    check(same, "seed 0 permutation is the classic table");
+    check(std::memcmp(table.p, PERLIN_DEFAULT_PERMUTATION.p, 512) == 0, "make_permutation(0) == PERLIN_DEFAULT_PERMUTATION");
+}
+
+//Everything batched at level against the scalar code, and the heights
+//against reference, the same batch at the scalar level
+void check_level(SimdLevel level, const std::vector<float> &reference) {
+    const size_t n = 1031;
+    std::vector<float> xs, zs;
+    fill_points(xs, zs, n);
+    std::vector<double> xd(xs.begin(), xs.end());
+    std::vector<double> zd(zs.begin(), zs.end());
+    std::vector<float> ys(n);
+    std::vector<double> yd(n);
+    for(size_t i = 0; i < n; ++i) {
+        ys[i] = (i % 7) * 1.25f;
+        yd[i] = ys[i];
+    }
+    PerlinF perlinf(1234);
+    Perlin perlind(1234);
+    std::vector<float> outf(n);
+    std::vector<double> outd(n);
+    char what[128];
+
+    perlinf.noise_batch(xs.data(), zs.data(), outf.data(), static_cast<int>(n));
+    perlind.noise_batch(xd.data(), zd.data(), outd.data(), static_cast<int>(n));
+    bool noise2f = true, noise2d = true;
+    for(size_t i = 0; i < n; ++i) {
+        noise2f = noise2f && same_bits(outf[i], perlinf.noise(xs[i], zs[i]));
+        noise2d = noise2d && same_bits(outd[i], perlind.noise(xd[i], zd[i]));
+    }
+    std::snprintf(what, sizeof(what), "%s: float noise_batch(x, y) == noise(x, y)", simd_level_name(level));
+    check(noise2f, what);
+    std::snprintf(what, sizeof(what), "%s: double noise_batch(x, y) == noise(x, y)", simd_level_name(level));
+    check(noise2d, what);
+
+    perlinf.noise_batch(xs.data(), ys.data(), zs.data(), outf.data(), static_cast<int>(n));
+    perlind.noise_batch(xd.data(), yd.data(), zd.data(), outd.data(), static_cast<int>(n));
+    bool noise3f = true, noise3d = true;
+    for(size_t i = 0; i < n; ++i) {
+        noise3f = noise3f && same_bits(outf[i], perlinf.noise(xs[i], ys[i], zs[i]));
+        noise3d = noise3d && same_bits(outd[i], perlind.noise(xd[i], yd[i], zd[i]));
+    }
+    std::snprintf(what, sizeof(what), "%s: noise_batch(x, y, z) == noise(x, y, z)", simd_level_name(level));
+    check(noise3f && noise3d, what);
+
+    FractalNoise fractal = FractalNoise::fbm(5, 1.0f/50.3f, 30.0f, 2.0f, 0.5f);
+    fractal.sample_batch(perlinf, xs.data(), zs.data(), outf.data(), n);
+    bool fbm = true;
+    for(size_t i = 0; i < n; ++i) {
+        fbm = fbm && same_bits(outf[i], fractal.sample(perlinf, xs[i], zs[i]));
+    }
+    std::snprintf(what, sizeof(what), "%s: FractalNoise::sample_batch == sample", simd_level_name(level));
+    check(fbm, what);
+
+    noise_wrap_batch(xs.data(), zs.data(), outf.data(), n);
+    bool heights = true, levels = true;
+    for(size_t i = 0; i < n; ++i) {
+        heights = heights && same_bits(outf[i], noise_wrap(xs[i], zs[i]));
+        levels = levels && same_bits(outf[i], reference[i]);
+    }
+    std::snprintf(what, sizeof(what), "%s: noise_wrap_batch == noise_wrap", simd_level_name(level));
+    check(heights, what);
+    std::snprintf(what, sizeof(what), "%s: noise_wrap_batch == the scalar level's", simd_level_name(level));
+    check(levels, what);
+}
+
+void check_simd_levels() {
+    std::vector<float> xs, zs;
+    fill_points(xs, zs, 1031);
+    std::vector<float> reference(xs.size());
+    force_simd_level(SIMD_SCALAR);
+    noise_wrap_batch(xs.data(), zs.data(), reference.data(), reference.size());
+    for(int l = SIMD_SCALAR; l <= detect_simd_level(); ++l) {
+        SimdLevel level = static_cast<SimdLevel>(l);
+        check(force_simd_level(level), "force_simd_level to a detected level");
+        std::printf("checking kernels at %s\n", simd_level_name(level));
+        check_level(level, reference);
+    }
+    force_simd_level(detect_simd_level());
+}
+
+//bilinear() against noise_wrap at random points around the origin
+void check_bilinear() {
+    HeightQuery query(0);
+    float worst = 0.0f;
+    for(int i = 0; i < 4000; ++i) {
+        float x = static_cast<float>(static_cast<int64_t>(cell_hash(9, i, 0, 0) % 120000) - 60000) * 0.01f;
+        float z = static_cast<float>(static_cast<int64_t>(cell_hash(10, i, 0, 0) % 120000) - 60000) * 0.01f;
+        worst = std::max(worst, std::fabs(query.bilinear(x, z) - noise_wrap(x, z)));
+    }
+    std::printf("bilinear height error %g (tolerance %g)\n", worst, HEIGHT_BILINEAR_TOLERANCE);
+    check(worst <= HEIGHT_BILINEAR_TOLERANCE, "bilinear height error <= HEIGHT_BILINEAR_TOLERANCE");
+}
+
+//HeightCache::bounds against the min and max of every sample in random
+//rectangles, some inside a tile and some across several
+bool bounds_match(int lod, int rounds) {
+    std::vector<float> heights;
+    for(int r = 0; r < rounds; ++r) {
+        int lx0 = static_cast<int>(cell_hash(3, r, lod, 0) % 400) - 200;
+        int lz0 = static_cast<int>(cell_hash(4, r, lod, 0) % 400) - 200;
+        int span = r % 2 == 0 ? 8 : 150;
+        int lx1 = lx0 + static_cast<int>(cell_hash(5, r, lod, 0) % span);
+        int lz1 = lz0 + static_cast<int>(cell_hash(6, r, lod, 0) % span);
+        int width = lx1 - lx0 + 1;
+        int depth = lz1 - lz0 + 1;
+        heights.resize(static_cast<size_t>(width) * depth);
+        HEIGHT_CACHE.sample_lattice(lod, lx0, lz0, 1, width, depth, heights.data(), NULL);
+        HeightBounds expected = HeightBounds::empty();
+        for(float h : heights) {
+            expected.merge(h, h);
+        }
+        HeightBounds found = HEIGHT_CACHE.bounds(lod, lx0, lz0, lx1, lz1);
+        if(!same_bits(found.min, expected.min) || !same_bits(found.max, expected.max)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void check_height_bounds() {
+    for(int lod = 0; lod < HEIGHT_LOD_COUNT; ++lod) {
+        check(bounds_match(lod, 64), "HeightCache::bounds == brute-force min/max");
+    }
+    //Edits land in cached tiles and in ones sampled after them
+    for(int e = 0; e < 32; ++e) {
+        int lx = static_cast<int>(cell_hash(7, e, 0, 0) % 400) - 200;
+        int lz = static_cast<int>(cell_hash(8, e, 0, 0) % 400) - 200;
+        HEIGHT_CACHE.set_height(lx, lz, e % 2 == 0 ? 500.0f + e : -500.0f - e);
+    }
+    for(int lod = 0; lod < HEIGHT_LOD_COUNT; ++lod) {
+        check(bounds_match(lod, 64), "HeightCache::bounds == brute-force min/max after edits");
+    }
+    HEIGHT_CACHE.clear();
+    for(int lod = 0; lod < HEIGHT_LOD_COUNT; ++lod) {
+        check(bounds_match(lod, 64), "HeightCache::bounds == brute-force min/max after clear");
+    }
+}
+
+//Every site within reach of a tile fits in it, over tiles spanning many cells
+void check_biome_tiles() {
+    BiomeTile tile;
+    int most = 0;
+    for(uint64_t seed = 0; seed < 4; ++seed) {
+        for(int tx = -120; tx < 120; ++tx) {
+            for(int tz = -120; tz < 120; ++tz) {
+                most = std::max(most, fill_biome_tile(tile, seed * 0x9E3779B97F4A7C15ull, tx, tz));
+            }
+        }
+    }
+    std::printf("biome sites within reach of a tile %d (room for %d)\n", most, BIOME_MAX_CANDIDATES);
+    check(most <= BIOME_MAX_CANDIDATES, "biome tile candidates <= BIOME_MAX_CANDIDATES");
+}
+
+//Random blocks from ever more types, against a plain array of them
+void check_palette_voxels() {
+    const int width = 16, height = 64, depth = 16;
+    PaletteVoxels voxels(width, height, depth);
+    std::vector<int16_t> expected(static_cast<size_t>(width) * height * depth, BLOCK_AIR);
+    auto matches = [&]() {
+        for(int x = 0; x < width; ++x) {
+            for(int y = 0; y < height; ++y) {
+                for(int z = 0; z < depth; ++z) {
+                    if(voxels.get(x, y, z) != expected[voxels.index(x, y, z)]) {
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    };
+
+    int widths_seen = 0;
+    int last_bits = voxels.bits();
+    bool round_trips = true;
+    bool sets = true;
+    //Air plus 255 types fills the palette. Each new type gets a voxel of its
+    //own on the bottom layer, which the random ones above never overwrite.
+    for(int types = 2; types <= VOXEL_PALETTE_MAX; ++types) {
+        int16_t newest = static_cast<int16_t>(types - 2);
+        sets = sets && voxels.set(newest % width, 0, newest / width, newest);
+        expected[voxels.index(newest % width, 0, newest / width)] = newest;
+        for(int i = 0; i < 64; ++i) {
+            uint64_t h = cell_hash(9, types, i, 0);
+            int x = static_cast<int>(h % width);
+            int y = 1 + static_cast<int>((h >> 8) % (height - 1));
+            int z = static_cast<int>((h >> 16) % depth);
+            int16_t block = static_cast<int16_t>((h >> 24) % (types - 1));
+            sets = sets && voxels.set(x, y, z, block);
+            expected[voxels.index(x, y, z)] = block;
+        }
+        if(voxels.bits() != last_bits) {
+            last_bits = voxels.bits();
+            widths_seen++;
+            round_trips = round_trips && matches();
+        }
+    }
+    check(sets, "PaletteVoxels::set while the palette has room");
+    check(widths_seen == 3 && voxels.bits() == 8, "PaletteVoxels widens 1 -> 2 -> 4 -> 8 bits");
+    check(round_trips && matches(), "PaletteVoxels keeps its blocks across widenings");
+
+    //With every entry in use a new type doesn't fit, until one is freed
+    check(voxels.types() == VOXEL_PALETTE_MAX && !voxels.set(0, 0, 0, 1000) && matches(),
+        "PaletteVoxels refuses a type past VOXEL_PALETTE_MAX");
+    for(int x = 0; x < width; ++x) {
+        for(int z = 0; z < depth; ++z) {
+            for(int y = 0; y < height; ++y) {
+                if(voxels.get(x, y, z) == STONE) {
+                    voxels.set(x, y, z, BLOCK_AIR);
+                    expected[voxels.index(x, y, z)] = BLOCK_AIR;
+                }
+            }
+        }
+    }
+    bool reused = voxels.set(1, 2, 3, 1000);
+    expected[voxels.index(1, 2, 3)] = 1000;
+    check(reused && voxels.bits() == 8 && matches(), "PaletteVoxels reuses a freed palette entry");
+
+    //fill_column against the same array
+    bool filled = voxels.fill_column(5, 7, 10, 50, 1000);
+    for(int y = 10; y < 50; ++y) {
+        expected[voxels.index(5, y, 7)] = 1000;
+    }
+    check(filled && matches(), "PaletteVoxels::fill_column");
+}
+
+//Whether every cell of grid is solved, within its starting domain, and
+//allows each of its neighbours on that side
+bool wfc_satisfied(const WfcRules &rules, const WfcGrid &grid) {
+    const int steps[WFC_DIRECTIONS][3] = { { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+    for(int x = 0; x < grid.width; ++x) {
+        for(int y = 0; y < grid.height; ++y) {
+            for(int z = 0; z < grid.depth; ++z) {
+                int tile = grid.tile(x, y, z);
+                if(tile < 0 || !grid.constraints[grid.index(x, y, z)].test(tile)) {
+                    return false;
+                }
+                for(int d = 0; d < WFC_DIRECTIONS; ++d) {
+                    int nx = x + steps[d][0];
+                    int ny = y + steps[d][1];
+                    int nz = z + steps[d][2];
+                    if(nx < 0 || ny < 0 || nz < 0 || nx >= grid.width || ny >= grid.height || nz >= grid.depth) {
+                        continue;
+                    }
+                    if(!rules.allowed(tile, d).test(grid.tile(nx, ny, nz))) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+//Ruin layouts as build_ruin solves them, then regions with pillars pinned
+//to their corners solved on one thread and on several
+void check_wfc() {
+    bool solved = true, satisfied = true;
+    for(int seed = 0; seed < 32; ++seed) {
+        WfcGrid grid;
+        grid.reset(RUIN_RULES, RUIN_SIZE, RUIN_HEIGHT, RUIN_SIZE);
+        bool ok = wfc_solve(RUIN_RULES, grid, cell_hash(seed, 0, 0, RNG_STREAM_RUIN));
+        solved = solved && ok;
+        satisfied = satisfied && ok && wfc_satisfied(RUIN_RULES, grid);
+    }
+    check(solved, "wfc_solve solves ruin grids");
+    check(satisfied, "solved ruin grids keep every adjacency rule");
+
+    std::vector<WfcRegion> single(8), several;
+    for(int r = 0; r < static_cast<int>(single.size()); ++r) {
+        WfcRegion &region = single[r];
+        region.x = r;
+        region.y = 0;
+        region.z = -r;
+        region.grid.reset(RUIN_RULES, 9, 4, 9);
+        for(int corner = 0; corner < 4; ++corner) {
+            region.grid.restrict(corner % 2 * 8, 0, corner / 2 * 8, WfcDomain::only(RUIN_PILLAR));
+        }
+    }
+    several = single;
+    wfc_solve_regions(RUIN_RULES, single, 5, 1);
+    wfc_solve_regions(RUIN_RULES, several, 5, 4);
+    bool regions = true, alike = true;
+    for(size_t r = 0; r < single.size(); ++r) {
+        regions = regions && single[r].solved && wfc_satisfied(RUIN_RULES, single[r].grid);
+        alike = alike && several[r].solved == single[r].solved && several[r].grid.tiles == single[r].grid.tiles;
+    }
+    check(regions, "wfc_solve_regions keeps every adjacency rule and restriction");
+    check(alike, "wfc_solve_regions gives the same tiles on 1 and 4 threads");
+}
+
+//One block face: side, x, y, z and block
+typedef std::tuple<int, int, int, int, int> UnitFace;
+
+//Every block face quads cover, once for each quad covering it
+void unit_faces(const std::vector<GreedyQuad> &quads, std::multiset<UnitFace> &faces) {
+    for(const GreedyQuad &quad : quads) {
+        for(int x = quad.x; x < quad.x + quad.size_x; ++x) {
+            for(int y = quad.y; y < quad.y + quad.size_y; ++y) {
+                for(int z = quad.z; z < quad.z + quad.size_z; ++z) {
+                    faces.insert(UnitFace(quad.side, x, y, z, quad.block));
+                }
+            }
+        }
+    }
+}
+
+//Whether (x, y, z) is solid, in voxels or, past its edges, in the neighbour there
+bool chunk_solid(const ChunkVoxels &voxels, const GreedyNeighbours &neighbours, int x, int y, int z) {
+    const ChunkVoxels* other = &voxels;
+    if(x < 0) {
+        other = neighbours.sides[LEFT];
+        x += voxels.width;
+    } else if(x >= voxels.width) {
+        other = neighbours.sides[RIGHT];
+        x -= voxels.width;
+    } else if(z >= voxels.depth) {
+        other = neighbours.sides[FORWARD];
+        z -= voxels.depth;
+    } else if(z < 0) {
+        other = neighbours.sides[BACK];
+        z += voxels.depth;
+    }
+    return other != NULL && other->solid(x, y, z);
+}
+
+//Each face of voxels' blocks against air, one at a time, from the lowest
+//section voxels or a neighbour stores up
+void exposed_faces(const ChunkVoxels &voxels, const GreedyNeighbours &neighbours, std::multiset<UnitFace> &faces) {
+    const int steps[6][3] = { { -1, 0, 0 }, { 1, 0, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, 1, 0 }, { 0, -1, 0 } };
+    int lowest = voxels.first;
+    for(const ChunkVoxels* neighbour : neighbours.sides) {
+        if(neighbour != NULL && !neighbour->sections.empty()) {
+            lowest = std::min(lowest, neighbour->first);
+        }
+    }
+    int y0 = lowest * voxels.section_height;
+    int y1 = (voxels.first + static_cast<int>(voxels.sections.size())) * voxels.section_height;
+    for(int x = 0; x < voxels.width; ++x) {
+        for(int y = y0; y < y1; ++y) {
+            for(int z = 0; z < voxels.depth; ++z) {
+                if(!voxels.solid(x, y, z)) {
+                    continue;
+                }
+                for(int side = LEFT; side <= BOTTOM; ++side) {
+                    if(!chunk_solid(voxels, neighbours, x + steps[side][0], y + steps[side][1], z + steps[side][2])) {
+                        faces.insert(UnitFace(side, x, y, z, voxels.get(x, y, z)));
+                    }
+                }
+            }
+        }
+    }
+}
+
+//Columns of a few block types up to random heights in sections first to
+//last, with pockets of air and the odd floating block
+void random_voxels(ChunkVoxels &voxels, int seed, int first, int last) {
+    const int size = 16, section_height = 32;
+    voxels.reset(size, section_height, size, first, last);
+    int y0 = first * section_height;
+    int span = (last - first + 1) * section_height;
+    for(int x = 0; x < size; ++x) {
+        for(int z = 0; z < size; ++z) {
+            uint64_t h = cell_hash(seed, x, z, 10);
+            int top = y0 + static_cast<int>(h % span);
+            voxels.fill_column(x, z, y0, top, static_cast<int16_t>((h >> 16) % 3));
+            voxels.set(x, top, z, static_cast<int16_t>((h >> 24) % 3));
+        }
+    }
+    for(int i = 0; i < 200; ++i) {
+        uint64_t h = cell_hash(seed, i, 0, 11);
+        voxels.set(static_cast<int>(h % size), y0 + static_cast<int>((h >> 8) % span), static_cast<int>((h >> 16) % size),
+            i % 2 == 0 ? BLOCK_AIR : static_cast<int16_t>(GRASS));
+    }
+}
+
+//Chunks against neighbours on every side, some storing sections lower or
+//higher than the chunk and some missing
+void check_greedy_mesh() {
+    bool exact = true;
+    for(int round = 0; round < 16; ++round) {
+        ChunkVoxels voxels;
+        random_voxels(voxels, round, round % 3 - 1, round % 3);
+        ChunkVoxels sides[4];
+        GreedyNeighbours neighbours;
+        for(int side = LEFT; side <= BACK; ++side) {
+            int first = static_cast<int>(cell_hash(round, side, 0, 12) % 4) - 2;
+            random_voxels(sides[side], round * 4 + side + 100, first, first + 1);
+            neighbours.sides[side] = (round + side) % 5 == 0 ? NULL : &sides[side];
+        }
+        std::vector<GreedyQuad> quads;
+        greedy_mesh(voxels, neighbours, quads);
+        std::multiset<UnitFace> meshed, expected;
+        unit_faces(quads, meshed);
+        exposed_faces(voxels, neighbours, expected);
+        exact = exact && meshed == expected;
+    }
+    check(exact, "greedy_mesh covers exactly the exposed block faces");
+}
+
+//Top block of world column (x, z): rolling ground with cliffs tens of blocks high
+int check_column_top(int x, int z) {
+    int cliff = cell_hash(13, floor_div(x, 5), floor_div(z, 7), 0) % 4 == 0 ? 70 : 0;
+    return static_cast<int>(cell_hash(14, x, z, 0) % 6) + (x + z) / 3 + cliff - 20;
+}
+
+//Chunk (cx, cz) of check_column_top's columns as voxels: a block of type 1
+//on top of each and stone under it
+void column_voxels(ChunkVoxels &voxels, int cx, int cz) {
+    const int size = 16, section_height = 32;
+    int low = INT_MAX, high = INT_MIN;
+    for(int x = 0; x < size; ++x) {
+        for(int z = 0; z < size; ++z) {
+            int top = check_column_top(cx * size + x, cz * size + z);
+            low = std::min(low, top);
+            high = std::max(high, top);
+        }
+    }
+    voxels.reset(size, section_height, size, floor_div(low, section_height), floor_div(high, section_height));
+    for(int x = 0; x < size; ++x) {
+        for(int z = 0; z < size; ++z) {
+            int top = check_column_top(cx * size + x, cz * size + z);
+            voxels.fill_column(x, z, voxels.first * section_height, top, STONE);
+            voxels.set(x, top, z, 1);
+        }
+    }
+}
+
+//column_mesh against the exposed faces of the same columns as voxels
+void check_column_mesh() {
+    const int size = 16;
+    const int steps[4][2] = { { -1, 0 }, { 1, 0 }, { 0, 1 }, { 0, -1 } };
+    bool exact = true;
+    for(int cx = -2; cx < 2; ++cx) {
+        for(int cz = -2; cz < 2; ++cz) {
+            ColumnHeights heights;
+            heights.reset(size, size);
+            for(int x = -1; x <= size; ++x) {
+                for(int z = -1; z <= size; ++z) {
+                    heights.top(x, z) = check_column_top(cx * size + x, cz * size + z);
+                }
+            }
+            for(int16_t &block : heights.blocks) {
+                block = 1;
+            }
+            std::vector<GreedyQuad> quads;
+            column_mesh(heights, quads);
+
+            ChunkVoxels voxels;
+            column_voxels(voxels, cx, cz);
+            ChunkVoxels sides[4];
+            GreedyNeighbours neighbours;
+            for(int side = LEFT; side <= BACK; ++side) {
+                column_voxels(sides[side], cx + steps[side][0], cz + steps[side][1]);
+                neighbours.sides[side] = &sides[side];
+            }
+            std::multiset<UnitFace> meshed, expected;
+            unit_faces(quads, meshed);
+            exposed_faces(voxels, neighbours, expected);
+            exact = exact && meshed == expected;
+        }
+    }
+    check(exact, "column_mesh covers exactly the exposed faces of its columns");
+}
+
+//merge_height_cells over terrain at a few places: cells each in one quad of
+//their material, every outline edge inside the grid matched by the reverse
+//edge of a neighbouring outline, and triangles filling each outline
+void check_height_merge() {
+    bool covered = true, shared = true, filled = true;
+    for(int place = 0; place < 8; ++place) {
+        TerrainCornerGrid grid;
+        fill_corner_grid(grid, place * 97.0f - 400.5f, place * -61.0f + 100.5f, 32, 32, 1.0f);
+        HeightMerge merge;
+        merge_height_cells(grid, HEIGHT_MERGE_TOLERANCE, merge);
+
+        std::vector<int> cover(static_cast<size_t>(grid.width) * grid.depth, 0);
+        std::map<std::pair<std::pair<int, int>, std::pair<int, int>>, int> edges;
+        HeightOutline outline;
+        std::vector<int> triangles;
+        for(const HeightQuad &quad : merge.quads) {
+            for(int x = quad.x; x < quad.x + quad.width; ++x) {
+                for(int z = quad.z; z < quad.z + quad.depth; ++z) {
+                    cover[x * grid.depth + z]++;
+                    covered = covered && grid.material(x, z) == quad.material;
+                }
+            }
+            height_quad_outline(merge, quad, outline);
+            for(size_t c = 0; c < outline.size(); ++c) {
+                edges[{ outline[c], outline[(c + 1) % outline.size()] }]++;
+            }
+
+            //Twice the signed area of each triangle, in the outline's winding
+            height_quad_triangles(quad, outline, triangles);
+            float area = 0.0f;
+            for(size_t t = 0; t + 2 < triangles.size(); t += 3) {
+                float px[3], pz[3];
+                for(int k = 0; k < 3; ++k) {
+                    int index = triangles[t + k];
+                    bool middle = index == static_cast<int>(outline.size());
+                    px[k] = middle ? quad.x + quad.width * 0.5f : static_cast<float>(outline[index].first);
+                    pz[k] = middle ? quad.z + quad.depth * 0.5f : static_cast<float>(outline[index].second);
+                }
+                float twice = (px[1] - px[0]) * (pz[2] - pz[0]) - (pz[1] - pz[0]) * (px[2] - px[0]);
+                filled = filled && twice > 0.0f;
+                area += twice;
+            }
+            filled = filled && area == 2.0f * quad.width * quad.depth;
+        }
+        for(int count : cover) {
+            covered = covered && count == 1;
+        }
+        for(const auto &edge : edges) {
+            std::pair<int, int> a = edge.first.first;
+            std::pair<int, int> b = edge.first.second;
+            bool boundary = (a.first == b.first && (a.first == 0 || a.first == grid.width)) ||
+                (a.second == b.second && (a.second == 0 || a.second == grid.depth));
+            if(boundary) {
+                //Every corner on the grid's edge is kept
+                shared = shared && edge.second == 1 && std::abs(a.first - b.first) + std::abs(a.second - b.second) == 1;
+            } else {
+                auto reverse = edges.find({ b, a });
+                shared = shared && edge.second == 1 && reverse != edges.end() && reverse->second == 1;
+            }
+        }
+    }
+    check(covered, "merge_height_cells covers each cell once, with its material");
+    check(shared, "merged outlines share every vertex along common edges");
+    check(filled, "height_quad_triangles fill each outline, in its winding");
+}
+
+int main() {
+    if(!load_terrain_graph(TERRAIN_GRAPH_PATH)) {
+        return EXIT_FAILURE;
+    }
+    check_precision();
+    check_flat_noise();
+    check_permutation();
+    check_simd_levels();
+    check_bilinear();
+    check_height_bounds();
+    check_biome_tiles();
+    check_palette_voxels();
+    check_wfc();
+    check_greedy_mesh();
+    check_column_mesh();
+    check_height_merge();
+    if(FAILURES > 0) {
+        std::fprintf(stderr, "%d checks failed\n", FAILURES);
+        return EXIT_FAILURE;
+    }
+    std::printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,401 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hashrng.hpp"
+#include "heightcache.hpp"
+#include "structures.hpp"
+#include "voxels.hpp"
+
+//Chunks are produced in stages: corner heights, then surface materials, then
+//the structure blocks reaching into them, then their voxels, then the mesh. Each chunk records
+//how many of its stages are done, and each stage declares which stages of
+//which neighbouring chunks it reads besides the chunk's own earlier ones.
+//
+//build() works out every chunk and stage a set of chunks needs, then runs
+//each stage on a pool of threads as soon as what it reads is done. Finished
+//stages are kept, so a chunk that was only built up to its structures as
+//some other chunk's neighbour, or one the camera left and came back to,
+//picks up where it stopped instead of starting over. Chunks no build has
+//wanted for a while are dropped once there are more than the capacity.
+
+#define CHUNK_PIPELINE_CAPACITY 256
+
+enum ChunkStage {
+    CHUNK_HEIGHTS,      //corner heights and their bounds
+    CHUNK_MATERIALS,    //centre heights and surface materials
+    CHUNK_STRUCTURES,   //blocks of trees and ruins inside the chunk
+    CHUNK_VOXELS,       //every block from the terrain and structures, palette-packed
+    CHUNK_MESH,         //vertices and uvs, ready to upload
+    CHUNK_STAGE_COUNT
+};
+
+struct ChunkData {
+    int x, z;           //chunk coordinates
+    int done;           //stages finished, in order
+    TerrainCornerGrid terrain;
+    HeightBounds bounds;
+    std::vector<StructureBlock> structures;
+    //Shared with whoever still reads the chunk's blocks after the pipeline drops it
+    std::shared_ptr<const ChunkVoxels> voxels;
+    std::vector<float> verts;
+    std::vector<float> uvs;
+
+    bool has(ChunkStage stage) const { return done > stage; }
+
+private:
+    friend class ChunkPipeline;
+    bool busy;          //a thread is running stage done
+    int wanted;         //stages the current build needs done
+    uint64_t used;      //last build that wanted any of its stages
+};
+
+//stage of chunk (x + dx, z + dz) that has to be done before chunk (x, z)'s stage can run
+struct ChunkDependency {
+    ChunkStage stage;
+    int dx, dz;
+};
+
+class ChunkPipeline;
+
+struct ChunkStageInfo {
+    const char* name;
+    std::vector<ChunkDependency> needs;
+    //Fills in this stage's part of chunk. Neighbours' finished stages named
+    //in needs can be read through pipeline.chunk().
+    std::function<void(ChunkData &chunk, const ChunkPipeline &pipeline)> run;
+};
+
+//build() may be called from any thread, one at a time.
+class ChunkPipeline {
+public:
+    explicit ChunkPipeline(size_t capacity);
+    ~ChunkPipeline();
+
+    void set_stage(ChunkStage stage, ChunkStageInfo info);
+
+    //Brings every chunk in wanted up to and including target, and their
+    //neighbours as far as that needs, on threads threads counting the
+    //caller's. Wanted chunks are started in the order given. The helper
+    //threads are started by the first build that needs them and kept for
+    //the ones after.
+    void build(const std::vector<std::pair<int, int>> &wanted, ChunkStage target, int threads);
+
+    //Chunk (x, z), or NULL if no build has reached it yet. Stays valid until the next build.
+    const ChunkData* chunk(int x, int z) const;
+
+    //Drops every chunk. build() does this itself when HEIGHT_CACHE is cleared;
+    //after HEIGHT_CACHE.set_height it only redoes the chunks the edits reach.
+    void clear();
+
+    //Has the next build run stage and the ones after it again on every chunk
+    //that already did them, e.g. after a setting they read changes
+    void invalidate(ChunkStage stage);
+
+    size_t size() const { return chunks.size(); }
+    //Times each stage has run, all builds together
+    size_t runs(ChunkStage stage) const { return run_count[stage].load(std::memory_order_relaxed); }
+
+private:
+    struct Key {
+        int x, z;
+        bool operator==(const Key &other) const { return x == other.x && z == other.z; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &key) const { return static_cast<size_t>(cell_hash(0, key.x, key.z, 0)); }
+    };
+
+    //Chunk (x, z), made empty if it's new, and marked wanted up to stages by this build
+    ChunkData &want(int x, int z, int stages, std::vector<ChunkData*> &work);
+    //Whether chunk's next stage has everything it reads. Call with mutex held.
+    bool ready(const ChunkData &chunk) const;
+    //Drops the chunks longest unwanted, down to capacity
+    void evict();
+    //Runs ready stages of work until all are done, alongside the other threads
+    void run_stages(std::vector<ChunkData*> &work);
+    //Undoes every stage of the chunks whose corners take in one of the lod 0
+    //points, then the stages of other chunks that read undone ones. Call with mutex held.
+    void invalidate_points(const std::vector<std::pair<int, int>> &points);
+    //What each helper thread runs: waits for a build to hand out work, then
+    //runs stages of it alongside the caller
+    void help();
+
+    size_t capacity;
+    ChunkStageInfo stages[CHUNK_STAGE_COUNT];
+    std::unordered_map<Key, ChunkData, KeyHash> chunks;
+    uint64_t build_count;
+    unsigned int clears;    //HEIGHT_CACHE.clears() the chunks were built after
+    size_t edits;           //HEIGHT_CACHE.edit_count() they take in
+    int invalid_from;       //first stage to undo at the next build
+    std::mutex mutex;
+    std::condition_variable progress;
+    std::atomic<size_t> run_count[CHUNK_STAGE_COUNT];
+
+    std::vector<std::thread> helpers;
+    std::condition_variable wake;       //a build has work for helpers, or they should stop
+    std::vector<ChunkData*>* shared;    //the running build's work, NULL between builds
+    int openings;                       //helpers the running build still takes
+    int helping;                        //helpers inside run_stages
+    bool stopping;
+};
+
+extern ChunkPipeline CHUNK_PIPELINE;
+
+#ifdef CHUNK_PIPELINE_IMP
+
+#include <algorithm>
+
+ChunkPipeline CHUNK_PIPELINE(CHUNK_PIPELINE_CAPACITY);
+
+ChunkPipeline::ChunkPipeline(size_t capacity) : capacity(capacity), build_count(0), clears(0), edits(0), invalid_from(CHUNK_STAGE_COUNT),
+    shared(NULL), openings(0), helping(0), stopping(false) {
+    for(int stage = 0; stage < CHUNK_STAGE_COUNT; ++stage) {
+        stages[stage].name = "";
+        run_count[stage].store(0, std::memory_order_relaxed);
+    }
+}
+
+ChunkPipeline::~ChunkPipeline() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(std::thread &helper : helpers) {
+        helper.join();
+    }
+}
+
+void ChunkPipeline::set_stage(ChunkStage stage, ChunkStageInfo info) {
+    std::lock_guard<std::mutex> lock(mutex);
+    stages[stage] = std::move(info);
+}
+
+const ChunkData* ChunkPipeline::chunk(int x, int z) const {
+    auto found = chunks.find({ x, z });
+    return found == chunks.end() ? NULL : &found->second;
+}
+
+void ChunkPipeline::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    chunks.clear();
+}
+
+void ChunkPipeline::invalidate(ChunkStage stage) {
+    std::lock_guard<std::mutex> lock(mutex);
+    invalid_from = std::min(invalid_from, static_cast<int>(stage));
+}
+
+ChunkData &ChunkPipeline::want(int x, int z, int stages, std::vector<ChunkData*> &work) {
+    auto found = chunks.find({ x, z });
+    if(found == chunks.end()) {
+        found = chunks.emplace(Key{ x, z }, ChunkData()).first;
+        ChunkData &fresh = found->second;
+        fresh.x = x;
+        fresh.z = z;
+        fresh.done = 0;
+        fresh.busy = false;
+        fresh.bounds = HeightBounds::empty();
+        fresh.used = 0;
+    }
+    ChunkData &chunk = found->second;
+    if(chunk.used != build_count) {
+        chunk.used = build_count;
+        chunk.wanted = 0;
+        work.push_back(&chunk);
+    }
+    chunk.wanted = std::max(chunk.wanted, stages);
+    return chunk;
+}
+
+bool ChunkPipeline::ready(const ChunkData &chunk) const {
+    for(const ChunkDependency &need : stages[chunk.done].needs) {
+        const ChunkData* neighbour = this->chunk(chunk.x + need.dx, chunk.z + need.dz);
+        if(neighbour == NULL || !neighbour->has(need.stage)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ChunkPipeline::evict() {
+    if(chunks.size() <= capacity) {
+        return;
+    }
+    std::vector<std::pair<uint64_t, Key>> idle;
+    for(const auto &entry : chunks) {
+        if(entry.second.used != build_count) {
+            idle.push_back({ entry.second.used, entry.first });
+        }
+    }
+    std::sort(idle.begin(), idle.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    for(size_t i = 0; i < idle.size() && chunks.size() > capacity; ++i) {
+        chunks.erase(idle[i].second);
+    }
+}
+
+void ChunkPipeline::run_stages(std::vector<ChunkData*> &work) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        ChunkData* next = NULL;
+        bool unfinished = false;
+        for(ChunkData* chunk : work) {
+            if(chunk->done >= chunk->wanted) {
+                continue;
+            }
+            unfinished = true;
+            if(!chunk->busy && ready(*chunk)) {
+                next = chunk;
+                break;
+            }
+        }
+        if(!unfinished) {
+            return;
+        }
+        if(next == NULL) {
+            progress.wait(lock);
+            continue;
+        }
+
+        ChunkStage stage = static_cast<ChunkStage>(next->done);
+        next->busy = true;
+        lock.unlock();
+        stages[stage].run(*next, *this);
+        run_count[stage].fetch_add(1, std::memory_order_relaxed);
+        lock.lock();
+        next->busy = false;
+        next->done++;
+        progress.notify_all();
+    }
+}
+
+void ChunkPipeline::invalidate_points(const std::vector<std::pair<int, int>> &points) {
+    for(auto &entry : chunks) {
+        ChunkData &chunk = entry.second;
+        if(!chunk.has(CHUNK_HEIGHTS)) {
+            continue;
+        }
+        const TerrainCornerGrid &grid = chunk.terrain;
+        for(const std::pair<int, int> &point : points) {
+            float x = point.first * HEIGHT_LOD_SPACING[0];
+            float z = point.second * HEIGHT_LOD_SPACING[0];
+            if(x >= grid.x0 && x <= grid.x0 + grid.width * grid.step &&
+                z >= grid.z0 && z <= grid.z0 + grid.depth * grid.step) {
+                chunk.done = CHUNK_HEIGHTS;
+                break;
+            }
+        }
+    }
+    //A stage that read a neighbour's stage which is now undone read stale
+    //data, and so on outwards, until no chunk loses any more
+    for(bool lowered = true; lowered;) {
+        lowered = false;
+        for(auto &entry : chunks) {
+            ChunkData &chunk = entry.second;
+            for(int stage = 0; stage < chunk.done; ++stage) {
+                bool stale = false;
+                for(const ChunkDependency &need : stages[stage].needs) {
+                    const ChunkData* neighbour = this->chunk(chunk.x + need.dx, chunk.z + need.dz);
+                    stale = stale || (neighbour != NULL && !neighbour->has(need.stage));
+                }
+                if(stale) {
+                    chunk.done = stage;
+                    lowered = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void ChunkPipeline::build(const std::vector<std::pair<int, int>> &wanted, ChunkStage target, int threads) {
+    std::vector<ChunkData*> work;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(HEIGHT_CACHE.clears() != clears) {
+            clears = HEIGHT_CACHE.clears();
+            edits = HEIGHT_CACHE.edit_count();
+            chunks.clear();
+        } else if(HEIGHT_CACHE.edit_count() != edits) {
+            std::vector<std::pair<int, int>> points;
+            HEIGHT_CACHE.edits_since(edits, points);
+            edits += points.size();
+            invalidate_points(points);
+        }
+        //Left until now since stages may have been running when it was asked for
+        if(invalid_from < CHUNK_STAGE_COUNT) {
+            for(auto &entry : chunks) {
+                entry.second.done = std::min(entry.second.done, invalid_from);
+            }
+            invalid_from = CHUNK_STAGE_COUNT;
+        }
+        ++build_count;
+        for(const std::pair<int, int> &position : wanted) {
+            want(position.first, position.second, target + 1, work);
+        }
+        //Neighbours join the list as stages still to run need them, and may
+        //need more of chunks already on it, so go round until nothing grows.
+        //Stages already done need nothing.
+        std::vector<int> raised;
+        for(bool growing = true; growing;) {
+            growing = false;
+            for(size_t i = 0; i < work.size(); ++i) {
+                raised.resize(work.size(), 0);
+                for(int stage = std::max(raised[i], work[i]->done); stage < work[i]->wanted; ++stage) {
+                    for(const ChunkDependency &need : stages[stage].needs) {
+                        want(work[i]->x + need.dx, work[i]->z + need.dz, need.stage + 1, work);
+                        growing = true;
+                    }
+                }
+                raised[i] = std::max(raised[i], work[i]->wanted);
+            }
+        }
+        evict();
+    }
+
+    while(static_cast<int>(helpers.size()) < threads - 1) {
+        helpers.emplace_back([this]() { help(); });
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shared = &work;
+        openings = threads - 1;
+    }
+    wake.notify_all();
+    run_stages(work);
+    //work goes away with this call, so wait out helpers still looking at it
+    std::unique_lock<std::mutex> lock(mutex);
+    shared = NULL;
+    openings = 0;
+    progress.wait(lock, [this]() { return helping == 0; });
+}
+
+void ChunkPipeline::help() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        wake.wait(lock, [this]() { return stopping || (shared != NULL && openings > 0); });
+        if(stopping) {
+            return;
+        }
+        std::vector<ChunkData*> &work = *shared;
+        openings--;
+        helping++;
+        lock.unlock();
+        run_stages(work);
+        lock.lock();
+        helping--;
+        progress.notify_all();
+    }
+}
+
+#endif
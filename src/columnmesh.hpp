@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "greedymesh.hpp"
+
+//Meshes a chunk as solid columns of blocks straight from its surface
+//heights, with everything under the top of a column taken to be stone.
+//Each column gets its top face and, on each side where the neighbouring
+//column is lower, the wall down to it, one quad for the top block and one
+//for the stone under it. Nothing below the surface is visited, so the cost
+//goes with the chunk's area and how steep it is rather than with its volume.
+
+//Top block of each column of a chunk and of the ring of columns around it
+struct ColumnHeights {
+    int width, depth;
+    //(width + 2) x (depth + 2), [(x + 1) * (depth + 2) + z + 1], so x and z
+    //run from -1 to width and depth; the ring's corners aren't read
+    std::vector<int> tops;
+    std::vector<int16_t> blocks;    //type of each top block, [x * depth + z]
+
+    void reset(int width, int depth);
+    int &top(int x, int z) { return tops[(x + 1) * (depth + 2) + z + 1]; }
+    int top(int x, int z) const { return tops[(x + 1) * (depth + 2) + z + 1]; }
+};
+
+//Appends the top and exposed wall faces of heights' columns to quads, with
+//x and z relative to the chunk
+void column_mesh(const ColumnHeights &heights, std::vector<GreedyQuad> &quads);
+
+#ifdef COLUMN_MESH_IMP
+
+void ColumnHeights::reset(int width, int depth) {
+    this->width = width;
+    this->depth = depth;
+    tops.assign(static_cast<size_t>(width + 2) * (depth + 2), 0);
+    blocks.assign(static_cast<size_t>(width) * depth, STONE);
+}
+
+void column_mesh(const ColumnHeights &heights, std::vector<GreedyQuad> &quads) {
+    //Towards each side's neighbour, in CubeFace order
+    const int step_x[4] = { -1, 1, 0, 0 };
+    const int step_z[4] = { 0, 0, 1, -1 };
+    for(int x = 0; x < heights.width; ++x) {
+        for(int z = 0; z < heights.depth; ++z) {
+            int top = heights.top(x, z);
+            int16_t block = heights.blocks[x * heights.depth + z];
+            quads.push_back({ TOP, block, x, top, z, 1, 1, 1 });
+            for(int side = LEFT; side <= BACK; ++side) {
+                int below = heights.top(x + step_x[side], z + step_z[side]);
+                if(below >= top) {
+                    continue;
+                }
+                quads.push_back({ static_cast<CubeFace>(side), block, x, top, z, 1, 1, 1 });
+                if(below < top - 1) {
+                    quads.push_back({ static_cast<CubeFace>(side), STONE, x, below + 1, z, 1, top - 1 - below, 1 });
+                }
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class FractalNoise;
+
+//Instruction sets the batched kernels are built for, lowest first
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE41,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+
+//Every batched kernel built for one level. Each kernels_*.cpp fills one of
+//these with code compiled for its instruction set; noise_kernels() hands out
+//the one this CPU can run.
+struct NoiseKernels {
+    SimdLevel level;
+    void (*noise2_f)(const uint8_t* perm, const float* xs, const float* ys, float* out, size_t n);
+    void (*noise2_d)(const uint8_t* perm, const double* xs, const double* ys, double* out, size_t n);
+    void (*noise3_f)(const uint8_t* perm, const float* xs, const float* ys, const float* zs, float* out, size_t n);
+    void (*noise3_d)(const uint8_t* perm, const double* xs, const double* ys, const double* zs, double* out, size_t n);
+    void (*fractal)(const uint8_t* perm, const FractalNoise &fractal, const float* xs, const float* zs,
+        float* out, size_t n);
+    void (*fractal_deriv)(const uint8_t* perm, const FractalNoise &fractal, const float* xs, const float* zs,
+        float* out, float* dxs, float* dzs, size_t n);
+};
+
+//Defined in kernels_*.cpp. The SIMD ones only exist on x86 builds (HONDA_X86_KERNELS).
+const NoiseKernels* noise_kernels_scalar();
+const NoiseKernels* noise_kernels_sse41();
+const NoiseKernels* noise_kernels_avx2();
+const NoiseKernels* noise_kernels_avx512();
+
+//Best level this CPU and OS can run
+SimdLevel detect_simd_level();
+
+//Level in use. Starts at detect_simd_level(), or at the level named by the
+//HONDA_SIMD environment variable (scalar, sse41, avx2, avx512) if it is set
+//and supported.
+SimdLevel simd_level();
+
+//Switches every kernel to level. Returns false and changes nothing if this CPU can't run it.
+bool force_simd_level(SimdLevel level);
+
+const NoiseKernels &noise_kernels();
+
+const char* simd_level_name(SimdLevel level);
+bool parse_simd_level(const char* name, SimdLevel &level);
+
+inline void noise2_batch(const uint8_t* perm, const float* xs, const float* ys, float* out, size_t n) {
+    noise_kernels().noise2_f(perm, xs, ys, out, n);
+}
+
+inline void noise2_batch(const uint8_t* perm, const double* xs, const double* ys, double* out, size_t n) {
+    noise_kernels().noise2_d(perm, xs, ys, out, n);
+}
+
+inline void noise3_batch(const uint8_t* perm, const float* xs, const float* ys, const float* zs, float* out, size_t n) {
+    noise_kernels().noise3_f(perm, xs, ys, zs, out, n);
+}
+
+inline void noise3_batch(const uint8_t* perm, const double* xs, const double* ys, const double* zs, double* out, size_t n) {
+    noise_kernels().noise3_d(perm, xs, ys, zs, out, n);
+}
+
+#ifdef CPU_DISPATCH_IMP
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#if defined(HONDA_X86_KERNELS)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+const char* SIMD_LEVEL_NAMES[] = { "scalar", "sse41", "avx2", "avx512" };
+
+std::atomic<const NoiseKernels*> ACTIVE_NOISE_KERNELS(nullptr);
+
+#if defined(HONDA_X86_KERNELS)
+void read_cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, leaf, subleaf);
+    for(int i = 0; i < 4; ++i) {
+        regs[i] = static_cast<unsigned int>(r[i]);
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+//Which register states the OS saves on context switch (XCR0)
+uint64_t read_xcr0() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+#endif
+
+SimdLevel detect_simd_level() {
+#if defined(HONDA_X86_KERNELS)
+    unsigned int regs[4];
+    read_cpuid(0, 0, regs);
+    unsigned int max_leaf = regs[0];
+
+    read_cpuid(1, 0, regs);
+    bool sse41 = (regs[2] & (1u << 19)) != 0;
+    bool osxsave = (regs[2] & (1u << 27)) != 0;
+    bool avx = (regs[2] & (1u << 28)) != 0;
+    if(!sse41) {
+        return SIMD_SCALAR;
+    }
+
+    //The CPU flags alone aren't enough: the OS must also save YMM (and ZMM) state
+    uint64_t xcr0 = osxsave ? read_xcr0() : 0;
+    bool ymm_state = (xcr0 & 0x6) == 0x6;
+    bool zmm_state = (xcr0 & 0xE6) == 0xE6;
+    if(!avx || !ymm_state || max_leaf < 7) {
+        return SIMD_SSE41;
+    }
+
+    read_cpuid(7, 0, regs);
+    bool avx2 = (regs[1] & (1u << 5)) != 0;
+    bool avx512f = (regs[1] & (1u << 16)) != 0;
+    if(!avx2) {
+        return SIMD_SSE41;
+    }
+    if(avx512f && zmm_state) {
+        return SIMD_AVX512;
+    }
+    return SIMD_AVX2;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+const char* simd_level_name(SimdLevel level) {
+    return SIMD_LEVEL_NAMES[level];
+}
+
+bool parse_simd_level(const char* name, SimdLevel &level) {
+    for(int l = SIMD_SCALAR; l <= SIMD_AVX512; ++l) {
+        if(std::strcmp(name, SIMD_LEVEL_NAMES[l]) == 0) {
+            level = static_cast<SimdLevel>(l);
+            return true;
+        }
+    }
+    return false;
+}
+
+const NoiseKernels* kernels_for_level(SimdLevel level) {
+    switch(level) {
+#if defined(HONDA_X86_KERNELS)
+    case SIMD_AVX512:
+        return noise_kernels_avx512();
+    case SIMD_AVX2:
+        return noise_kernels_avx2();
+    case SIMD_SSE41:
+        return noise_kernels_sse41();
+#endif
+    default:
+        return noise_kernels_scalar();
+    }
+}
+
+const NoiseKernels* startup_noise_kernels() {
+    SimdLevel level = detect_simd_level();
+    const char* forced = std::getenv("HONDA_SIMD");
+    if(forced != NULL) {
+        SimdLevel requested;
+        if(!parse_simd_level(forced, requested)) {
+            std::cerr << "Unknown HONDA_SIMD level " << forced << ", using " << simd_level_name(level) << std::endl;
+        } else if(requested > level) {
+            std::cerr << "HONDA_SIMD=" << forced << " not supported by this CPU, using " << simd_level_name(level) << std::endl;
+        } else {
+            level = requested;
+        }
+    }
+    return kernels_for_level(level);
+}
+
+const NoiseKernels &noise_kernels() {
+    const NoiseKernels* kernels = ACTIVE_NOISE_KERNELS.load(std::memory_order_acquire);
+    if(kernels == NULL) {
+        static const NoiseKernels* startup = startup_noise_kernels();
+        kernels = startup;
+        ACTIVE_NOISE_KERNELS.store(kernels, std::memory_order_release);
+    }
+    return *kernels;
+}
+
+SimdLevel simd_level() {
+    return noise_kernels().level;
+}
+
+bool force_simd_level(SimdLevel level) {
+    if(level > detect_simd_level()) {
+        return false;
+    }
+    ACTIVE_NOISE_KERNELS.store(kernels_for_level(level), std::memory_order_release);
+    return true;
+}
+
+#endif
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "terrain.hpp"
+
+//Volumetric terrain for caves and overhangs. A voxel is solid where
+//
+//    density(x, y, z) = noise_wrap(x, z) - y + DENSITY_AMPLITUDE * noise(x, y, z) at DENSITY_FREQUENCY
+//
+//is >= 0, so the heightfield is the surface and the 3D noise pushes it up to
+//DENSITY_AMPLITUDE blocks either way.
+//
+//fill_density samples the 3D term only every DENSITY_LATTICE voxels on each
+//axis and trilinearly interpolates between, which is 64x fewer noise calls.
+//Lattice cells whose columns all sit more than the noise's reach below the
+//surface are solid whatever the noise says, and ones above it are air, so
+//those never sample the noise at all. The surface term is evaluated exactly
+//per column, so only the cave shapes are interpolated.
+
+#define DENSITY_LATTICE 4
+
+const float DENSITY_AMPLITUDE = 12.0f;
+const float DENSITY_FREQUENCY = 1.0f / 24.0f;
+
+//Upper bound on |Perlin::noise(x, y, z)| (the observed peak is about 0.97)
+const float DENSITY_NOISE_BOUND = 1.1f;
+
+enum DensityCell : uint8_t {
+    DENSITY_CELL_AIR,
+    DENSITY_CELL_SOLID,
+    DENSITY_CELL_MIXED
+};
+
+struct DensityVolume {
+    int x0, y0, z0;
+    int width;
+    int height;
+    //Indexed [(y * width + z) * width + x], relative to (x0, y0, z0). In
+    //skipped cells only the sign is exact; the value is the surface term alone.
+    std::vector<float> density;
+
+    //How much work the last fill did
+    int mixed_cells;
+    int skipped_cells;
+    int lattice_samples;
+
+    float at(int x, int y, int z) const { return density[(static_cast<size_t>(y) * width + z) * width + x]; }
+    bool solid(int x, int y, int z) const { return at(x, y, z) >= 0.0f; }
+};
+
+//Fills volume with the width x height x width voxels whose lowest corner is
+//(x0, y0, z0). width and height must be multiples of DENSITY_LATTICE.
+void fill_density(DensityVolume &volume, int x0, int y0, int z0, int width, int height);
+
+//density() at one point, evaluated directly with no lattice
+float density_at(float x, float y, float z);
+
+#ifdef DENSITY_IMP
+
+float density_at(float x, float y, float z) {
+    return noise_wrap(x, z) - y + DENSITY_AMPLITUDE * p.noise(x * DENSITY_FREQUENCY, y * DENSITY_FREQUENCY, z * DENSITY_FREQUENCY);
+}
+
+void fill_density(DensityVolume &volume, int x0, int y0, int z0, int width, int height) {
+    const int L = DENSITY_LATTICE;
+    int cells_w = width / L;
+    int cells_h = height / L;
+    int lattice_w = cells_w + 1;
+    int lattice_h = cells_h + 1;
+
+    volume.x0 = x0;
+    volume.y0 = y0;
+    volume.z0 = z0;
+    volume.width = width;
+    volume.height = height;
+    volume.density.resize(static_cast<size_t>(width) * width * height);
+    volume.mixed_cells = 0;
+    volume.skipped_cells = 0;
+
+    //Exact surface height of every column
+    std::vector<float> xs;
+    std::vector<float> zs;
+    for(int z = 0; z < width; ++z) {
+        for(int x = 0; x < width; ++x) {
+            xs.push_back(static_cast<float>(x0 + x));
+            zs.push_back(static_cast<float>(z0 + z));
+        }
+    }
+    std::vector<float> heights(xs.size());
+    noise_wrap_batch(xs.data(), zs.data(), heights.data(), heights.size());
+
+    //Classify cells, marking the lattice corners the mixed ones need
+    float reach = DENSITY_AMPLITUDE * DENSITY_NOISE_BOUND;
+    std::vector<uint8_t> cells(static_cast<size_t>(cells_w) * cells_w * cells_h);
+    std::vector<int> lattice_index(static_cast<size_t>(lattice_w) * lattice_w * lattice_h, -1);
+    auto lattice_at = [&](int lx, int ly, int lz) -> int& {
+        return lattice_index[(static_cast<size_t>(ly) * lattice_w + lz) * lattice_w + lx];
+    };
+    std::vector<float> lxs;
+    std::vector<float> lys;
+    std::vector<float> lzs;
+    for(int cz = 0; cz < cells_w; ++cz) {
+        for(int cx = 0; cx < cells_w; ++cx) {
+            float hmin = 1e30f;
+            float hmax = -1e30f;
+            for(int z = cz * L; z < cz * L + L; ++z) {
+                for(int x = cx * L; x < cx * L + L; ++x) {
+                    float h = heights[z * width + x];
+                    hmin = h < hmin ? h : hmin;
+                    hmax = h > hmax ? h : hmax;
+                }
+            }
+            for(int cy = 0; cy < cells_h; ++cy) {
+                float ylo = static_cast<float>(y0 + cy * L);
+                float yhi = ylo + (L - 1);
+                uint8_t &cell = cells[(static_cast<size_t>(cy) * cells_w + cz) * cells_w + cx];
+                if(hmax + reach < ylo) {
+                    cell = DENSITY_CELL_AIR;
+                } else if(hmin - reach >= yhi) {
+                    cell = DENSITY_CELL_SOLID;
+                } else {
+                    cell = DENSITY_CELL_MIXED;
+                    for(int corner = 0; corner < 8; ++corner) {
+                        int lx = cx + (corner & 1);
+                        int ly = cy + ((corner >> 1) & 1);
+                        int lz = cz + ((corner >> 2) & 1);
+                        int &index = lattice_at(lx, ly, lz);
+                        if(index < 0) {
+                            index = static_cast<int>(lxs.size());
+                            lxs.push_back((x0 + lx * L) * DENSITY_FREQUENCY);
+                            lys.push_back((y0 + ly * L) * DENSITY_FREQUENCY);
+                            lzs.push_back((z0 + lz * L) * DENSITY_FREQUENCY);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<float> lattice(lxs.size());
+    p.noise_batch(lxs.data(), lys.data(), lzs.data(), lattice.data(), static_cast<int>(lattice.size()));
+    volume.lattice_samples = static_cast<int>(lattice.size());
+
+    for(int cy = 0; cy < cells_h; ++cy) {
+        for(int cz = 0; cz < cells_w; ++cz) {
+            for(int cx = 0; cx < cells_w; ++cx) {
+                uint8_t cell = cells[(static_cast<size_t>(cy) * cells_w + cz) * cells_w + cx];
+                if(cell != DENSITY_CELL_MIXED) {
+                    //The sign is already decided, so the surface term alone will do
+                    volume.skipped_cells++;
+                    for(int y = cy * L; y < cy * L + L; ++y) {
+                        for(int z = cz * L; z < cz * L + L; ++z) {
+                            for(int x = cx * L; x < cx * L + L; ++x) {
+                                volume.density[(static_cast<size_t>(y) * width + z) * width + x] =
+                                    heights[z * width + x] - (y0 + y);
+                            }
+                        }
+                    }
+                    continue;
+                }
+
+                volume.mixed_cells++;
+                float c[8];
+                for(int corner = 0; corner < 8; ++corner) {
+                    c[corner] = lattice[lattice_at(cx + (corner & 1), cy + ((corner >> 1) & 1), cz + ((corner >> 2) & 1))];
+                }
+                for(int y = 0; y < L; ++y) {
+                    float ty = static_cast<float>(y) / L;
+                    for(int z = 0; z < L; ++z) {
+                        float tz = static_cast<float>(z) / L;
+                        //Corners are numbered x + 2y + 4z
+                        float low = c[0] + tz * (c[4] - c[0]);
+                        float low1 = c[1] + tz * (c[5] - c[1]);
+                        float high = c[2] + tz * (c[6] - c[2]);
+                        float high1 = c[3] + tz * (c[7] - c[3]);
+                        float x_start = low + ty * (high - low);
+                        float x_end = low1 + ty * (high1 - low1);
+                        for(int x = 0; x < L; ++x) {
+                            float tx = static_cast<float>(x) / L;
+                            float n = x_start + tx * (x_end - x_start);
+                            int vx = cx * L + x;
+                            int vy = cy * L + y;
+                            int vz = cz * L + z;
+                            volume.density[(static_cast<size_t>(vy) * width + vz) * width + vx] =
+                                heights[vz * width + vx] - (y0 + vy) + DENSITY_AMPLITUDE * n;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,378 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Baked hydraulic erosion. Eroding the terrain takes seconds per square
+//kilometre, far too slow to run as chunks load, so bake_erosion runs it
+//offline over a region and saves how much each point moved as an
+//ErosionMap. At runtime the worldgen graph's erosion op (see worldgen.hpp)
+//reads that map back, bilinearly, and the terrain graph adds it to the
+//height. Outside the baked region, or with no map loaded, the delta is 0.
+//
+//The simulation drops water particles onto the heightfield; each rolls
+//downhill, picks up sediment where it speeds up and drops it where it slows
+//or fills up, which cuts gullies and fans out deposits at the bottom.
+//erode_heightfield splits the region into tiles and runs them on several
+//threads in four phases, one per corner of each 2 x 2 block of tiles. A
+//particle never leaves its tile plus a halo of its lifetime and brush radius
+//in cells, and tiles run in the same phase are at least two halos apart, so
+//no two threads ever touch the same cells. Between phases the threads meet at a
+//barrier, which is how each tile sees what its neighbours did to its halo.
+//Every particle's start is a hash of (seed, round, tile, index), so the
+//result doesn't depend on the thread count or on scheduling.
+
+#define EROSION_MAP_PATH "src/assets/worldgen/erosion.bin"
+
+struct ErosionSettings {
+    float droplets_per_cell = 0.5f;
+    int rounds = 4;             //droplets are split over this many passes of the four phases
+    int lifetime = 48;          //steps per droplet, each at most one cell
+    int radius = 3;             //cells around a droplet it wears down, so it cuts channels rather than pits
+    int tile_size = 128;        //in cells, raised to two halos if smaller
+    float inertia = 0.05f;      //how much of its old direction a droplet keeps
+    float capacity = 4.0f;      //sediment carried per unit of drop, speed and water
+    float min_capacity = 0.01f;
+    float erode = 0.3f;         //fraction of spare capacity taken from the ground per step
+    float deposit = 0.3f;       //fraction of excess sediment dropped per step
+    float evaporate = 0.02f;
+    float gravity = 4.0f;
+};
+
+//Erodes heights, width x depth cells indexed [x * depth + z] with cell_size
+//blocks between them, on threads threads
+void erode_heightfield(std::vector<float> &heights, int width, int depth, float cell_size,
+    const ErosionSettings &settings, uint64_t seed, int threads);
+
+//How far erosion moved the terrain over a grid of world points
+struct ErosionMap {
+    uint64_t seed;              //world seed the map was baked for
+    float x0, z0;               //world position of deltas[0]
+    float spacing;              //blocks between points
+    int width, depth;
+    std::vector<float> deltas;  //[x * depth + z]
+
+    bool empty() const { return deltas.empty(); }
+};
+
+extern ErosionMap EROSION_MAP;
+
+//Loads the map at path into EROSION_MAP if it was baked for seed. A missing
+//file just means nothing is baked and is not an error.
+bool load_erosion_map(const char* path, uint64_t seed);
+bool save_erosion_map(const ErosionMap &map, const char* path);
+
+//out[i] = baked delta at (xs[i], zs[i]); dxs and dzs, if given, get its slope
+void erosion_sample_batch(const ErosionMap &map, const float* xs, const float* zs, float* out,
+    float* dxs, float* dzs, size_t n);
+
+//One delta in double, for WorldGraph::reference
+double erosion_reference(const ErosionMap &map, double x, double z);
+
+#ifdef EROSION_IMP
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "hashrng.hpp"
+
+ErosionMap EROSION_MAP = { 0, 0.0f, 0.0f, 1.0f, 0, 0, {} };
+
+//File layout: magic, version, then the ErosionMap fields and deltas, native byte order
+const char EROSION_MAP_MAGIC[4] = { 'H', 'E', 'R', 'O' };
+const uint32_t EROSION_MAP_VERSION = 1;
+
+//Cells of the heightfield one tile's droplets may touch
+struct ErosionWindow {
+    int tx, tz;                 //the tile, in cells
+    int x0, z0, x1, z1;         //tile plus halo, clamped to the heightfield; x1 and z1 exclusive
+};
+
+//Cells within settings.radius of a droplet and how much of what it wears away comes from each
+struct ErosionBrush {
+    std::vector<int> dx, dz;
+    std::vector<float> weights;
+};
+
+ErosionBrush make_erosion_brush(int radius) {
+    ErosionBrush brush;
+    float total = 0.0f;
+    for(int x = -radius; x <= radius; ++x) {
+        for(int z = -radius; z <= radius; ++z) {
+            float weight = radius + 0.5f - std::sqrt(static_cast<float>(x * x + z * z));
+            if(weight > 0.0f) {
+                brush.dx.push_back(x);
+                brush.dz.push_back(z);
+                brush.weights.push_back(weight);
+                total += weight;
+            }
+        }
+    }
+    for(float &weight : brush.weights) {
+        weight /= total;
+    }
+    return brush;
+}
+
+//Height and downhill slope at (x, z), in cells, from the four surrounding heights
+void erosion_gradient(const float* heights, int depth, float x, float z, float &height, float &gx, float &gz) {
+    int ix = static_cast<int>(x);
+    int iz = static_cast<int>(z);
+    float u = x - ix;
+    float v = z - iz;
+    const float* h = heights + static_cast<size_t>(ix) * depth + iz;
+    float h00 = h[0];
+    float h01 = h[1];
+    float h10 = h[depth];
+    float h11 = h[depth + 1];
+    gx = (h10 - h00) * (1.0f - v) + (h11 - h01) * v;
+    gz = (h01 - h00) * (1.0f - u) + (h11 - h10) * u;
+    height = h00 * (1.0f - u) * (1.0f - v) + h10 * u * (1.0f - v) + h01 * (1.0f - u) * v + h11 * u * v;
+}
+
+//Adds amount to the four heights around (x, z), split bilinearly
+void erosion_splat(float* heights, int depth, float x, float z, float amount) {
+    int ix = static_cast<int>(x);
+    int iz = static_cast<int>(z);
+    float u = x - ix;
+    float v = z - iz;
+    float* h = heights + static_cast<size_t>(ix) * depth + iz;
+    h[0] += amount * (1.0f - u) * (1.0f - v);
+    h[1] += amount * (1.0f - u) * v;
+    h[depth] += amount * u * (1.0f - v);
+    h[depth + 1] += amount * u * v;
+}
+
+//One droplet from (x, z), in cells, until it dries up, stops or leaves the window
+void erosion_droplet(float* heights, int depth, float cell_size, const ErosionWindow &window,
+    const ErosionSettings &settings, const ErosionBrush &brush, float x, float z) {
+    //Far enough in from the window's edge for the brush and the bilinear reads
+    float x0 = static_cast<float>(window.x0 + settings.radius);
+    float z0 = static_cast<float>(window.z0 + settings.radius);
+    float x1 = static_cast<float>(window.x1 - settings.radius - 1);
+    float z1 = static_cast<float>(window.z1 - settings.radius - 1);
+    if(x < x0 || z < z0 || x >= x1 || z >= z1) {
+        return;
+    }
+    float dx = 0.0f;
+    float dz = 0.0f;
+    float speed = 1.0f;
+    float water = 1.0f;
+    float sediment = 0.0f;
+    for(int step = 0; step < settings.lifetime; ++step) {
+        float height, gx, gz;
+        erosion_gradient(heights, depth, x, z, height, gx, gz);
+        dx = dx * settings.inertia - gx * (1.0f - settings.inertia);
+        dz = dz * settings.inertia - gz * (1.0f - settings.inertia);
+        float length = std::sqrt(dx * dx + dz * dz);
+        if(length < 1e-6f) {
+            break;
+        }
+        dx /= length;
+        dz /= length;
+        float nx = x + dx;
+        float nz = z + dz;
+        if(nx < x0 || nz < z0 || nx >= x1 || nz >= z1) {
+            break;
+        }
+
+        float next, nextgx, nextgz;
+        erosion_gradient(heights, depth, nx, nz, next, nextgx, nextgz);
+        float drop = height - next;
+        //Capacity goes with the slope in blocks per block, not per cell
+        float fill = std::max(drop / cell_size * speed * water * settings.capacity, settings.min_capacity);
+        if(drop < 0.0f || sediment > fill) {
+            //Uphill: fill the hole behind, up to the sediment carried. Otherwise shed the excess.
+            float amount = drop < 0.0f ? std::min(-drop, sediment) : (sediment - fill) * settings.deposit;
+            sediment -= amount;
+            erosion_splat(heights, depth, x, z, amount);
+        } else {
+            //Never dig deeper than the drop, or the droplet carves a pit it can't leave
+            float amount = std::min((fill - sediment) * settings.erode, drop);
+            sediment += amount;
+            float* centre = heights + static_cast<size_t>(static_cast<int>(x)) * depth + static_cast<int>(z);
+            for(size_t b = 0; b < brush.weights.size(); ++b) {
+                centre[static_cast<ptrdiff_t>(brush.dx[b]) * depth + brush.dz[b]] -= amount * brush.weights[b];
+            }
+        }
+
+        speed = std::sqrt(std::max(0.0f, speed * speed + drop / cell_size * settings.gravity));
+        water *= 1.0f - settings.evaporate;
+        x = nx;
+        z = nz;
+    }
+}
+
+void erode_heightfield(std::vector<float> &heights, int width, int depth, float cell_size,
+    const ErosionSettings &settings, uint64_t seed, int threads) {
+    int halo = settings.lifetime + settings.radius + 1;
+    ErosionBrush brush = make_erosion_brush(settings.radius);
+    int tile_size = std::max(settings.tile_size, 2 * halo);
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    int tiles_z = (depth + tile_size - 1) / tile_size;
+
+    //Tiles by phase: which corner of its 2 x 2 block each is
+    std::vector<ErosionWindow> phases[4];
+    for(int tx = 0; tx < tiles_x; ++tx) {
+        for(int tz = 0; tz < tiles_z; ++tz) {
+            ErosionWindow window;
+            window.tx = tx;
+            window.tz = tz;
+            window.x0 = std::max(0, tx * tile_size - halo);
+            window.z0 = std::max(0, tz * tile_size - halo);
+            window.x1 = std::min(width, (tx + 1) * tile_size + halo);
+            window.z1 = std::min(depth, (tz + 1) * tile_size + halo);
+            phases[(tx & 1) + 2 * (tz & 1)].push_back(window);
+        }
+    }
+
+    int rounds = std::max(1, settings.rounds);
+    int droplets = static_cast<int>(settings.droplets_per_cell * tile_size * tile_size / rounds);
+    float* field = heights.data();
+    auto erode_tile = [&](const ErosionWindow &window, int round) {
+        uint64_t round_seed = hash_mix64(seed + static_cast<uint64_t>(round));
+        int tile = window.tx * tiles_z + window.tz;
+        for(int d = 0; d < droplets; ++d) {
+            float x = (window.tx + cell_random(round_seed, tile, d, RNG_STREAM_EROSION_X)) * tile_size;
+            float z = (window.tz + cell_random(round_seed, tile, d, RNG_STREAM_EROSION_Z)) * tile_size;
+            erosion_droplet(field, depth, cell_size, window, settings, brush, x, z);
+        }
+    };
+
+    //Every thread works through the current phase's tiles, then all wait for
+    //the slowest before the next phase starts
+    int phase_count = rounds * 4;
+    std::atomic<size_t> next_tile(0);
+    int phase = 0;
+    std::barrier sync(threads, [&]() noexcept {
+        phase++;
+        next_tile = 0;
+    });
+    auto work = [&]() {
+        while(phase < phase_count) {
+            const std::vector<ErosionWindow> &tiles = phases[phase % 4];
+            int round = phase / 4;
+            for(size_t t = next_tile++; t < tiles.size(); t = next_tile++) {
+                erode_tile(tiles[t], round);
+            }
+            sync.arrive_and_wait();
+        }
+    };
+    std::vector<std::thread> workers;
+    for(int t = 1; t < threads; ++t) {
+        workers.emplace_back(work);
+    }
+    work();
+    for(std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+bool load_erosion_map(const char* path, uint64_t seed) {
+    std::ifstream file(path, std::ios::binary);
+    if(!file.is_open()) {
+        return true;
+    }
+    char magic[4];
+    uint32_t version = 0;
+    ErosionMap map;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&version), sizeof(version));
+    file.read(reinterpret_cast<char*>(&map.seed), sizeof(map.seed));
+    file.read(reinterpret_cast<char*>(&map.x0), sizeof(map.x0));
+    file.read(reinterpret_cast<char*>(&map.z0), sizeof(map.z0));
+    file.read(reinterpret_cast<char*>(&map.spacing), sizeof(map.spacing));
+    file.read(reinterpret_cast<char*>(&map.width), sizeof(map.width));
+    file.read(reinterpret_cast<char*>(&map.depth), sizeof(map.depth));
+    if(!file || std::memcmp(magic, EROSION_MAP_MAGIC, sizeof(magic)) != 0 || version != EROSION_MAP_VERSION ||
+        map.width < 2 || map.depth < 2 || !(map.spacing > 0.0f)) {
+        std::cerr << "Erosion map " << path << " is not a version " << EROSION_MAP_VERSION << " erosion map" << std::endl;
+        return false;
+    }
+    if(map.seed != seed) {
+        std::cerr << "Erosion map " << path << " was baked for seed " << map.seed << ", not " << seed << std::endl;
+        return false;
+    }
+    map.deltas.resize(static_cast<size_t>(map.width) * map.depth);
+    file.read(reinterpret_cast<char*>(map.deltas.data()), map.deltas.size() * sizeof(float));
+    if(!file) {
+        std::cerr << "Erosion map " << path << " is truncated" << std::endl;
+        return false;
+    }
+    EROSION_MAP = std::move(map);
+    return true;
+}
+
+bool save_erosion_map(const ErosionMap &map, const char* path) {
+    std::ofstream file(path, std::ios::binary);
+    if(!file.is_open()) {
+        std::cerr << "Couldn't write erosion map " << path << std::endl;
+        return false;
+    }
+    file.write(EROSION_MAP_MAGIC, sizeof(EROSION_MAP_MAGIC));
+    file.write(reinterpret_cast<const char*>(&EROSION_MAP_VERSION), sizeof(EROSION_MAP_VERSION));
+    file.write(reinterpret_cast<const char*>(&map.seed), sizeof(map.seed));
+    file.write(reinterpret_cast<const char*>(&map.x0), sizeof(map.x0));
+    file.write(reinterpret_cast<const char*>(&map.z0), sizeof(map.z0));
+    file.write(reinterpret_cast<const char*>(&map.spacing), sizeof(map.spacing));
+    file.write(reinterpret_cast<const char*>(&map.width), sizeof(map.width));
+    file.write(reinterpret_cast<const char*>(&map.depth), sizeof(map.depth));
+    file.write(reinterpret_cast<const char*>(map.deltas.data()), map.deltas.size() * sizeof(float));
+    return static_cast<bool>(file);
+}
+
+void erosion_sample_batch(const ErosionMap &map, const float* xs, const float* zs, float* out,
+    float* dxs, float* dzs, size_t n) {
+    if(map.empty()) {
+        std::fill(out, out + n, 0.0f);
+        if(dxs != NULL) {
+            std::fill(dxs, dxs + n, 0.0f);
+            std::fill(dzs, dzs + n, 0.0f);
+        }
+        return;
+    }
+    float inverse = 1.0f / map.spacing;
+    for(size_t i = 0; i < n; ++i) {
+        float fx = (xs[i] - map.x0) * inverse;
+        float fz = (zs[i] - map.z0) * inverse;
+        //The edge deltas are baked to 0, so outside is simply 0 too
+        if(!(fx >= 0.0f && fz >= 0.0f && fx < map.width - 1 && fz < map.depth - 1)) {
+            out[i] = 0.0f;
+            if(dxs != NULL) {
+                dxs[i] = 0.0f;
+                dzs[i] = 0.0f;
+            }
+            continue;
+        }
+        float height, gx, gz;
+        erosion_gradient(map.deltas.data(), map.depth, fx, fz, height, gx, gz);
+        out[i] = height;
+        if(dxs != NULL) {
+            dxs[i] = gx * inverse;
+            dzs[i] = gz * inverse;
+        }
+    }
+}
+
+double erosion_reference(const ErosionMap &map, double x, double z) {
+    double fx = (x - map.x0) / map.spacing;
+    double fz = (z - map.z0) / map.spacing;
+    if(map.empty() || !(fx >= 0.0 && fz >= 0.0 && fx < map.width - 1 && fz < map.depth - 1)) {
+        return 0.0;
+    }
+    int ix = static_cast<int>(fx);
+    int iz = static_cast<int>(fz);
+    double u = fx - ix;
+    double v = fz - iz;
+    const float* h = map.deltas.data() + static_cast<size_t>(ix) * map.depth + iz;
+    return h[0] * (1.0 - u) * (1.0 - v) + h[map.depth] * u * (1.0 - v) + h[1] * (1.0 - u) * v + h[map.depth + 1] * u * v;
+}
+
+#endif
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+
+#include "perlin.h"
+
+//One layer of a fractal sum: noise(x * frequency, z * frequency) * amplitude
+struct NoiseOctave {
+    float frequency;
+    float amplitude;
+};
+
+enum FractalMode {
+    FRACTAL_FBM,    //plain sum of octaves
+    FRACTAL_RIDGED  //each octave folded to (1 - |n|)^2, gives sharp crests
+};
+
+#define FRACTAL_MAX_OCTAVES 16
+
+//N octaves of 2D Perlin evaluated in one pass. The batch path loads each
+//coordinate once and keeps the running sum in a register across all octaves,
+//so adding an octave costs one noise kernel and nothing else.
+class FractalNoise {
+public:
+    FractalMode mode;
+    int octave_count;
+    NoiseOctave octaves[FRACTAL_MAX_OCTAVES];
+
+    FractalNoise();
+
+    //Classic fBm: each octave's frequency is lacunarity times the last and its amplitude gain times the last
+    static FractalNoise fbm(int count, float frequency, float amplitude, float lacunarity, float gain);
+
+    void add_octave(float frequency, float amplitude);
+
+    float sample(const PerlinF &perlin, float x, float z) const;
+    void sample_batch(const PerlinF &perlin, const float* xs, const float* zs, float* out, size_t n) const;
+
+    //sample() plus its analytic partial derivatives d/dx and d/dz
+    float sample_deriv(const PerlinF &perlin, float x, float z, float &dx, float &dz) const;
+    void sample_deriv_batch(const PerlinF &perlin, const float* xs, const float* zs,
+        float* out, float* dxs, float* dzs, size_t n) const;
+};
+
+template <typename L>
+inline typename L::V fractal2_lanes(const uint8_t* p, const FractalNoise &fractal, typename L::V x, typename L::V z) {
+    typedef typename L::V V;
+    V sum = L::zero();
+    for(int o = 0; o < fractal.octave_count; ++o) {
+        V frequency = L::set1(fractal.octaves[o].frequency);
+        V n = noise2_lanes<L>(p, L::mul(x, frequency), L::mul(z, frequency));
+        if(fractal.mode == FRACTAL_RIDGED) {
+            n = L::sub(L::set1(1.0f), L::abs(n));
+            n = L::mul(n, n);
+        }
+        sum = L::add(sum, L::mul(n, L::set1(fractal.octaves[o].amplitude)));
+    }
+    return sum;
+}
+
+//fractal2_lanes with the derivatives carried along. Each octave contributes
+//amplitude * frequency * n'(x * frequency); ridged octaves also pick up the
+//fold's chain-rule factor -2(1 - |n|)sign(n).
+template <typename L>
+inline typename L::V fractal2_deriv_lanes(const uint8_t* p, const FractalNoise &fractal, typename L::V x, typename L::V z,
+    typename L::V &dx, typename L::V &dz) {
+    typedef typename L::V V;
+    V sum = L::zero();
+    dx = L::zero();
+    dz = L::zero();
+    for(int o = 0; o < fractal.octave_count; ++o) {
+        const NoiseOctave &octave = fractal.octaves[o];
+        V frequency = L::set1(octave.frequency);
+        V ndx, ndz;
+        V n = noise2_deriv_lanes<L>(p, L::mul(x, frequency), L::mul(z, frequency), ndx, ndz);
+        if(fractal.mode == FRACTAL_RIDGED) {
+            V fold = L::sub(L::set1(1.0f), L::abs(n));
+            V chain = L::negate_if(L::lt(n, L::zero()), L::mul(L::set1(-2.0f), fold));
+            ndx = L::mul(ndx, chain);
+            ndz = L::mul(ndz, chain);
+            n = L::mul(fold, fold);
+        }
+        sum = L::add(sum, L::mul(n, L::set1(octave.amplitude)));
+        V slope_scale = L::set1(octave.amplitude * octave.frequency);
+        dx = L::add(dx, L::mul(ndx, slope_scale));
+        dz = L::add(dz, L::mul(ndz, slope_scale));
+    }
+    return sum;
+}
+
+#ifdef FRACTAL_IMP
+
+FractalNoise::FractalNoise() : mode(FRACTAL_FBM), octave_count(0) {
+
+}
+
+FractalNoise FractalNoise::fbm(int count, float frequency, float amplitude, float lacunarity, float gain) {
+    FractalNoise fractal;
+    for(int o = 0; o < count; ++o) {
+        fractal.add_octave(frequency, amplitude);
+        frequency *= lacunarity;
+        amplitude *= gain;
+    }
+    return fractal;
+}
+
+void FractalNoise::add_octave(float frequency, float amplitude) {
+    if(octave_count < FRACTAL_MAX_OCTAVES) {
+        octaves[octave_count].frequency = frequency;
+        octaves[octave_count].amplitude = amplitude;
+        octave_count++;
+    }
+}
+
+float FractalNoise::sample(const PerlinF &perlin, float x, float z) const {
+    return fractal2_lanes<ScalarLanes<float> >(perlin.table(), *this, x, z);
+}
+
+void FractalNoise::sample_batch(const PerlinF &perlin, const float* xs, const float* zs, float* out, size_t n) const {
+    noise_kernels().fractal(perlin.table(), *this, xs, zs, out, n);
+}
+
+float FractalNoise::sample_deriv(const PerlinF &perlin, float x, float z, float &dx, float &dz) const {
+    return fractal2_deriv_lanes<ScalarLanes<float> >(perlin.table(), *this, x, z, dx, dz);
+}
+
+void FractalNoise::sample_deriv_batch(const PerlinF &perlin, const float* xs, const float* zs,
+    float* out, float* dxs, float* dzs, size_t n) const {
+    noise_kernels().fractal_deriv(perlin.table(), *this, xs, zs, out, dxs, dzs, n);
+}
+
+#endif
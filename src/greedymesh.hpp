@@ -0,0 +1,237 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "voxels.hpp"
+
+//Binary greedy meshing of a chunk's voxels. Visible faces are found a
+//whole column at a time from ChunkVoxels' solid masks: a column's top faces
+//are mask & ~(mask >> 1), its faces towards x - 1 are mask & ~(the column
+//at x - 1), and so on, 64 blocks to an and. Faces of the same block type
+//are then merged greedily into rectangles, first along a run of set bits
+//and then across neighbouring rows holding the same run, so a flat wall or
+//floor of one material becomes a single quad.
+
+enum CubeFace {
+    LEFT = 0, RIGHT, FORWARD, BACK, TOP, BOTTOM
+};
+
+//A rectangle of block faces, all of one block type, facing side. It covers
+//the blocks [x, x + size_x) x [y, y + size_y) x [z, z + size_z), one of the
+//sizes being 1, with x and z relative to the chunk and y the world's.
+struct GreedyQuad {
+    CubeFace side;
+    int16_t block;
+    int x, y, z;
+    int size_x, size_y, size_z;
+};
+
+//Neighbouring chunks' voxels in the order LEFT, RIGHT, FORWARD, BACK, as
+//they are towards -x, +x, +z and -z. NULL ones count as air.
+struct GreedyNeighbours {
+    const ChunkVoxels* sides[4];
+};
+
+//Appends the merged faces of voxels to quads. Faces against blocks of the
+//neighbouring chunks are left out. Walls of the stone below voxels' sections
+//are meshed too, down to the lowest section a neighbour stores.
+void greedy_mesh(const ChunkVoxels &voxels, const GreedyNeighbours &neighbours, std::vector<GreedyQuad> &quads);
+
+#ifdef GREEDY_MESH_IMP
+
+#include <algorithm>
+#include <bit>
+
+//Solid mask of column (x, z) of world section section in voxels; below the
+//stored sections is solid and above them, or with no voxels, is air
+uint64_t greedy_column(const ChunkVoxels* voxels, int section, int x, int z) {
+    if(voxels == NULL) {
+        return 0;
+    }
+    int s = section - voxels->first;
+    if(s < 0) {
+        return voxels->section_height >= 64 ? ~0ull : (1ull << voxels->section_height) - 1;
+    }
+    if(s >= static_cast<int>(voxels->sections.size())) {
+        return 0;
+    }
+    return voxels->column(s, x, z);
+}
+
+//Bits [y, y + length) of a column word
+uint64_t greedy_run(int y, int length) {
+    return (length >= 64 ? ~0ull : (1ull << length) - 1) << y;
+}
+
+//Per-thread face masks of the section being meshed
+struct GreedyScratch {
+    std::vector<uint64_t> faces[6];     //[x * depth + z], bit y
+    std::vector<uint64_t> rows;         //TOP or BOTTOM faces, [y * depth + z], bit x
+};
+
+thread_local GreedyScratch GREEDY_SCRATCH;
+
+//Block at (x, y, z) of a section, or stone for one that isn't stored
+int16_t greedy_block(const PaletteVoxels* section, int x, int y, int z) {
+    return section == NULL ? static_cast<int16_t>(STONE) : section->get(x, y, z);
+}
+
+//Whether blocks y to y + length of column (x, z) are all block
+bool greedy_same(const PaletteVoxels* section, int x, int y, int z, int length, int16_t block) {
+    for(int i = 0; i < length; ++i) {
+        if(greedy_block(section, x, y + i, z) != block) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//Merges the faces of one side whose rows are column words, along y, and
+//which grow across neighbouring columns: along z for LEFT and RIGHT, along x
+//for FORWARD and BACK. section is NULL below the stored sections.
+void greedy_merge_columns(const ChunkVoxels &voxels, const PaletteVoxels* section, int base, CubeFace side,
+    std::vector<uint64_t> &faces, std::vector<GreedyQuad> &quads) {
+    bool along_z = side == LEFT || side == RIGHT;
+    int rows = along_z ? voxels.width : voxels.depth;
+    int across = along_z ? voxels.depth : voxels.width;
+    for(int r = 0; r < rows; ++r) {
+        for(int a = 0; a < across; ++a) {
+            int x = along_z ? r : a;
+            int z = along_z ? a : r;
+            uint64_t &word = faces[static_cast<size_t>(x) * voxels.depth + z];
+            while(word != 0) {
+                int y = std::countr_zero(word);
+                int16_t block = greedy_block(section, x, y, z);
+                int height = 1;
+                while(y + height < 64 && ((word >> (y + height)) & 1) && greedy_block(section, x, y + height, z) == block) {
+                    ++height;
+                }
+                uint64_t run = greedy_run(y, height);
+                word &= ~run;
+
+                int width = 1;
+                while(a + width < across) {
+                    int nx = along_z ? x : x + width;
+                    int nz = along_z ? z + width : z;
+                    uint64_t &next = faces[static_cast<size_t>(nx) * voxels.depth + nz];
+                    if((next & run) != run || !greedy_same(section, nx, y, nz, height, block)) {
+                        break;
+                    }
+                    next &= ~run;
+                    ++width;
+                }
+                quads.push_back({ side, block, x, base + y, z, along_z ? 1 : width, height, along_z ? width : 1 });
+            }
+        }
+    }
+}
+
+//Merges TOP or BOTTOM faces, turned into rows along x first
+void greedy_merge_rows(const ChunkVoxels &voxels, const PaletteVoxels* section, int base, CubeFace side,
+    std::vector<uint64_t> &faces, std::vector<uint64_t> &rows, std::vector<GreedyQuad> &quads) {
+    int depth = voxels.depth;
+    rows.assign(static_cast<size_t>(voxels.section_height) * depth, 0);
+    for(int x = 0; x < voxels.width; ++x) {
+        for(int z = 0; z < depth; ++z) {
+            for(uint64_t word = faces[static_cast<size_t>(x) * depth + z]; word != 0; word &= word - 1) {
+                rows[static_cast<size_t>(std::countr_zero(word)) * depth + z] |= 1ull << x;
+            }
+        }
+    }
+    for(int y = 0; y < voxels.section_height; ++y) {
+        for(int z = 0; z < depth; ++z) {
+            uint64_t &row = rows[static_cast<size_t>(y) * depth + z];
+            while(row != 0) {
+                int x = std::countr_zero(row);
+                int16_t block = greedy_block(section, x, y, z);
+                int width = 1;
+                while(x + width < 64 && ((row >> (x + width)) & 1) && greedy_block(section, x + width, y, z) == block) {
+                    ++width;
+                }
+                uint64_t run = greedy_run(x, width);
+                row &= ~run;
+
+                int length = 1;
+                while(z + length < depth) {
+                    uint64_t &next = rows[static_cast<size_t>(y) * depth + z + length];
+                    bool same = (next & run) == run;
+                    for(int i = 0; same && i < width; ++i) {
+                        same = greedy_block(section, x + i, y, z + length) == block;
+                    }
+                    if(!same) {
+                        break;
+                    }
+                    next &= ~run;
+                    ++length;
+                }
+                quads.push_back({ side, block, x, base + y, z, width, 1, length });
+            }
+        }
+    }
+}
+
+void greedy_mesh(const ChunkVoxels &voxels, const GreedyNeighbours &neighbours, std::vector<GreedyQuad> &quads) {
+    GreedyScratch &scratch = GREEDY_SCRATCH;
+    int width = voxels.width;
+    int depth = voxels.depth;
+    int top = voxels.section_height - 1;
+    for(int side = LEFT; side <= BOTTOM; ++side) {
+        scratch.faces[side].resize(static_cast<size_t>(width) * depth);
+    }
+
+    //Below its stored sections the chunk is stone, but a neighbour may store
+    //air there that it faces, so start from the lowest section any of them stores
+    int lowest = voxels.first;
+    for(int side = LEFT; side <= BACK; ++side) {
+        if(neighbours.sides[side] != NULL && !neighbours.sides[side]->sections.empty()) {
+            lowest = std::min(lowest, neighbours.sides[side]->first);
+        }
+    }
+    int end = voxels.first + static_cast<int>(voxels.sections.size());
+    for(int section = lowest; section < end; ++section) {
+        int s = section - voxels.first;
+        const PaletteVoxels* stored = s >= 0 ? &voxels.sections[s] : NULL;
+        bool faces = false;
+        for(int x = 0; x < width; ++x) {
+            for(int z = 0; z < depth; ++z) {
+                uint64_t column = greedy_column(&voxels, section, x, z);
+                size_t i = static_cast<size_t>(x) * depth + z;
+                if(column == 0) {
+                    for(int side = LEFT; side <= BOTTOM; ++side) {
+                        scratch.faces[side][i] = 0;
+                    }
+                    continue;
+                }
+                uint64_t above = greedy_column(&voxels, section + 1, x, z);
+                uint64_t below = greedy_column(&voxels, section - 1, x, z);
+                uint64_t left = x > 0 ? greedy_column(&voxels, section, x - 1, z) : greedy_column(neighbours.sides[LEFT], section, width - 1, z);
+                uint64_t right = x + 1 < width ? greedy_column(&voxels, section, x + 1, z) : greedy_column(neighbours.sides[RIGHT], section, 0, z);
+                uint64_t forward = z + 1 < depth ? greedy_column(&voxels, section, x, z + 1) : greedy_column(neighbours.sides[FORWARD], section, x, 0);
+                uint64_t back = z > 0 ? greedy_column(&voxels, section, x, z - 1) : greedy_column(neighbours.sides[BACK], section, x, depth - 1);
+                scratch.faces[TOP][i] = column & ~((column >> 1) | ((above & 1) << top));
+                scratch.faces[BOTTOM][i] = column & ~((column << 1) | ((below >> top) & 1));
+                scratch.faces[LEFT][i] = column & ~left;
+                scratch.faces[RIGHT][i] = column & ~right;
+                scratch.faces[FORWARD][i] = column & ~forward;
+                scratch.faces[BACK][i] = column & ~back;
+                for(int side = LEFT; side <= BOTTOM; ++side) {
+                    faces = faces || scratch.faces[side][i] != 0;
+                }
+            }
+        }
+        //Sections below the stored ones usually face nothing
+        if(!faces) {
+            continue;
+        }
+        int base = section * voxels.section_height;
+        greedy_merge_columns(voxels, stored, base, LEFT, scratch.faces[LEFT], quads);
+        greedy_merge_columns(voxels, stored, base, RIGHT, scratch.faces[RIGHT], quads);
+        greedy_merge_columns(voxels, stored, base, FORWARD, scratch.faces[FORWARD], quads);
+        greedy_merge_columns(voxels, stored, base, BACK, scratch.faces[BACK], quads);
+        greedy_merge_rows(voxels, stored, base, TOP, scratch.faces[TOP], scratch.rows, quads);
+        greedy_merge_rows(voxels, stored, base, BOTTOM, scratch.faces[BOTTOM], scratch.rows, quads);
+    }
+}
+
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+//Counter-based random numbers: each value is a pure hash of (seed, cell,
+//stream), so there is no generator state to share between threads and a
+//cell gets the same answer however many times, in whatever order and on
+//whichever thread it is asked. Use a different stream for each independent
+//decision made about the same cell.
+
+//splitmix64's output function, a full-avalanche 64-bit mix
+constexpr uint64_t hash_mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+constexpr uint64_t cell_hash(uint64_t seed, int32_t x, int32_t z, uint32_t stream) {
+    uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(z);
+    return hash_mix64(hash_mix64(seed ^ (static_cast<uint64_t>(stream) * 0x9E3779B97F4A7C15ull)) ^ key);
+}
+
+//Uniform in [0, 1), from the top 24 bits so every value is exact in a float
+constexpr float cell_random(uint64_t seed, int32_t x, int32_t z, uint32_t stream) {
+    return static_cast<float>(cell_hash(seed, x, z, stream) >> 40) * (1.0f / 16777216.0f);
+}
+
+//cell_random streams, one per kind of decision made about a world cell
+const uint32_t RNG_STREAM_TREES = 1;
+const uint32_t RNG_STREAM_BIOME_SITE_X = 2;
+const uint32_t RNG_STREAM_BIOME_SITE_Z = 3;
+const uint32_t RNG_STREAM_BIOME_TYPE = 4;
+const uint32_t RNG_STREAM_EROSION_X = 5;
+const uint32_t RNG_STREAM_EROSION_Z = 6;
+const uint32_t RNG_STREAM_WFC_ORDER = 7;
+const uint32_t RNG_STREAM_WFC_CHOICE = 8;
+const uint32_t RNG_STREAM_WFC_REGION = 9;
+const uint32_t RNG_STREAM_STRUCTURE_SITE = 10;
+const uint32_t RNG_STREAM_RUIN = 11;
+const uint32_t RNG_STREAM_TREE_HEIGHT = 12;
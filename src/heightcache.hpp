@@ -0,0 +1,523 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "hashrng.hpp"
+#include "terrain.hpp"
+
+//Terrain heights cached in square tiles, shared by everything that reads the
+//surface: chunk meshes, the far terrain, billboards and, through
+//heightquery.hpp, has_block and anything else asking for one height.
+//
+//Each level of detail samples the terrain on a lattice HEIGHT_LOD_SPACING[lod]
+//blocks apart, and tile (tx, tz) at that lod holds lattice points
+//[tx * HEIGHT_TILE_SIZE, (tx + 1) * HEIGHT_TILE_SIZE) on each axis. Lod 0's
+//half-block lattice has every chunk cell corner and centre on it, lod 1's the
+//far terrain's 5-block cells. A tile is sampled in one batch the first time
+//anything reads it and then stays until HEIGHT_CACHE_TILES newer ones push it out.
+//
+//Every tile also carries a min/max pyramid, so the height range of any
+//rectangle of lattice points costs a walk down a quadtree rather than a read
+//of every sample. Edits made through set_height are kept apart from the
+//tiles, so they survive eviction, and patch the pyramids of cached tiles in
+//place of rebuilding them.
+
+#define HEIGHT_TILE_SIZE 64
+#define HEIGHT_LOD_COUNT 2
+#define HEIGHT_CACHE_TILES 256
+
+const float HEIGHT_LOD_SPACING[HEIGHT_LOD_COUNT] = { 0.5f, 2.5f };
+const float HEIGHT_LOD_INVERSE_SPACING[HEIGHT_LOD_COUNT] = { 2.0f, 0.4f };
+//Lod 0 lattice steps per step of each lod's lattice
+const int HEIGHT_LOD_RATIO[HEIGHT_LOD_COUNT] = { 1, 5 };
+
+//Pyramid level k has HEIGHT_TILE_SIZE >> k cells a side, each bounding 2^k x 2^k samples
+#define HEIGHT_PYRAMID_LEVELS 7
+
+//Where level k (k >= 1) starts in HeightTile's pyramid arrays. Level 0 is the samples themselves.
+constexpr int height_pyramid_offset(int level) {
+    return level <= 1 ? 0 : height_pyramid_offset(level - 1) + (HEIGHT_TILE_SIZE >> (level - 1)) * (HEIGHT_TILE_SIZE >> (level - 1));
+}
+
+#define HEIGHT_PYRAMID_CELLS height_pyramid_offset(HEIGHT_PYRAMID_LEVELS)
+
+struct HeightBounds {
+    float min;
+    float max;
+
+    //Nothing yet; merging anything in replaces both
+    static HeightBounds empty() { return { INFINITY, -INFINITY }; }
+    bool valid() const { return min <= max; }
+    void merge(float low, float high) {
+        min = low < min ? low : min;
+        max = high > max ? high : max;
+    }
+};
+
+struct HeightTile {
+    int tx, tz, lod;
+    //[x * HEIGHT_TILE_SIZE + z], x and z relative to the tile's first lattice point
+    float heights[HEIGHT_TILE_SIZE * HEIGHT_TILE_SIZE];
+    float materials[HEIGHT_TILE_SIZE * HEIGHT_TILE_SIZE];
+    float pyramid_min[HEIGHT_PYRAMID_CELLS];
+    float pyramid_max[HEIGHT_PYRAMID_CELLS];
+
+    float cell_min(int level, int i, int j) const {
+        return level == 0 ? heights[i * HEIGHT_TILE_SIZE + j] :
+            pyramid_min[height_pyramid_offset(level) + i * (HEIGHT_TILE_SIZE >> level) + j];
+    }
+    float cell_max(int level, int i, int j) const {
+        return level == 0 ? heights[i * HEIGHT_TILE_SIZE + j] :
+            pyramid_max[height_pyramid_offset(level) + i * (HEIGHT_TILE_SIZE >> level) + j];
+    }
+
+    //Fills every level from heights
+    void build_pyramid();
+    //Changes one sample and the pyramid cells above it
+    void set_height(int x, int z, float height);
+    //Range of the samples in [x0, x1] x [z0, z1], inclusive and relative to
+    //the tile, merged into bounds. Parts outside the tile are ignored.
+    void bounds(int x0, int z0, int x1, int z1, HeightBounds &bounds) const;
+
+private:
+    void update_cell(int level, int i, int j);
+    void bounds_in(int level, int i, int j, int x0, int z0, int x1, int z1, HeightBounds &bounds) const;
+};
+
+//Bounded LRU of HeightTiles. Every method is safe to call from any thread.
+class HeightCache {
+public:
+    explicit HeightCache(size_t capacity);
+
+    //The tile, sampling it first on a miss. It stays valid for as long as it
+    //is held, even if the cache evicts it meanwhile.
+    std::shared_ptr<const HeightTile> tile(int tx, int tz, int lod);
+
+    //Heights and materials (either may be NULL) at the lod's lattice points
+    //(lx + i * stride, lz + j * stride) for i < width, j < depth, written to
+    //[i * depth + j]. Locks once per tile touched rather than per point.
+    void sample_lattice(int lod, int lx, int lz, int stride, int width, int depth, float* heights, float* materials);
+
+    //Lowest and highest lattice height in [lx0, lx1] x [lz0, lz1] at lod, inclusive
+    HeightBounds bounds(int lod, int lx0, int lz0, int lx1, int lz1);
+
+    //Replaces the height at lod 0 lattice point (lx, lz), in every lod whose
+    //lattice has it. Cached tiles are copied, patched and swapped in, so
+    //readers still holding the old ones see no change under them.
+    void set_height(int lx, int lz, float height);
+
+    //Drops every tile. Call after anything changes the terrain (seed or graph).
+    //Edits made with set_height are kept.
+    void clear();
+
+    //Goes up by one whenever cached tiles are dropped or replaced, so holders of tiles know to let them go
+    unsigned int generation() const { return change_count.load(std::memory_order_acquire); }
+    //Goes up by one per clear(), after which nothing sampled before can be trusted
+    unsigned int clears() const { return clear_count.load(std::memory_order_acquire); }
+    //set_height calls so far
+    size_t edit_count() const { return edit_total.load(std::memory_order_acquire); }
+    //Appends the lod 0 points edited from the first-th set_height call on, in order
+    void edits_since(size_t first, std::vector<std::pair<int, int>> &points);
+
+    size_t hits() const { return hit_count.load(std::memory_order_relaxed); }
+    size_t misses() const { return miss_count.load(std::memory_order_relaxed); }
+    size_t size();
+
+private:
+    struct Key {
+        int tx, tz, lod;
+        bool operator==(const Key &other) const { return tx == other.tx && tz == other.tz && lod == other.lod; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &key) const { return static_cast<size_t>(cell_hash(key.lod, key.tx, key.tz, 0)); }
+    };
+    struct Entry {
+        std::shared_ptr<const HeightTile> tile;
+        std::list<Key>::iterator age;
+    };
+
+    //Writes the edits that fall in tile. Call with mutex held.
+    void apply_edits(HeightTile &tile);
+
+    size_t capacity;
+    std::mutex mutex;
+    std::list<Key> ages;    //most recently used first
+    std::unordered_map<Key, Entry, KeyHash> tiles;
+    std::map<std::pair<int, int>, float> edits;     //lod 0 (lx, lz) to height
+    std::vector<std::pair<int, int>> edit_log;      //every set_height's point, in order
+    std::atomic<size_t> hit_count;
+    std::atomic<size_t> miss_count;
+    std::atomic<unsigned int> change_count;
+    std::atomic<unsigned int> clear_count;
+    std::atomic<size_t> edit_total;
+};
+
+extern HeightCache HEIGHT_CACHE;
+
+//Range of the lod's lattice heights over every
+//lattice point on or around the world rectangle [x0, x1] x [z0, z1]. The
+//meshes interpolate linearly between lattice points, so this bounds what is
+//drawn there.
+HeightBounds height_bounds(float x0, float z0, float x1, float z1, int lod = 0);
+
+//set_height for world (x, z). Returns false if it isn't on the half-block lattice.
+bool set_height_at(float x, float z, float height);
+
+//Index of coord on the lod's lattice, or false if it isn't exactly on it
+bool height_lattice_index(float coord, int lod, int &index);
+
+//Terrain under a width x depth grid of square cells of side step, whose lowest
+//corner is (x0, z0). Neighbouring cells share corners, so a 16 x 16 chunk
+//needs 17 x 17 corner heights plus 256 centres rather than five samples per cell.
+struct TerrainCornerGrid {
+    float x0, z0;
+    float step;
+    int width, depth;
+    std::vector<float> corners;     //(width + 1) x (depth + 1) heights, [x * (depth + 1) + z]
+    std::vector<float> centres;     //width x depth heights, [x * depth + z]
+    std::vector<float> materials;   //TERRAIN_MATERIAL at each centre
+
+    float corner(int x, int z) const { return corners[x * (depth + 1) + z]; }
+    float centre(int x, int z) const { return centres[x * depth + z]; }
+    float material(int x, int z) const { return materials[x * depth + z]; }
+    float cell_x(int x) const { return x0 + (x + 0.5f) * step; }
+    float cell_z(int z) const { return z0 + (z + 0.5f) * step; }
+};
+
+//Reads through HEIGHT_CACHE when the corners and centres all fall on one
+//lod's lattice, and samples the terrain directly otherwise.
+void fill_corner_grid(TerrainCornerGrid &grid, float x0, float z0, int width, int depth, float step);
+
+//The two halves of fill_corner_grid, for callers that want the corner heights
+//before the centres and materials. fill_corner_centres reads the grid's
+//placement from fill_corner_heights.
+void fill_corner_heights(TerrainCornerGrid &grid, float x0, float z0, int width, int depth, float step);
+void fill_corner_centres(TerrainCornerGrid &grid);
+
+//Rounds towards negative infinity, unlike /
+int floor_div(int a, int b);
+
+#ifdef HEIGHT_CACHE_IMP
+
+HeightCache HEIGHT_CACHE(HEIGHT_CACHE_TILES);
+
+int floor_div(int a, int b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+void HeightTile::update_cell(int level, int i, int j) {
+    float low = std::min(std::min(cell_min(level - 1, 2 * i, 2 * j), cell_min(level - 1, 2 * i, 2 * j + 1)),
+        std::min(cell_min(level - 1, 2 * i + 1, 2 * j), cell_min(level - 1, 2 * i + 1, 2 * j + 1)));
+    float high = std::max(std::max(cell_max(level - 1, 2 * i, 2 * j), cell_max(level - 1, 2 * i, 2 * j + 1)),
+        std::max(cell_max(level - 1, 2 * i + 1, 2 * j), cell_max(level - 1, 2 * i + 1, 2 * j + 1)));
+    int cell = height_pyramid_offset(level) + i * (HEIGHT_TILE_SIZE >> level) + j;
+    pyramid_min[cell] = low;
+    pyramid_max[cell] = high;
+}
+
+void HeightTile::build_pyramid() {
+    for(int level = 1; level < HEIGHT_PYRAMID_LEVELS; ++level) {
+        int side = HEIGHT_TILE_SIZE >> level;
+        for(int i = 0; i < side; ++i) {
+            for(int j = 0; j < side; ++j) {
+                update_cell(level, i, j);
+            }
+        }
+    }
+}
+
+void HeightTile::set_height(int x, int z, float height) {
+    heights[x * HEIGHT_TILE_SIZE + z] = height;
+    for(int level = 1; level < HEIGHT_PYRAMID_LEVELS; ++level) {
+        update_cell(level, x >> level, z >> level);
+    }
+}
+
+void HeightTile::bounds_in(int level, int i, int j, int x0, int z0, int x1, int z1, HeightBounds &bounds) const {
+    int cx0 = i << level;
+    int cz0 = j << level;
+    int cx1 = cx0 + (1 << level) - 1;
+    int cz1 = cz0 + (1 << level) - 1;
+    if(cx1 < x0 || cx0 > x1 || cz1 < z0 || cz0 > z1) {
+        return;
+    }
+    if(level == 0 || (cx0 >= x0 && cx1 <= x1 && cz0 >= z0 && cz1 <= z1)) {
+        bounds.merge(cell_min(level, i, j), cell_max(level, i, j));
+        return;
+    }
+    for(int child = 0; child < 4; ++child) {
+        bounds_in(level - 1, 2 * i + (child & 1), 2 * j + (child >> 1), x0, z0, x1, z1, bounds);
+    }
+}
+
+void HeightTile::bounds(int x0, int z0, int x1, int z1, HeightBounds &bounds) const {
+    bounds_in(HEIGHT_PYRAMID_LEVELS - 1, 0, 0, x0, z0, x1, z1, bounds);
+}
+
+HeightCache::HeightCache(size_t capacity) : capacity(capacity), hit_count(0), miss_count(0), change_count(0), clear_count(0), edit_total(0) {
+}
+
+std::shared_ptr<const HeightTile> HeightCache::tile(int tx, int tz, int lod) {
+    Key key = { tx, tz, lod };
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = tiles.find(key);
+        if(found != tiles.end()) {
+            ages.splice(ages.begin(), ages, found->second.age);
+            hit_count.fetch_add(1, std::memory_order_relaxed);
+            return found->second.tile;
+        }
+    }
+    miss_count.fetch_add(1, std::memory_order_relaxed);
+
+    //Sampled without the lock held, so other threads' hits don't wait on it.
+    //Two threads missing the same tile both sample it and the first one in wins.
+    std::shared_ptr<HeightTile> fresh = std::make_shared<HeightTile>();
+    fresh->tx = tx;
+    fresh->tz = tz;
+    fresh->lod = lod;
+    float spacing = HEIGHT_LOD_SPACING[lod];
+    std::vector<float> xs(HEIGHT_TILE_SIZE * HEIGHT_TILE_SIZE);
+    std::vector<float> zs(HEIGHT_TILE_SIZE * HEIGHT_TILE_SIZE);
+    for(int x = 0; x < HEIGHT_TILE_SIZE; ++x) {
+        for(int z = 0; z < HEIGHT_TILE_SIZE; ++z) {
+            xs[x * HEIGHT_TILE_SIZE + z] = (tx * HEIGHT_TILE_SIZE + x) * spacing;
+            zs[x * HEIGHT_TILE_SIZE + z] = (tz * HEIGHT_TILE_SIZE + z) * spacing;
+        }
+    }
+    terrain_sample_batch(xs.data(), zs.data(), fresh->heights, fresh->materials, xs.size());
+    fresh->build_pyramid();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = tiles.find(key);
+    if(found != tiles.end()) {
+        return found->second.tile;
+    }
+    //Under the lock, so no edit can land between these and the insert
+    apply_edits(*fresh);
+    ages.push_front(key);
+    tiles[key] = { fresh, ages.begin() };
+    while(tiles.size() > capacity) {
+        tiles.erase(ages.back());
+        ages.pop_back();
+    }
+    return fresh;
+}
+
+void HeightCache::sample_lattice(int lod, int lx, int lz, int stride, int width, int depth, float* heights, float* materials) {
+    if(width <= 0 || depth <= 0) {
+        return;
+    }
+    const int T = HEIGHT_TILE_SIZE;
+    int last_x = lx + (width - 1) * stride;
+    int last_z = lz + (depth - 1) * stride;
+    for(int tx = floor_div(lx, T); tx <= floor_div(last_x, T); ++tx) {
+        //Points i0 <= i < i1 land in this column of tiles
+        int i0 = std::max(0, -floor_div(lx - tx * T, stride));
+        int i1 = std::min(width, -floor_div(lx - (tx + 1) * T, stride));
+        if(i0 >= i1) {
+            continue;
+        }
+        for(int tz = floor_div(lz, T); tz <= floor_div(last_z, T); ++tz) {
+            int j0 = std::max(0, -floor_div(lz - tz * T, stride));
+            int j1 = std::min(depth, -floor_div(lz - (tz + 1) * T, stride));
+            if(j0 >= j1) {
+                continue;
+            }
+            std::shared_ptr<const HeightTile> t = tile(tx, tz, lod);
+            for(int i = i0; i < i1; ++i) {
+                int row = (lx + i * stride - tx * T) * T - tz * T;
+                for(int j = j0; j < j1; ++j) {
+                    int local = row + lz + j * stride;
+                    if(heights != NULL) {
+                        heights[i * depth + j] = t->heights[local];
+                    }
+                    if(materials != NULL) {
+                        materials[i * depth + j] = t->materials[local];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void HeightCache::apply_edits(HeightTile &tile) {
+    int ratio = HEIGHT_LOD_RATIO[tile.lod];
+    int lx0 = tile.tx * HEIGHT_TILE_SIZE * ratio;
+    int lz0 = tile.tz * HEIGHT_TILE_SIZE * ratio;
+    int lx1 = lx0 + (HEIGHT_TILE_SIZE - 1) * ratio;
+    int lz1 = lz0 + (HEIGHT_TILE_SIZE - 1) * ratio;
+    auto edit = edits.lower_bound({ lx0, lz0 });
+    auto end = edits.upper_bound({ lx1, lz1 });
+    for(; edit != end; ++edit) {
+        int lx = edit->first.first - lx0;
+        int lz = edit->first.second - lz0;
+        if(lz >= 0 && lz <= lz1 - lz0 && lx % ratio == 0 && lz % ratio == 0) {
+            tile.set_height(lx / ratio, lz / ratio, edit->second);
+        }
+    }
+}
+
+HeightBounds HeightCache::bounds(int lod, int lx0, int lz0, int lx1, int lz1) {
+    const int T = HEIGHT_TILE_SIZE;
+    HeightBounds result = HeightBounds::empty();
+    for(int tx = floor_div(lx0, T); tx <= floor_div(lx1, T); ++tx) {
+        for(int tz = floor_div(lz0, T); tz <= floor_div(lz1, T); ++tz) {
+            tile(tx, tz, lod)->bounds(lx0 - tx * T, lz0 - tz * T, lx1 - tx * T, lz1 - tz * T, result);
+        }
+    }
+    return result;
+}
+
+void HeightCache::set_height(int lx, int lz, float height) {
+    std::lock_guard<std::mutex> lock(mutex);
+    edits[{ lx, lz }] = height;
+    for(int lod = 0; lod < HEIGHT_LOD_COUNT; ++lod) {
+        int ratio = HEIGHT_LOD_RATIO[lod];
+        if(floor_div(lx, ratio) * ratio != lx || floor_div(lz, ratio) * ratio != lz) {
+            continue;
+        }
+        int x = lx / ratio;
+        int z = lz / ratio;
+        Key key = { floor_div(x, HEIGHT_TILE_SIZE), floor_div(z, HEIGHT_TILE_SIZE), lod };
+        auto found = tiles.find(key);
+        if(found == tiles.end()) {
+            continue;
+        }
+        std::shared_ptr<HeightTile> patched = std::make_shared<HeightTile>(*found->second.tile);
+        patched->set_height(x - key.tx * HEIGHT_TILE_SIZE, z - key.tz * HEIGHT_TILE_SIZE, height);
+        found->second.tile = patched;
+    }
+    edit_log.push_back({ lx, lz });
+    edit_total.store(edit_log.size(), std::memory_order_release);
+    change_count.fetch_add(1, std::memory_order_release);
+}
+
+void HeightCache::edits_since(size_t first, std::vector<std::pair<int, int>> &points) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(first < edit_log.size()) {
+        points.insert(points.end(), edit_log.begin() + first, edit_log.end());
+    }
+}
+
+void HeightCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    tiles.clear();
+    ages.clear();
+    clear_count.fetch_add(1, std::memory_order_release);
+    change_count.fetch_add(1, std::memory_order_release);
+}
+
+size_t HeightCache::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return tiles.size();
+}
+
+bool height_lattice_index(float coord, int lod, int &index) {
+    //Casts rather than std::floor, which is a libm call without SSE4.1
+    float scaled = coord * HEIGHT_LOD_INVERSE_SPACING[lod];
+    if(!(std::fabs(scaled) < 1e9f)) {
+        return false;
+    }
+    index = static_cast<int>(scaled);
+    if(static_cast<float>(index) != scaled) {
+        return false;
+    }
+    //Tiles sample at index * spacing, which must give coord back exactly
+    return index * HEIGHT_LOD_SPACING[lod] == coord;
+}
+
+HeightBounds height_bounds(float x0, float z0, float x1, float z1, int lod) {
+    float inverse = HEIGHT_LOD_INVERSE_SPACING[lod];
+    return HEIGHT_CACHE.bounds(lod, static_cast<int>(std::floor(x0 * inverse)), static_cast<int>(std::floor(z0 * inverse)),
+        static_cast<int>(std::ceil(x1 * inverse)), static_cast<int>(std::ceil(z1 * inverse)));
+}
+
+bool set_height_at(float x, float z, float height) {
+    int lx, lz;
+    if(!height_lattice_index(x, 0, lx) || !height_lattice_index(z, 0, lz)) {
+        return false;
+    }
+    HEIGHT_CACHE.set_height(lx, lz, height);
+    return true;
+}
+
+//The coarsest lod whose lattice has every corner and centre of grid on it,
+//or -1. Coarse tiles cover more ground per sample, so a wide grid with a big
+//step pulls in far fewer of them.
+int corner_grid_lod(const TerrainCornerGrid &grid, int &lx, int &lz, int &half) {
+    //Centres are half a step in from the corners, so half steps must be on the lattice too
+    for(int lod = HEIGHT_LOD_COUNT - 1; lod >= 0; --lod) {
+        if(height_lattice_index(grid.x0, lod, lx) && height_lattice_index(grid.z0, lod, lz) &&
+            height_lattice_index(grid.step / 2.0f, lod, half) && half > 0) {
+            return lod;
+        }
+    }
+    return -1;
+}
+
+void fill_corner_heights(TerrainCornerGrid &grid, float x0, float z0, int width, int depth, float step) {
+    grid.x0 = x0;
+    grid.z0 = z0;
+    grid.step = step;
+    grid.width = width;
+    grid.depth = depth;
+    grid.corners.resize(static_cast<size_t>(width + 1) * (depth + 1));
+
+    int lx, lz, half;
+    int lod = corner_grid_lod(grid, lx, lz, half);
+    if(lod >= 0) {
+        HEIGHT_CACHE.sample_lattice(lod, lx, lz, 2 * half, width + 1, depth + 1, grid.corners.data(), NULL);
+        return;
+    }
+
+    std::vector<float> xs;
+    std::vector<float> zs;
+    for(int x = 0; x <= width; ++x) {
+        for(int z = 0; z <= depth; ++z) {
+            xs.push_back(x0 + x * step);
+            zs.push_back(z0 + z * step);
+        }
+    }
+    noise_wrap_batch(xs.data(), zs.data(), grid.corners.data(), xs.size());
+}
+
+void fill_corner_centres(TerrainCornerGrid &grid) {
+    grid.centres.resize(static_cast<size_t>(grid.width) * grid.depth);
+    grid.materials.resize(grid.centres.size());
+
+    int lx, lz, half;
+    int lod = corner_grid_lod(grid, lx, lz, half);
+    if(lod >= 0) {
+        HEIGHT_CACHE.sample_lattice(lod, lx + half, lz + half, 2 * half, grid.width, grid.depth,
+            grid.centres.data(), grid.materials.data());
+        return;
+    }
+
+    std::vector<float> xs;
+    std::vector<float> zs;
+    for(int x = 0; x < grid.width; ++x) {
+        for(int z = 0; z < grid.depth; ++z) {
+            xs.push_back(grid.cell_x(x));
+            zs.push_back(grid.cell_z(z));
+        }
+    }
+    terrain_sample_batch(xs.data(), zs.data(), grid.centres.data(), grid.materials.data(), xs.size());
+}
+
+void fill_corner_grid(TerrainCornerGrid &grid, float x0, float z0, int width, int depth, float step) {
+    fill_corner_heights(grid, x0, z0, width, depth, step);
+    fill_corner_centres(grid);
+}
+
+#endif
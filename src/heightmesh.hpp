@@ -0,0 +1,207 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "heightcache.hpp"
+
+//Simplifies a TerrainCornerGrid's surface before meshing. Neighbouring cells
+//of one material whose corners all lie on one plane, to within a
+//tolerance, are merged greedily into a rectangle drawn as one polygon, so
+//plateaus and even slopes cost a few triangles rather than two per cell.
+//
+//Wherever a corner of one rectangle lies along the edge of a bigger one
+//(a T-junction), the bigger one's outline goes through that corner too, at
+//the same height, so the two meet exactly and no crack can open between
+//them. Corners on the grid's edges are always kept, so neighbouring grids,
+//simplified on their own, meet the same way.
+
+//How far a merged cell's corners may be off the plane it is drawn on, in blocks
+const float HEIGHT_MERGE_TOLERANCE = 0.1f;
+
+//Cells [x, x + width) x [z, z + depth) of the grid, all of material
+struct HeightQuad {
+    int x, z;
+    int width, depth;
+    float material;
+};
+
+//Corners (x, z) of a polygon, indices into the grid's corners
+typedef std::vector<std::pair<int, int>> HeightOutline;
+
+struct HeightMerge {
+    std::vector<HeightQuad> quads;
+    //[x * (depth + 1) + z], set for the corners some outline goes through
+    std::vector<unsigned char> kept;
+    int depth;
+
+    bool is_kept(int x, int z) const { return kept[x * (depth + 1) + z] != 0; }
+};
+
+void merge_height_cells(const TerrainCornerGrid &grid, float tolerance, HeightMerge &merge);
+
+//quad's outline, starting at its lowest corner and going along x first, with
+//every kept corner on its edges
+void height_quad_outline(const HeightMerge &merge, const HeightQuad &quad, HeightOutline &outline);
+
+//Triangles covering quad's outline, three indices into it each, in the
+//outline's winding. An index of outline.size() is the middle of the quad.
+void height_quad_triangles(const HeightQuad &quad, const HeightOutline &outline, std::vector<int> &triangles);
+
+#ifdef HEIGHT_MESH_IMP
+
+#include <cmath>
+
+//Whether the corners of cells [x, x + width) x [z, z + depth) are all within
+//tolerance of the plane through its corners
+bool height_cells_planar(const TerrainCornerGrid &grid, int x, int z, int width, int depth, float tolerance) {
+    float h00 = grid.corner(x, z);
+    float h10 = grid.corner(x + width, z);
+    float h01 = grid.corner(x, z + depth);
+    float h11 = grid.corner(x + width, z + depth);
+    //Bilinear across the corners is a plane only when the diagonals agree
+    if(std::fabs(h00 + h11 - h10 - h01) > tolerance) {
+        return false;
+    }
+    for(int i = 0; i <= width; ++i) {
+        for(int j = 0; j <= depth; ++j) {
+            float u = static_cast<float>(i) / width;
+            float v = static_cast<float>(j) / depth;
+            float plane = h00 + (h10 - h00) * u + (h01 - h00) * v;
+            if(std::fabs(grid.corner(x + i, z + j) - plane) > tolerance) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void merge_height_cells(const TerrainCornerGrid &grid, float tolerance, HeightMerge &merge) {
+    int width = grid.width;
+    int depth = grid.depth;
+    merge.quads.clear();
+    merge.depth = depth;
+    merge.kept.assign(static_cast<size_t>(width + 1) * (depth + 1), 0);
+    std::vector<unsigned char> taken(static_cast<size_t>(width) * depth, 0);
+    auto free_cell = [&](int x, int z, float material) {
+        return !taken[x * depth + z] && grid.material(x, z) == material;
+    };
+
+    for(int x = 0; x < width; ++x) {
+        for(int z = 0; z < depth; ++z) {
+            if(taken[x * depth + z]) {
+                continue;
+            }
+            float material = grid.material(x, z);
+            //Along z as far as it stays flat, then across x a whole row at a time
+            int d = 1;
+            while(z + d < depth && free_cell(x, z + d, material) && height_cells_planar(grid, x, z, 1, d + 1, tolerance)) {
+                ++d;
+            }
+            int w = 1;
+            while(x + w < width) {
+                bool row = true;
+                for(int j = 0; row && j < d; ++j) {
+                    row = free_cell(x + w, z + j, material);
+                }
+                if(!row || !height_cells_planar(grid, x, z, w + 1, d, tolerance)) {
+                    break;
+                }
+                ++w;
+            }
+            for(int i = 0; i < w; ++i) {
+                for(int j = 0; j < d; ++j) {
+                    taken[(x + i) * depth + z + j] = 1;
+                }
+            }
+            merge.quads.push_back({ x, z, w, d, material });
+            merge.kept[x * (depth + 1) + z] = 1;
+            merge.kept[(x + w) * (depth + 1) + z] = 1;
+            merge.kept[x * (depth + 1) + z + d] = 1;
+            merge.kept[(x + w) * (depth + 1) + z + d] = 1;
+        }
+    }
+    for(int x = 0; x <= width; ++x) {
+        merge.kept[x * (depth + 1)] = 1;
+        merge.kept[x * (depth + 1) + depth] = 1;
+    }
+    for(int z = 0; z <= depth; ++z) {
+        merge.kept[z] = 1;
+        merge.kept[width * (depth + 1) + z] = 1;
+    }
+}
+
+void height_quad_outline(const HeightMerge &merge, const HeightQuad &quad, HeightOutline &outline) {
+    int x0 = quad.x;
+    int z0 = quad.z;
+    int x1 = quad.x + quad.width;
+    int z1 = quad.z + quad.depth;
+    outline.clear();
+    for(int x = x0; x < x1; ++x) {
+        if(x == x0 || merge.is_kept(x, z0)) {
+            outline.push_back({ x, z0 });
+        }
+    }
+    for(int z = z0; z < z1; ++z) {
+        if(z == z0 || merge.is_kept(x1, z)) {
+            outline.push_back({ x1, z });
+        }
+    }
+    for(int x = x1; x > x0; --x) {
+        if(x == x1 || merge.is_kept(x, z1)) {
+            outline.push_back({ x, z1 });
+        }
+    }
+    for(int z = z1; z > z0; --z) {
+        if(z == z1 || merge.is_kept(x0, z)) {
+            outline.push_back({ x0, z });
+        }
+    }
+}
+
+//Which sides of quad point is on, a bit each for z0, x1, z1 and x0 in outline order
+int height_quad_sides(const HeightQuad &quad, const std::pair<int, int> &point) {
+    return (point.second == quad.z ? 1 : 0) | (point.first == quad.x + quad.width ? 2 : 0)
+        | (point.second == quad.z + quad.depth ? 4 : 0) | (point.first == quad.x ? 8 : 0);
+}
+
+void height_quad_triangles(const HeightQuad &quad, const HeightOutline &outline, std::vector<int> &triangles) {
+    int count = static_cast<int>(outline.size());
+    int extra[4] = { 0, 0, 0, 0 };
+    for(const std::pair<int, int> &point : outline) {
+        int sides = height_quad_sides(quad, point);
+        for(int s = 0; s < 4; ++s) {
+            //Corners are on two sides and in no side's count
+            if(sides == 1 << s) {
+                extra[s]++;
+            }
+        }
+    }
+    //A fan from a point with no other point in line with it along its sides
+    //has no flat triangles, and needs count - 2 of them
+    int apex = -1;
+    for(int c = 0; c < count && apex < 0; ++c) {
+        int sides = height_quad_sides(quad, outline[c]);
+        bool alone = true;
+        for(int s = 0; s < 4; ++s) {
+            if(sides & (1 << s)) {
+                alone = alone && extra[s] <= (sides == 1 << s ? 1 : 0);
+            }
+        }
+        if(alone) {
+            apex = c;
+        }
+    }
+    triangles.clear();
+    if(apex >= 0) {
+        for(int i = 1; i < count - 1; ++i) {
+            triangles.insert(triangles.end(), { apex, (apex + i) % count, (apex + i + 1) % count });
+        }
+        return;
+    }
+    for(int c = 0; c < count; ++c) {
+        triangles.insert(triangles.end(), { count, c, (c + 1) % count });
+    }
+}
+
+#endif
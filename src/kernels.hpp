@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+
+#include "cpu_dispatch.hpp"
+#include "perlin.h"
+#include "fractal.hpp"
+
+//Batch drivers behind NoiseKernels. Each kernels_*.cpp enables its lane type
+//in simd.h, includes this and calls make_noise_kernels once.
+//
+//Those files are compiled with their instruction set switched on, so nothing
+//they instantiate may also be instantiated elsewhere: the linker would keep
+//one copy and could hand AVX code to a CPU without it. Only the lane type's
+//own templates are used here, and a short tail is padded out to a full
+//register instead of falling back to the scalar functions.
+
+template <typename L, typename T>
+void noise2_batch_lanes(const uint8_t* p, const T* xs, const T* ys, T* out, size_t n) {
+    size_t i = 0;
+    for(; i + L::WIDTH <= n; i += L::WIDTH) {
+        L::store(out + i, noise2_lanes<L>(p, L::load(xs + i), L::load(ys + i)));
+    }
+    if(i < n) {
+        T tx[L::WIDTH] = {};
+        T ty[L::WIDTH] = {};
+        T to[L::WIDTH];
+        for(size_t j = 0; i + j < n; ++j) {
+            tx[j] = xs[i + j];
+            ty[j] = ys[i + j];
+        }
+        L::store(to, noise2_lanes<L>(p, L::load(tx), L::load(ty)));
+        for(size_t j = 0; i + j < n; ++j) {
+            out[i + j] = to[j];
+        }
+    }
+}
+
+template <typename L, typename T>
+void noise3_batch_lanes(const uint8_t* p, const T* xs, const T* ys, const T* zs, T* out, size_t n) {
+    size_t i = 0;
+    for(; i + L::WIDTH <= n; i += L::WIDTH) {
+        L::store(out + i, noise3_lanes<L>(p, L::load(xs + i), L::load(ys + i), L::load(zs + i)));
+    }
+    if(i < n) {
+        T tx[L::WIDTH] = {};
+        T ty[L::WIDTH] = {};
+        T tz[L::WIDTH] = {};
+        T to[L::WIDTH];
+        for(size_t j = 0; i + j < n; ++j) {
+            tx[j] = xs[i + j];
+            ty[j] = ys[i + j];
+            tz[j] = zs[i + j];
+        }
+        L::store(to, noise3_lanes<L>(p, L::load(tx), L::load(ty), L::load(tz)));
+        for(size_t j = 0; i + j < n; ++j) {
+            out[i + j] = to[j];
+        }
+    }
+}
+
+template <typename L>
+void fractal_batch_lanes(const uint8_t* p, const FractalNoise &fractal, const float* xs, const float* zs,
+    float* out, size_t n) {
+    size_t i = 0;
+    for(; i + L::WIDTH <= n; i += L::WIDTH) {
+        L::store(out + i, fractal2_lanes<L>(p, fractal, L::load(xs + i), L::load(zs + i)));
+    }
+    if(i < n) {
+        float tx[L::WIDTH] = {};
+        float tz[L::WIDTH] = {};
+        float to[L::WIDTH];
+        for(size_t j = 0; i + j < n; ++j) {
+            tx[j] = xs[i + j];
+            tz[j] = zs[i + j];
+        }
+        L::store(to, fractal2_lanes<L>(p, fractal, L::load(tx), L::load(tz)));
+        for(size_t j = 0; i + j < n; ++j) {
+            out[i + j] = to[j];
+        }
+    }
+}
+
+template <typename L>
+void fractal_deriv_batch_lanes(const uint8_t* p, const FractalNoise &fractal, const float* xs, const float* zs,
+    float* out, float* dxs, float* dzs, size_t n) {
+    typedef typename L::V V;
+    size_t i = 0;
+    for(; i + L::WIDTH <= n; i += L::WIDTH) {
+        V dx, dz;
+        L::store(out + i, fractal2_deriv_lanes<L>(p, fractal, L::load(xs + i), L::load(zs + i), dx, dz));
+        L::store(dxs + i, dx);
+        L::store(dzs + i, dz);
+    }
+    if(i < n) {
+        float tx[L::WIDTH] = {};
+        float tz[L::WIDTH] = {};
+        float to[L::WIDTH];
+        float tdx[L::WIDTH];
+        float tdz[L::WIDTH];
+        V dx, dz;
+        for(size_t j = 0; i + j < n; ++j) {
+            tx[j] = xs[i + j];
+            tz[j] = zs[i + j];
+        }
+        L::store(to, fractal2_deriv_lanes<L>(p, fractal, L::load(tx), L::load(tz), dx, dz));
+        L::store(tdx, dx);
+        L::store(tdz, dz);
+        for(size_t j = 0; i + j < n; ++j) {
+            out[i + j] = to[j];
+            dxs[i + j] = tdx[j];
+            dzs[i + j] = tdz[j];
+        }
+    }
+}
+
+template <typename LF, typename LD>
+NoiseKernels make_noise_kernels(SimdLevel level) {
+    NoiseKernels kernels;
+    kernels.level = level;
+    kernels.noise2_f = noise2_batch_lanes<LF, float>;
+    kernels.noise2_d = noise2_batch_lanes<LD, double>;
+    kernels.noise3_f = noise3_batch_lanes<LF, float>;
+    kernels.noise3_d = noise3_batch_lanes<LD, double>;
+    kernels.fractal = fractal_batch_lanes<LF>;
+    kernels.fractal_deriv = fractal_deriv_batch_lanes<LF>;
+    return kernels;
+}
@@ -0,0 +1,8 @@
+//AVX2 kernels, 8 floats / 4 doubles per register. Built with -mavx2 (see CMakeLists.txt).
+#define SIMD_LANES_AVX2
+#include "kernels.hpp"
+
+const NoiseKernels* noise_kernels_avx2() {
+    static const NoiseKernels kernels = make_noise_kernels<Avx2LanesF, Avx2LanesD>(SIMD_AVX2);
+    return &kernels;
+}
@@ -0,0 +1,8 @@
+//AVX-512F kernels, 16 floats / 8 doubles per register. Built with -mavx512f (see CMakeLists.txt).
+#define SIMD_LANES_AVX512
+#include "kernels.hpp"
+
+const NoiseKernels* noise_kernels_avx512() {
+    static const NoiseKernels kernels = make_noise_kernels<Avx512LanesF, Avx512LanesD>(SIMD_AVX512);
+    return &kernels;
+}
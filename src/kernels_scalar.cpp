@@ -0,0 +1,7 @@
+//Plain C++ kernels, the fallback on any CPU
+#include "kernels.hpp"
+
+const NoiseKernels* noise_kernels_scalar() {
+    static const NoiseKernels kernels = make_noise_kernels<ScalarLanes<float>, ScalarLanes<double> >(SIMD_SCALAR);
+    return &kernels;
+}
@@ -0,0 +1,8 @@
+//SSE4.1 kernels, 4 floats / 2 doubles per register. Built with -msse4.1 (see CMakeLists.txt).
+#define SIMD_LANES_SSE41
+#include "kernels.hpp"
+
+const NoiseKernels* noise_kernels_sse41() {
+    static const NoiseKernels kernels = make_noise_kernels<Sse41LanesF, Sse41LanesD>(SIMD_SSE41);
+    return &kernels;
+}
@@ -8,6 +8,7 @@
 #include <functional>
 #include <sstream>
 #include <fstream>
+#include <climits>
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -17,15 +18,63 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+#define CPU_DISPATCH_IMP
+#include "cpu_dispatch.hpp"
+
 #define PERLIN_IMP
 #include "perlin.h"
 
+#define FRACTAL_IMP
+#include "fractal.hpp"
+
+#define BIOME_IMP
+#include "biome.hpp"
+
+#define EROSION_IMP
+#include "erosion.hpp"
+
+#define WORLDGEN_IMP
+#include "worldgen.hpp"
+
+#define TERRAIN_IMP
+#include "terrain.hpp"
+
+#define HEIGHT_CACHE_IMP
+#include "heightcache.hpp"
+
+#define HEIGHT_QUERY_IMP
+#include "heightquery.hpp"
+
+#define WFC_IMP
+#include "wfc.hpp"
+
+#define STRUCTURES_IMP
+#include "structures.hpp"
+
+#define VOXELS_IMP
+#include "voxels.hpp"
+
+#define CHUNK_PIPELINE_IMP
+#include "chunkpipeline.hpp"
+
+#define GREEDY_MESH_IMP
+#include "greedymesh.hpp"
+
+#define HEIGHT_MESH_IMP
+#include "heightmesh.hpp"
+
+#define COLUMN_MESH_IMP
+#include "columnmesh.hpp"
+
 #define TEXTUREFACE_IMP
 #include "textureface.hpp"
 
+#include "hashrng.hpp"
+
 #include <entt/entt.hpp>
 #include <thread>
 #include <mutex>
+#include <atomic>
 
 
 enum GameState {
@@ -61,7 +110,6 @@ glm::vec3 CAMERA_UP(0.0f, 1.0f, 0.0f);
 
 //GAME-RELATED THINGS?
 float GLOBAL_BRIGHTNESS = 1.0;
-Perlin p;
 entt::registry REGISTRY;
 float SPEED_MULTIPLIER = 2.0f;
 
@@ -116,8 +164,6 @@ void update_time();
 void bind_geometry(GLuint vbov, GLuint vbouv, const GLfloat *vertices, const GLfloat *uv, size_t vsize, size_t usize, GLuint shader);
 void bind_geometry_no_upload(GLuint vbov, GLuint vbouv, GLuint shader);
 void react_to_input();
-float noise_wrap(float x, float z);
-void grid(int xstride, int zstride, float step, glm::vec3 center, std::function<void(float,float,float)> func);
 
 void rend_imgui();
 void init_imgui();
@@ -172,6 +218,8 @@ public:
     entt::entity me;
     int nuggo_pool_index;
     glm::ivec2 position;
+    //Lowest and highest terrain in the chunk, as of the last rebuild
+    HeightBounds bounds;
     void rebuild();
     void move_to(glm::ivec2 newpos);
     BlockChunk();
@@ -189,6 +237,16 @@ public:
 std::vector<int> chunks_to_rebuild;
 std::mutex CTR_MUTEX;
 
+//Billboard positions of the trees out in the far terrain, gathered on the
+//chunk thread; FAR_TREES_READY is set when the render thread has yet to pick them up
+std::vector<glm::vec3> far_trees;
+std::atomic<bool> FAR_TREES_READY(false);
+
+//The far terrain's mesh, built on the chunk thread the same way
+std::vector<GLfloat> far_verts;
+std::vector<GLfloat> far_uvs;
+std::atomic<bool> FAR_TERRAIN_READY(false);
+
 
 std::vector<Nuggo> NUGGO_POOL;
 
@@ -204,66 +262,417 @@ void BlockChunk::move_to(glm::ivec2 newpos) {
     this->position = newpos;
 }
 
-enum CubeFace {
-    LEFT = 0, RIGHT, FORWARD, BACK, TOP, BOTTOM
+//Atlas tile of each BlockTypes value
+const glm::ivec2 BLOCK_TILES[2] = {
+    glm::ivec2(0, 0),
+    glm::ivec2(1, 0)
 };
 
-enum BlockTypes {
-    STONE, GRASS
+TextureFace BlockTextures[2] = {
+    TextureFace(BLOCK_TILES[STONE].x, BLOCK_TILES[STONE].y),
+    TextureFace(BLOCK_TILES[GRASS].x, BLOCK_TILES[GRASS].y)
 };
 
-TextureFace BlockTextures[2] = {
-    TextureFace(0,0),
-    TextureFace(1,0)
+//Texture for a TERRAIN_MATERIAL sample
+TextureFace &material_face(float material) {
+    int type = static_cast<int>(material);
+    if(type < BlockTypes::STONE || type > BlockTypes::GRASS) {
+        type = BlockTypes::STONE;
+    }
+    return BlockTextures[type];
+}
+
+//Corners of each CubeFace of a block centred on the origin, clockwise seen
+//from outside, in the order bl, tl, tr, br of its texture
+const glm::vec3 CUBE_FACE_CORNERS[6][4] = {
+    { {-0.5f,-0.5f,-0.5f}, {-0.5f, 0.5f,-0.5f}, {-0.5f, 0.5f, 0.5f}, {-0.5f,-0.5f, 0.5f} },
+    { { 0.5f,-0.5f, 0.5f}, { 0.5f, 0.5f, 0.5f}, { 0.5f, 0.5f,-0.5f}, { 0.5f,-0.5f,-0.5f} },
+    { {-0.5f,-0.5f, 0.5f}, {-0.5f, 0.5f, 0.5f}, { 0.5f, 0.5f, 0.5f}, { 0.5f,-0.5f, 0.5f} },
+    { { 0.5f,-0.5f,-0.5f}, { 0.5f, 0.5f,-0.5f}, {-0.5f, 0.5f,-0.5f}, {-0.5f,-0.5f,-0.5f} },
+    { {-0.5f, 0.5f, 0.5f}, {-0.5f, 0.5f,-0.5f}, { 0.5f, 0.5f,-0.5f}, { 0.5f, 0.5f, 0.5f} },
+    { {-0.5f,-0.5f,-0.5f}, {-0.5f,-0.5f, 0.5f}, { 0.5f,-0.5f, 0.5f}, { 0.5f,-0.5f,-0.5f} }
 };
 
-bool has_block(int x, int y, int z) {
-    if(noise_wrap(x,z) >= y) {
-        return true;
+const glm::ivec3 CUBE_FACE_NORMALS[6] = {
+    {-1, 0, 0}, {1, 0, 0}, {0, 0, 1}, {0, 0, -1}, {0, 1, 0}, {0, -1, 0}
+};
+
+void add_cube_face(std::vector<GLfloat> &verts, std::vector<GLfloat> &uvs, glm::vec3 centre, CubeFace side, TextureFace &face) {
+    const glm::vec3* c = CUBE_FACE_CORNERS[side];
+    glm::vec3 bl = centre + c[0];
+    glm::vec3 tl = centre + c[1];
+    glm::vec3 tr = centre + c[2];
+    glm::vec3 br = centre + c[3];
+    verts.insert(verts.end(), {
+        bl.x, bl.y, bl.z,
+        tl.x, tl.y, tl.z,
+        tr.x, tr.y, tr.z,
+        tr.x, tr.y, tr.z,
+        br.x, br.y, br.z,
+        bl.x, bl.y, bl.z
+    });
+    uvs.insert(uvs.end(), {
+        face.bl.x, face.bl.y,
+        face.tl.x, face.tl.y,
+        face.tr.x, face.tr.y,
+
+        face.tr.x, face.tr.y,
+        face.br.x, face.br.y,
+        face.bl.x, face.bl.y
+    });
+}
+
+//Greedy quads span several blocks and repeat their block's tile across
+//them. The standard shader does the repeating for texture coordinates of
+//-(1 + tile * GREEDY_TILE_STRIDE + blocks along the face).
+const float GREEDY_TILE_STRIDE = 128.0f;
+
+void add_greedy_quad(std::vector<GLfloat> &verts, std::vector<GLfloat> &uvs, const GreedyQuad &quad, int x0, int z0) {
+    int type = quad.block;
+    if(type < BlockTypes::STONE || type > BlockTypes::GRASS) {
+        type = BlockTypes::STONE;
+    }
+    glm::vec2 tile(BLOCK_TILES[type]);
+    glm::vec3 size(quad.size_x, quad.size_y, quad.size_z);
+    glm::vec3 low = glm::vec3(x0 + quad.x, quad.y, z0 + quad.z) - glm::vec3(0.5f);
+    //The texture runs across the face along s and up it along t
+    int s = quad.side == LEFT || quad.side == RIGHT ? 2 : 0;
+    int t = quad.side == TOP || quad.side == BOTTOM ? 2 : 1;
+
+    glm::vec3 corners[4];
+    glm::vec2 texcoords[4];
+    for(int c = 0; c < 4; ++c) {
+        glm::vec3 offset = (CUBE_FACE_CORNERS[quad.side][c] + glm::vec3(0.5f)) * size;
+        corners[c] = low + offset;
+        texcoords[c] = glm::vec2(-1.0f) - tile * GREEDY_TILE_STRIDE - glm::vec2(offset[s], offset[t]);
+    }
+    for(int c : { 0, 1, 2, 2, 3, 0 }) {
+        verts.insert(verts.end(), { corners[c].x, corners[c].y, corners[c].z });
+        uvs.insert(uvs.end(), { texcoords[c].x, texcoords[c].y });
+    }
+}
+
+//Lowest block coordinate in chunk c along either axis
+int chunk_first_block(int c) {
+    return c * BLOCKCHUNKWIDTH - BLOCKCHUNKWIDTH/2;
+}
+
+//Whether the neighbouring chunk that p falls in has a structure block there
+bool neighbour_has_block(const ChunkData &chunk, const ChunkPipeline &pipeline, glm::ivec3 p) {
+    int dx = floor_div(p.x - chunk_first_block(chunk.x), BLOCKCHUNKWIDTH);
+    int dz = floor_div(p.z - chunk_first_block(chunk.z), BLOCKCHUNKWIDTH);
+    const ChunkData* neighbour = pipeline.chunk(chunk.x + dx, chunk.z + dz);
+    if(neighbour == NULL) {
+        return false;
+    }
+    for(const StructureBlock &block : neighbour->structures) {
+        if(block.x == p.x && block.y == p.y && block.z == p.z) {
+            return true;
+        }
     }
     return false;
 }
 
+//Cubes for the chunk's structure blocks, without the faces two of them
+//share, in this chunk or across its sides
+void add_structure_blocks(std::vector<GLfloat> &verts, std::vector<GLfloat> &uvs, const ChunkData &chunk, const ChunkPipeline &pipeline) {
+    const std::vector<StructureBlock> &blocks = chunk.structures;
+    int x0 = chunk_first_block(chunk.x);
+    int z0 = chunk_first_block(chunk.z);
+    if(blocks.empty()) {
+        return;
+    }
+    int y0 = blocks[0].y;
+    int y1 = blocks[0].y;
+    for(const StructureBlock &block : blocks) {
+        y0 = std::min(y0, block.y);
+        y1 = std::max(y1, block.y);
+    }
+    int height = y1 - y0 + 1;
+    std::vector<uint8_t> filled(static_cast<size_t>(BLOCKCHUNKWIDTH) * BLOCKCHUNKWIDTH * height, 0);
+    auto index = [&](int x, int y, int z) {
+        return (static_cast<size_t>(y - y0) * BLOCKCHUNKWIDTH + (z - z0)) * BLOCKCHUNKWIDTH + (x - x0);
+    };
+    auto occupied = [&](glm::ivec3 p) {
+        if(p.x < x0 || p.x >= x0 + BLOCKCHUNKWIDTH || p.z < z0 || p.z >= z0 + BLOCKCHUNKWIDTH) {
+            return neighbour_has_block(chunk, pipeline, p);
+        }
+        return p.y >= y0 && p.y <= y1 && filled[index(p.x, p.y, p.z)];
+    };
+    for(const StructureBlock &block : blocks) {
+        filled[index(block.x, block.y, block.z)] = 1;
+    }
+    for(const StructureBlock &block : blocks) {
+        glm::ivec3 p(block.x, block.y, block.z);
+        TextureFace &face = material_face(static_cast<float>(block.block));
+        for(int side = LEFT; side <= BOTTOM; ++side) {
+            if(!occupied(p + CUBE_FACE_NORMALS[side])) {
+                add_cube_face(verts, uvs, glm::vec3(p), static_cast<CubeFace>(side), face);
+            }
+        }
+    }
+}
+
+//Voxels of the chunks around the camera, for has_block on any thread
+std::mutex LOADED_VOXELS_MUTEX;
+std::map<std::pair<int, int>, std::shared_ptr<const ChunkVoxels>> LOADED_VOXELS;
+//Goes up whenever LOADED_VOXELS changes
+std::atomic<unsigned int> LOADED_VOXELS_GENERATION(0);
+
+//Makes the voxels CHUNK_PIPELINE built for chunks the ones has_block reads
+void publish_loaded_voxels(const std::vector<std::pair<int, int>> &chunks) {
+    std::map<std::pair<int, int>, std::shared_ptr<const ChunkVoxels>> loaded;
+    for(const std::pair<int, int> &position : chunks) {
+        const ChunkData* chunk = CHUNK_PIPELINE.chunk(position.first, position.second);
+        if(chunk != NULL && chunk->voxels) {
+            loaded[position] = chunk->voxels;
+        }
+    }
+    std::lock_guard<std::mutex> lock(LOADED_VOXELS_MUTEX);
+    LOADED_VOXELS.swap(loaded);
+    LOADED_VOXELS_GENERATION.fetch_add(1, std::memory_order_release);
+}
+
+//The chunk has_block last read on this thread, so runs of queries in one
+//chunk don't take the lock
+struct VoxelLookup {
+    int cx, cz;
+    unsigned int generation;
+    bool found;
+    std::shared_ptr<const ChunkVoxels> voxels;
+};
+
+thread_local VoxelLookup LAST_VOXELS = { 0, 0, 0, false, NULL };
+
+//Solid blocks of the loaded chunks come from their column masks; anywhere
+//else falls back to the terrain height
+bool has_block(int x, int y, int z) {
+    int cx = floor_div(x + BLOCKCHUNKWIDTH/2, BLOCKCHUNKWIDTH);
+    int cz = floor_div(z + BLOCKCHUNKWIDTH/2, BLOCKCHUNKWIDTH);
+    unsigned int generation = LOADED_VOXELS_GENERATION.load(std::memory_order_acquire);
+    if(!LAST_VOXELS.found || LAST_VOXELS.cx != cx || LAST_VOXELS.cz != cz || LAST_VOXELS.generation != generation) {
+        std::lock_guard<std::mutex> lock(LOADED_VOXELS_MUTEX);
+        auto loaded = LOADED_VOXELS.find({ cx, cz });
+        LAST_VOXELS.cx = cx;
+        LAST_VOXELS.cz = cz;
+        LAST_VOXELS.generation = LOADED_VOXELS_GENERATION.load(std::memory_order_relaxed);
+        LAST_VOXELS.found = true;
+        LAST_VOXELS.voxels = loaded == LOADED_VOXELS.end() ? NULL : loaded->second;
+    }
+    if(!LAST_VOXELS.voxels) {
+        return height_at(x, z) >= y;
+    }
+    return LAST_VOXELS.voxels->solid(x - chunk_first_block(cx), y, z - chunk_first_block(cz));
+}
+
 bool has_block(glm::ivec3 &i) {
-    if(noise_wrap(i.x, i.z) >= i.y) {
-        return true;
+    return has_block(i.x, i.y, i.z);
+}
+
+
+//CHUNK_PIPELINE's stages for the chunks around the camera
+
+//Every corner height is sampled once and shared by the cells around it
+void chunk_heights(ChunkData &chunk, const ChunkPipeline &) {
+    float x0 = chunk_first_block(chunk.x) - 0.5f;
+    float z0 = chunk_first_block(chunk.z) - 0.5f;
+    fill_corner_heights(chunk.terrain, x0, z0, BLOCKCHUNKWIDTH, BLOCKCHUNKWIDTH, 1.0f);
+    chunk.bounds = height_bounds(x0, z0, x0 + BLOCKCHUNKWIDTH, z0 + BLOCKCHUNKWIDTH);
+}
+
+void chunk_materials(ChunkData &chunk, const ChunkPipeline &) {
+    fill_corner_centres(chunk.terrain);
+}
+
+void chunk_structures(ChunkData &chunk, const ChunkPipeline &) {
+    int x0 = chunk_first_block(chunk.x);
+    int z0 = chunk_first_block(chunk.z);
+    chunk.structures.clear();
+    structure_blocks_in(WORLD_SEED, x0, z0, x0 + BLOCKCHUNKWIDTH, z0 + BLOCKCHUNKWIDTH, chunk.structures);
+}
+
+//Ground kept in voxels under a chunk's lowest surface block, for digging into
+const int CHUNK_SOIL_DEPTH = 8;
+
+//Surface block of cell (a, b), has_block's solid being y <= height
+int column_top(const TerrainCornerGrid &terrain, int a, int b) {
+    return static_cast<int>(std::floor(terrain.centre(a, b)));
+}
+
+//Stone up to the surface, topped with the terrain's material, and then the structures
+void chunk_voxels(ChunkData &chunk, const ChunkPipeline &) {
+    const TerrainCornerGrid &terrain = chunk.terrain;
+    std::vector<int> tops(terrain.centres.size());
+    int low = INT_MAX;
+    int high = INT_MIN;
+    for(int a = 0; a < terrain.width; ++a) {
+        for(int b = 0; b < terrain.depth; ++b) {
+            int top = column_top(terrain, a, b);
+            tops[a * terrain.depth + b] = top;
+            low = std::min(low, top);
+            high = std::max(high, top);
+        }
     }
-    return false;
+    for(const StructureBlock &block : chunk.structures) {
+        high = std::max(high, block.y);
+    }
+    std::shared_ptr<ChunkVoxels> voxels = std::make_shared<ChunkVoxels>();
+    voxels->reset(BLOCKCHUNKWIDTH, BLOCKCHUNKHEIGHT, BLOCKCHUNKWIDTH,
+        floor_div(low - CHUNK_SOIL_DEPTH, BLOCKCHUNKHEIGHT), floor_div(high, BLOCKCHUNKHEIGHT));
+
+    int bottom = voxels->first * BLOCKCHUNKHEIGHT;
+    for(int a = 0; a < terrain.width; ++a) {
+        for(int b = 0; b < terrain.depth; ++b) {
+            int top = tops[a * terrain.depth + b];
+            voxels->fill_column(a, b, bottom, top, STONE);
+            voxels->set(a, top, b, static_cast<int16_t>(terrain.material(a, b)));
+        }
+    }
+    int x0 = chunk_first_block(chunk.x);
+    int z0 = chunk_first_block(chunk.z);
+    for(const StructureBlock &block : chunk.structures) {
+        voxels->set(block.x - x0, block.y, block.z - z0, static_cast<int16_t>(block.block));
+    }
+    chunk.voxels = voxels;
 }
 
+//How chunks are drawn
+enum ChunkLook {
+    CHUNK_SMOOTH,       //smooth terrain with blocks standing on it
+    CHUNK_COLUMNS,      //a solid column of blocks under each cell, from the heights alone
+    CHUNK_BLOCKS        //meshed from their voxels
+};
 
-void BlockChunk::rebuild() {
+std::atomic<int> CHUNK_LOOK(CHUNK_SMOOTH);
 
-    std::vector<GLfloat> verts;
-    std::vector<GLfloat> uvs;
+void chunk_voxel_mesh(ChunkData &chunk, const ChunkPipeline &pipeline) {
+    GreedyNeighbours neighbours;
+    for(int side = LEFT; side <= BACK; ++side) {
+        const ChunkData* neighbour = pipeline.chunk(chunk.x + CUBE_FACE_NORMALS[side].x, chunk.z + CUBE_FACE_NORMALS[side].z);
+        neighbours.sides[side] = neighbour != NULL ? neighbour->voxels.get() : NULL;
+    }
+    std::vector<GreedyQuad> quads;
+    greedy_mesh(*chunk.voxels, neighbours, quads);
+    for(const GreedyQuad &quad : quads) {
+        add_greedy_quad(chunk.verts, chunk.uvs, quad, chunk_first_block(chunk.x), chunk_first_block(chunk.z));
+    }
+}
 
-    float pushup = 0.0f;
-    grid(BLOCKCHUNKWIDTH, BLOCKCHUNKWIDTH, 1.0f, glm::vec3(position.x*BLOCKCHUNKWIDTH, 0, position.y*BLOCKCHUNKWIDTH), [&verts, &uvs, &pushup](float i, float k, float step){
-        verts.insert(verts.end(), {
-
-        i-step/2.0f, noise_wrap(i-step/2.0f, k-step/2.0f)+pushup, k-step/2.0f,
-        i+step/2.0f, noise_wrap(i+step/2.0f, k-step/2.0f)+pushup, k-step/2.0f,
-        i+step/2.0f, noise_wrap(i+step/2.0f, k+step/2.0f)+pushup, k+step/2.0f,
-        i+step/2.0f, noise_wrap(i+step/2.0f, k+step/2.0f)+pushup, k+step/2.0f,
-        i-step/2.0f, noise_wrap(i-step/2.0f, k+step/2.0f)+pushup, k+step/2.0f,
-        i-step/2.0f, noise_wrap(i-step/2.0f, k-step/2.0f)+pushup, k-step/2.0f,
-            
-        });
-
-        TextureFace &face = noise_wrap(i,k) > 6 ? BlockTextures[BlockTypes::STONE] : BlockTextures[BlockTypes::GRASS];
-
-        uvs.insert(uvs.end(), {
-            face.bl.x, face.bl.y,
-            face.tl.x, face.tl.y,
-            face.tr.x, face.tr.y,
-
-            face.tr.x, face.tr.y,
-            face.br.x, face.br.y,
-            face.bl.x, face.bl.y
-        });
-    });
+//Columns up to each cell's surface block, walled where the next column,
+//in this chunk or a neighbouring one, is lower
+void chunk_column_mesh(ChunkData &chunk, const ChunkPipeline &pipeline) {
+    const TerrainCornerGrid &terrain = chunk.terrain;
+    ColumnHeights heights;
+    heights.reset(terrain.width, terrain.depth);
+    for(int a = 0; a < terrain.width; ++a) {
+        for(int b = 0; b < terrain.depth; ++b) {
+            heights.top(a, b) = column_top(terrain, a, b);
+            heights.blocks[a * terrain.depth + b] = static_cast<int16_t>(terrain.material(a, b));
+        }
+    }
+    for(int side = LEFT; side <= BACK; ++side) {
+        glm::ivec3 normal = CUBE_FACE_NORMALS[side];
+        const ChunkData* neighbour = pipeline.chunk(chunk.x + normal.x, chunk.z + normal.z);
+        const TerrainCornerGrid &next = neighbour != NULL ? neighbour->terrain : terrain;
+        //The neighbour's row along the shared side, or with no neighbour this
+        //chunk's own edge so no walls go up there
+        for(int i = 0; i < (normal.x != 0 ? terrain.depth : terrain.width); ++i) {
+            int a = normal.x != 0 ? (normal.x < 0 ? -1 : terrain.width) : i;
+            int b = normal.x != 0 ? i : (normal.z < 0 ? -1 : terrain.depth);
+            int from_a = neighbour != NULL ? (a + terrain.width) % terrain.width : std::clamp(a, 0, terrain.width - 1);
+            int from_b = neighbour != NULL ? (b + terrain.depth) % terrain.depth : std::clamp(b, 0, terrain.depth - 1);
+            heights.top(a, b) = column_top(next, from_a, from_b);
+        }
+    }
+    std::vector<GreedyQuad> quads;
+    column_mesh(heights, quads);
+    for(const GreedyQuad &quad : quads) {
+        add_greedy_quad(chunk.verts, chunk.uvs, quad, chunk_first_block(chunk.x), chunk_first_block(chunk.z));
+    }
+}
+
+//Draws terrain's surface with cells merged by merge_height_cells, each
+//merged rectangle's tile repeated across it like a greedy quad's
+void add_height_mesh(std::vector<GLfloat> &verts, std::vector<GLfloat> &uvs, const TerrainCornerGrid &terrain) {
+    HeightMerge merge;
+    HeightOutline outline;
+    std::vector<int> triangles;
+    merge_height_cells(terrain, HEIGHT_MERGE_TOLERANCE, merge);
+    std::vector<glm::vec3> corners;
+    std::vector<glm::vec2> texcoords;
+    for(const HeightQuad &quad : merge.quads) {
+        int type = static_cast<int>(quad.material);
+        if(type < BlockTypes::STONE || type > BlockTypes::GRASS) {
+            type = BlockTypes::STONE;
+        }
+        glm::vec2 tile = glm::vec2(-1.0f) - glm::vec2(BLOCK_TILES[type]) * GREEDY_TILE_STRIDE;
+        height_quad_outline(merge, quad, outline);
+        corners.clear();
+        texcoords.clear();
+        for(const std::pair<int, int> &point : outline) {
+            glm::vec2 offset = glm::vec2(point.first - quad.x, point.second - quad.z) * static_cast<float>(terrain.step);
+            corners.push_back(glm::vec3(terrain.x0 + point.first * terrain.step, terrain.corner(point.first, point.second),
+                terrain.z0 + point.second * terrain.step));
+            texcoords.push_back(tile - offset);
+        }
+
+        //The middle, for outlines too crowded with smaller neighbours' corners to fan from one of them
+        glm::vec2 half = glm::vec2(quad.width, quad.depth) * (0.5f * terrain.step);
+        float middle_y = (terrain.corner(quad.x, quad.z) + terrain.corner(quad.x + quad.width, quad.z)
+            + terrain.corner(quad.x, quad.z + quad.depth) + terrain.corner(quad.x + quad.width, quad.z + quad.depth)) * 0.25f;
+        corners.push_back(glm::vec3(terrain.x0 + quad.x * terrain.step + half.x, middle_y, terrain.z0 + quad.z * terrain.step + half.y));
+        texcoords.push_back(tile - half);
+
+        height_quad_triangles(quad, outline, triangles);
+        for(int c : triangles) {
+            verts.insert(verts.end(), { corners[c].x, corners[c].y, corners[c].z });
+            uvs.insert(uvs.end(), { texcoords[c].x, texcoords[c].y });
+        }
+    }
+}
 
+void chunk_mesh(ChunkData &chunk, const ChunkPipeline &pipeline) {
+    std::vector<GLfloat> &verts = chunk.verts;
+    std::vector<GLfloat> &uvs = chunk.uvs;
+    verts.clear();
+    uvs.clear();
+    switch(CHUNK_LOOK.load(std::memory_order_relaxed)) {
+    case CHUNK_BLOCKS:
+        chunk_voxel_mesh(chunk, pipeline);
+        return;
+    case CHUNK_COLUMNS:
+        chunk_column_mesh(chunk, pipeline);
+        break;
+    default:
+        add_height_mesh(verts, uvs, chunk.terrain);
+        break;
+    }
+    add_structure_blocks(verts, uvs, chunk, pipeline);
+}
 
+void init_chunk_pipeline() {
+    CHUNK_PIPELINE.set_stage(CHUNK_HEIGHTS, { "heights", {}, chunk_heights });
+    CHUNK_PIPELINE.set_stage(CHUNK_MATERIALS, { "materials", {}, chunk_materials });
+    CHUNK_PIPELINE.set_stage(CHUNK_STRUCTURES, { "structures", {}, chunk_structures });
+    CHUNK_PIPELINE.set_stage(CHUNK_VOXELS, { "voxels", {}, chunk_voxels });
+    //Faces against a neighbour's blocks are left out
+    CHUNK_PIPELINE.set_stage(CHUNK_MESH, { "mesh", {
+        { CHUNK_VOXELS, -1, 0 }, { CHUNK_VOXELS, 1, 0 },
+        { CHUNK_VOXELS, 0, -1 }, { CHUNK_VOXELS, 0, 1 } }, chunk_mesh });
+}
+
+//Threads building chunks, the chunk thread included
+int chunk_build_threads() {
+    return std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+}
+
+//Hands the chunk's mesh, built by CHUNK_PIPELINE, to the render thread
+void BlockChunk::rebuild() {
+    const ChunkData* chunk = CHUNK_PIPELINE.chunk(position.x, position.y);
+    if(chunk == NULL || !chunk->has(CHUNK_MESH)) {
+        return;
+    }
+    bounds = chunk->bounds;
 
     bool found = false;
     for(auto c : chunks_to_rebuild) {
@@ -272,8 +681,8 @@ void BlockChunk::rebuild() {
         }
     }
     if(!found) {
-        NUGGO_POOL[this->nuggo_pool_index].verts = verts;
-        NUGGO_POOL[this->nuggo_pool_index].uvs = uvs;
+        NUGGO_POOL[this->nuggo_pool_index].verts = chunk->verts;
+        NUGGO_POOL[this->nuggo_pool_index].uvs = chunk->uvs;
         chunks_to_rebuild.push_back(nuggo_pool_index);
     }
 
@@ -282,50 +691,124 @@ void BlockChunk::rebuild() {
 }
 
 
-void grid(int xstride, int zstride, float step, glm::vec3 center, std::function<void(float,float,float)> func) {
-    for(float i = center.x - xstride/2; i < center.x + xstride/2; i+=step)
-    {
-        for(float k = center.z - zstride/2; k < center.z + zstride/2; k+=step)
-        {
-            func(i, k, step);
+#define LOAD_AFTER_DISTANCE 1
+
+#define CHUNK_LOAD_RADIUS 4
+
+//Chunks around chunk (cx, cz) that get meshed, nearest first
+std::vector<std::pair<int, int>> chunks_around(int cx, int cz) {
+    std::vector<std::pair<int, int>> around;
+    for(int i = -CHUNK_LOAD_RADIUS; i < CHUNK_LOAD_RADIUS; ++i) {
+        for(int k = -CHUNK_LOAD_RADIUS; k < CHUNK_LOAD_RADIUS; ++k) {
+            around.push_back({ cx + i, cz + k });
         }
     }
+    std::stable_sort(around.begin(), around.end(), [&](const auto &a, const auto &b) {
+        int da = (a.first - cx) * (a.first - cx) + (a.second - cz) * (a.second - cz);
+        int db = (b.first - cx) * (b.first - cx) + (b.second - cz) * (b.second - cz);
+        return da < db;
+    });
+    return around;
 }
 
-float noise_wrap(float x, float z) {
-    float divider = 50.3f;
-    float multiplier = 30.0f;
-    
-    float biggermult = 3.0f;
 
-    float onoise = static_cast<float>(p.noise(x/(divider*biggermult), z/(divider*biggermult))) * (multiplier*biggermult);
-    return (static_cast<float>(p.noise(x/divider, z/divider)) * multiplier) + onoise;
+//A billboard for each structure tree out in the far terrain around camera;
+//the chunks around chunk (cx, cz) build those trees out of blocks
+void gather_far_trees(glm::vec3 camera, int cx, int cz, std::vector<glm::vec3> &trees) {
+    //Matches the far terrain, snapped to its cells
+    glm::vec3 farcenter = glm::floor(camera / 5.0f) * 5.0f;
+    int nearx0 = (cx - CHUNK_LOAD_RADIUS) * BLOCKCHUNKWIDTH - BLOCKCHUNKWIDTH/2;
+    int nearz0 = (cz - CHUNK_LOAD_RADIUS) * BLOCKCHUNKWIDTH - BLOCKCHUNKWIDTH/2;
+    int nearx1 = nearx0 + 2 * CHUNK_LOAD_RADIUS * BLOCKCHUNKWIDTH;
+    int nearz1 = nearz0 + 2 * CHUNK_LOAD_RADIUS * BLOCKCHUNKWIDTH;
+    int farx0 = static_cast<int>(farcenter.x) - 200;
+    int farz0 = static_cast<int>(farcenter.z) - 200;
+    trees.clear();
+    for(int rx = floor_div(farx0, STRUCTURE_REGION_SIZE); rx <= floor_div(farx0 + 399, STRUCTURE_REGION_SIZE); ++rx) {
+        for(int rz = floor_div(farz0, STRUCTURE_REGION_SIZE); rz <= floor_div(farz0 + 399, STRUCTURE_REGION_SIZE); ++rz) {
+            for(const Structure &s : structure_region(WORLD_SEED, rx, rz).structures) {
+                bool in_far = s.x >= farx0 && s.x < farx0 + 400 && s.z >= farz0 && s.z < farz0 + 400;
+                bool in_near = s.x >= nearx0 && s.x < nearx1 && s.z >= nearz0 && s.z < nearz1;
+                if(s.type == STRUCTURE_TREE && in_far && !in_near) {
+                    trees.push_back(glm::vec3(static_cast<float>(s.x), s.y + 3.0f, static_cast<float>(s.z)));
+                }
+            }
+        }
+    }
 }
 
-#define LOAD_AFTER_DISTANCE 1
+//The far terrain's cells around camera, out to 200 blocks, two triangles each
+void build_far_terrain(glm::vec3 camera, std::vector<GLfloat> &verts, std::vector<GLfloat> &uvs) {
+    //Snapped to the cell size so cells, and what grows on them, stay put as the camera moves
+    glm::vec3 farcenter = glm::floor(camera / 5.0f) * 5.0f;
+    float pushup = 0.0f;
 
-#define CHUNK_LOAD_RADIUS 4
+    //Shared corner heights, one sample per corner rather than four per cell
+    TerrainCornerGrid farterrain;
+    fill_corner_grid(farterrain, farcenter.x - 200.0f - 2.5f, farcenter.z - 200.0f - 2.5f, 80, 80, 5.0f);
+
+    verts.clear();
+    uvs.clear();
+    for(int a = 0; a < farterrain.width; ++a) {
+        for(int b = 0; b < farterrain.depth; ++b) {
+            float step = farterrain.step;
+            float i = farterrain.cell_x(a);
+            float k = farterrain.cell_z(b);
+
+            verts.insert(verts.end(), {
+
+            i-step/2.0f, farterrain.corner(a, b)+pushup ,k-step/2.0f,
+            i+step/2.0f, farterrain.corner(a + 1, b)+pushup ,k-step/2.0f,
+            i+step/2.0f, farterrain.corner(a + 1, b + 1)+pushup ,k+step/2.0f,
+            i+step/2.0f, farterrain.corner(a + 1, b + 1)+pushup ,k+step/2.0f,
+            i-step/2.0f, farterrain.corner(a, b + 1)+pushup ,k+step/2.0f,
+            i-step/2.0f, farterrain.corner(a, b)+pushup ,k-step/2.0f,
 
+            });
 
+            TextureFace &face = material_face(farterrain.material(a, b));
 
+            uvs.insert(uvs.end(), {
+                face.bl.x, face.bl.y,
+                face.tl.x, face.tl.y,
+                face.tr.x, face.tr.y,
+
+                face.tr.x, face.tr.y,
+                face.br.x, face.br.y,
+                face.bl.x, face.bl.y
+            });
+        }
+    }
+}
+
+//Set when the chunks around the camera need rebuilding where they are
+std::atomic<bool> CHUNKS_STALE(false);
 
 void chunk_thread() {
     glm::ivec3 last_cam_pos_divided;
     while(!glfwWindowShouldClose(WINDOW)) {
         glm::ivec3 curr_cam_divided = glm::ivec3(CAMERA_POSITION)/5;
-        if(curr_cam_divided != last_cam_pos_divided) {
+        if(curr_cam_divided != last_cam_pos_divided || CHUNKS_STALE.exchange(false)) {
             last_cam_pos_divided = curr_cam_divided;
-            int index = 0;
+            glm::ivec3 worldcampos(CAMERA_POSITION/static_cast<float>(BLOCKCHUNKWIDTH));
+            std::vector<std::pair<int, int>> around = chunks_around(worldcampos.x, worldcampos.z);
+            CHUNK_PIPELINE.build(around, CHUNK_MESH, chunk_build_threads());
+            publish_loaded_voxels(around);
+            std::vector<glm::vec3> trees;
+            gather_far_trees(CAMERA_POSITION, worldcampos.x, worldcampos.z, trees);
+            std::vector<GLfloat> verts;
+            std::vector<GLfloat> uvs;
+            build_far_terrain(CAMERA_POSITION, verts, uvs);
             CTR_MUTEX.lock();
+            far_trees.swap(trees);
+            FAR_TREES_READY.store(true);
+            far_verts.swap(verts);
+            far_uvs.swap(uvs);
+            FAR_TERRAIN_READY.store(true);
             chunks_to_rebuild.clear();
-            for(int i = -CHUNK_LOAD_RADIUS; i < CHUNK_LOAD_RADIUS; ++i) {
-                for(int k = -CHUNK_LOAD_RADIUS; k < CHUNK_LOAD_RADIUS; ++k) {
-                    glm::ivec3 worldcampos(CAMERA_POSITION/static_cast<float>(BLOCKCHUNKWIDTH));
-                    glm::ivec2 newchunkpos(worldcampos.x+i, worldcampos.z+k);
-                    CHUNKS[index].move_to(newchunkpos);
-                    CHUNKS[index].rebuild();
-                    index++;
-                }
+            for(size_t index = 0; index < around.size(); ++index) {
+                CHUNKS[index].move_to(glm::ivec2(around[index].first, around[index].second));
+                CHUNKS[index].rebuild();
             }
             CTR_MUTEX.unlock();
         }
@@ -333,7 +816,10 @@ void chunk_thread() {
 }
 
 
-int main() {
+int main(int argc, char **argv) {
+    if(argc > 1) {
+        set_world_seed(std::strtoull(argv[1], NULL, 10));
+    }
     if(!create_window("Honda 1")) {
         std::cerr << "Honda 1 window create err" << std::endl;
         return EXIT_FAILURE;
@@ -363,8 +849,21 @@ int main() {
         std::cerr << "Create SHADER_BILLBOARD err" << std::endl;
         return EXIT_FAILURE;
     }
+    if(!load_terrain_graph(TERRAIN_GRAPH_PATH)) {
+        std::cerr << "Load terrain graph err" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if(!load_erosion_map(EROSION_MAP_PATH, WORLD_SEED)) {
+        std::cerr << "Playing without baked erosion" << std::endl;
+    }
     init_imgui();
 
+#ifndef NDEBUG
+    float noise_error = noise_wrap_precision_error(2000.0f, 200);
+    if(noise_error > NOISE_WRAP_TOLERANCE) {
+        std::cerr << "Float terrain is off from the double reference by " << noise_error << std::endl;
+    }
+#endif
 
     //1 vao and shader for now
     glGenVertexArrays(1, &VERTEX_ARRAY_OBJECT);
@@ -378,13 +877,15 @@ int main() {
 
     //SPAWN CHUNKS
 
-    for(int i = -CHUNK_LOAD_RADIUS; i < CHUNK_LOAD_RADIUS; ++i) {
-        for(int k = -CHUNK_LOAD_RADIUS; k < CHUNK_LOAD_RADIUS; ++k) {
-            BlockChunk b;
-            b.move_to(glm::ivec2(i, k));
-            b.rebuild();
-            CHUNKS.push_back(b);
-        }
+    init_chunk_pipeline();
+    std::vector<std::pair<int, int>> around = chunks_around(0, 0);
+    CHUNK_PIPELINE.build(around, CHUNK_MESH, chunk_build_threads());
+    publish_loaded_voxels(around);
+    for(const std::pair<int, int> &position : around) {
+        BlockChunk b;
+        b.move_to(glm::ivec2(position.first, position.second));
+        b.rebuild();
+        CHUNKS.push_back(b);
     }
 
     //START THREAD TO REBUILD THEM
@@ -481,74 +982,15 @@ int main() {
 
                     static GLuint billqvbo, billposvbo, billuvvbo = 0;
 
-                    static glm::vec3 last_cam_pos;
+                    //Kept between frames, swapped for the chunk thread's whenever it builds a new one
+                    static std::vector<GLfloat> verts;
+                    static std::vector<GLfloat> uvs;
 
-                    std::vector<GLfloat> verts;
-                    std::vector<GLfloat> uvs;
-
-                    std::vector<GLfloat> billinstances;
-                    std::vector<GLfloat> billuvs;
-
-                    float pushup = 0.0f;
+                    static std::vector<GLfloat> billinstances;
+                    static std::vector<GLfloat> billuvs;
 
                     
 
-                    grid(400, 400, 5, CAMERA_POSITION, [&billinstances, &billuvs, &verts, &uvs, &pushup](float i, float k, float step){
-
-
-
-
-                         verts.insert(verts.end(), {
-
-                            i-step/2.0f, noise_wrap(i-step/2.0f, k-step/2.0f)+pushup ,k-step/2.0f,
-                            i+step/2.0f, noise_wrap(i+step/2.0f, k-step/2.0f)+pushup ,k-step/2.0f,
-                            i+step/2.0f, noise_wrap(i+step/2.0f, k+step/2.0f)+pushup ,k+step/2.0f,
-                            i+step/2.0f, noise_wrap(i+step/2.0f, k+step/2.0f)+pushup ,k+step/2.0f,
-                            i-step/2.0f, noise_wrap(i-step/2.0f, k+step/2.0f)+pushup ,k+step/2.0f,
-                            i-step/2.0f, noise_wrap(i-step/2.0f, k-step/2.0f)+pushup ,k-step/2.0f,
-
-                                
-                                
-                                
-                                
-                                
-                                
-                            });
-
-                            TextureFace &face = noise_wrap(i,k) > 6 ? BlockTextures[BlockTypes::STONE] : BlockTextures[BlockTypes::GRASS];
-
-                            uvs.insert(uvs.end(), {
-                                face.bl.x, face.bl.y,
-                                face.tl.x, face.tl.y,
-                                face.tr.x, face.tr.y,
-
-                                face.tr.x, face.tr.y,
-                                face.br.x, face.br.y,
-                                face.bl.x, face.bl.y
-                            });
-
-                            float billheight = 2.0f;
-
-                            
-
-                            if(static_cast<float>(rand()) / static_cast<float>(RAND_MAX) < 0.3f)
-                            {
-                                TextureFace tree(2,0);
-
-                                billinstances.insert(billinstances.end(), {
-                                    i, noise_wrap(i, k)+3.0f ,k,
-                                });
-
-                                billuvs.insert(billuvs.end(), {
-                                    tree.bl.x, tree.bl.y,
-                                    tree.tl.x, tree.tl.y,
-                                    tree.tr.x, tree.tr.y,
-                                    tree.br.x, tree.br.y
-                                });
-                            }
-                    });
-
-
                     bool redrawBills = false;
 
                     GLfloat quadVertices[] = {
@@ -559,9 +1001,12 @@ int main() {
                         -3.0f,  3.0f, 0.0f, 3.0f   // Corner 3
                     }; 
 
-                    if(vbov == 0 || glm::ivec3(last_cam_pos)/BLOCKCHUNKWIDTH != glm::ivec3(CAMERA_POSITION)/BLOCKCHUNKWIDTH) {
-                        redrawBills = true;
-                        last_cam_pos = CAMERA_POSITION;
+                    if(FAR_TERRAIN_READY.load() && CTR_MUTEX.try_lock()) {
+                        verts.swap(far_verts);
+                        uvs.swap(far_uvs);
+                        FAR_TERRAIN_READY.store(false);
+                        CTR_MUTEX.unlock();
+
                         glDeleteBuffers(1, &vbov);
                         glDeleteBuffers(1, &vbouv);
                         glGenBuffers(1, &vbov);
@@ -586,6 +1031,25 @@ int main() {
 
                     send_SHADER_BILLBOARD_uniforms();
 
+                    //Trees the chunk thread gathered since they were last uploaded
+                    if(FAR_TREES_READY.load() && CTR_MUTEX.try_lock()) {
+                        billinstances.clear();
+                        billuvs.clear();
+                        TextureFace tree(2,0);
+                        for(const glm::vec3 &position : far_trees) {
+                            billinstances.insert(billinstances.end(), { position.x, position.y, position.z });
+                            billuvs.insert(billuvs.end(), {
+                                tree.bl.x, tree.bl.y,
+                                tree.tl.x, tree.tl.y,
+                                tree.tr.x, tree.tr.y,
+                                tree.br.x, tree.br.y
+                            });
+                        }
+                        FAR_TREES_READY.store(false);
+                        CTR_MUTEX.unlock();
+                        redrawBills = true;
+                    }
+
                     if(billposvbo == 0 || redrawBills) {
 
                         glDeleteBuffers(1, &billqvbo);
@@ -765,6 +1229,8 @@ void rend_imgui() {
     ImGui::Begin("HiddenWindow", NULL, ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoBackground);
 
     ImGui::Text("Honda v0.0.0");
+    ImGui::Text("SIMD: %s", simd_level_name(simd_level()));
+    ImGui::Text("Height tiles: %zu, %zu hits, %zu misses", HEIGHT_CACHE.size(), HEIGHT_CACHE.hits(), HEIGHT_CACHE.misses());
 
     ImGui::End();
     ImGui::Begin("Test Window", NULL,  ImGuiWindowFlags_NoBackground);
@@ -775,6 +1241,15 @@ void rend_imgui() {
 
     ImGui::SliderFloat("Brightness", &GLOBAL_BRIGHTNESS, 0.0f, 1.0f);
     ImGui::SliderFloat("Speed", &SPEED_MULTIPLIER, 1.0f, 20.0f);
+    int chunk_look = CHUNK_LOOK.load();
+    bool look_changed = ImGui::RadioButton("Smooth chunks", &chunk_look, CHUNK_SMOOTH);
+    look_changed |= ImGui::RadioButton("Column chunks", &chunk_look, CHUNK_COLUMNS);
+    look_changed |= ImGui::RadioButton("Voxel chunks", &chunk_look, CHUNK_BLOCKS);
+    if(look_changed) {
+        CHUNK_LOOK.store(chunk_look);
+        CHUNK_PIPELINE.invalidate(CHUNK_MESH);
+        CHUNKS_STALE.store(true);
+    }
 
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -1,26 +1,14 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 
-class Perlin {
+#include "cpu_dispatch.hpp"
+#include "hashrng.hpp"
+#include "simd.h"
 
-public:
-	Perlin();
-	double noise(double x, double y, double z);
-	double noise(double x, double y);
-
-private:
-	int p[512];
-	double fade(double d);
-	double grad(int hash, double x, double y, double z);
-	double lerp(double t, double a, double b);
-
-};
-
-#ifdef PERLIN_IMP
-
-Perlin::Perlin() {
-	int permutation[] = { 151,160,137,91,90,15,
+//Ken Perlin's reference permutation, used for the default seed
+inline constexpr uint8_t PERLIN_CLASSIC_PERMUTATION[256] = { 151,160,137,91,90,15,
 	131,13,201,95,96,53,194,233,7,225,140,36,103,30,69,142,8,99,37,240,21,10,23,
 	190, 6,148,247,120,234,75,0,26,197,62,94,252,219,203,117,35,11,32,57,177,33,
 	88,237,149,56,87,174,20,125,136,171,168, 68,175,74,165,71,134,139,48,27,166,
@@ -33,39 +21,285 @@ Perlin::Perlin() {
 	251,34,242,193,238,210,144,12,191,179,162,241, 81,51,145,235,249,14,239,107,
 	49,192,214, 31,181,199,106,157,184, 84,204,176,115,121,50,45,127, 4,150,254,
 	138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180
-	};
+};
+
+//Seed 0 is the classic table, so worlds made before seeds existed keep their shape
+const uint64_t PERLIN_DEFAULT_SEED = 0;
+
+//Doubled permutation (entries 256..511 repeat 0..255 so lookups never wrap)
+//stored as bytes: the 512 hot bytes span exactly 8 cache lines. The 4 bytes
+//of padding let the SIMD gathers read a full 32 bits at any index.
+struct PermutationTable {
+	alignas(64) uint8_t p[512 + 4];
+};
 
+constexpr uint64_t splitmix64(uint64_t &state) {
+	return hash_mix64(state += 0x9E3779B97F4A7C15ull);
+}
+
+//Fisher-Yates shuffle of 0..255 driven by splitmix64. Usable at compile time
+//(constexpr PermutationTable t = make_permutation(1234);) and at runtime.
+constexpr PermutationTable make_permutation(uint64_t seed) {
+	PermutationTable table = {};
+	uint8_t perm[256] = {};
+	if (seed == PERLIN_DEFAULT_SEED) {
+		for (int i = 0; i < 256; i++) {
+			perm[i] = PERLIN_CLASSIC_PERMUTATION[i];
+		}
+	}
+	else {
+		for (int i = 0; i < 256; i++) {
+			perm[i] = static_cast<uint8_t>(i);
+		}
+		uint64_t state = seed;
+		for (int i = 255; i > 0; i--) {
+			int j = static_cast<int>(splitmix64(state) % static_cast<uint64_t>(i + 1));
+			uint8_t swap = perm[i];
+			perm[i] = perm[j];
+			perm[j] = swap;
+		}
+	}
 	for (int i = 0; i < 256; i++) {
-		p[i] = p[256 + i] = permutation[i];
+		table.p[i] = table.p[256 + i] = perm[i];
 	}
+	return table;
 }
 
-double Perlin::fade(double t) {
+inline constexpr PermutationTable PERLIN_DEFAULT_PERMUTATION = make_permutation(PERLIN_DEFAULT_SEED);
+
+//T is the scalar type every step is computed in. Perlin (double) is the
+//reference, PerlinF (float) packs twice as many samples per register.
+template <typename T>
+class BasicPerlin {
+
+public:
+	explicit BasicPerlin(uint64_t seed = PERLIN_DEFAULT_SEED);
+	T noise(T x, T y, T z);
+	T noise(T x, T y);
+
+	//noise(x, y) plus its analytic partial derivatives, from the same lookups
+	T noise_deriv(T x, T y, T &dx, T &dy);
+
+	//Evaluates noise(xs[i], ys[i]) for i in [0, n), several samples per register
+	//using the widest kernel this CPU supports (see cpu_dispatch.hpp)
+	void noise_batch(const T* xs, const T* ys, T* out, int n);
+	//Same for noise(xs[i], ys[i], zs[i])
+	void noise_batch(const T* xs, const T* ys, const T* zs, T* out, int n);
+
+	//Raw permutation bytes, for kernels that fuse several lookups (see fractal.hpp)
+	const uint8_t* table() const { return perm.p; }
+
+	//Seed the table was built from, for anything else derived from the same world
+	uint64_t seed() const { return seed_value; }
+
+private:
+	PermutationTable perm;
+	uint64_t seed_value;
+	T fade(T d);
+	T grad(int hash, T x, T y, T z);
+	T lerp(T t, T a, T b);
+
+};
+
+typedef BasicPerlin<double> Perlin;
+typedef BasicPerlin<float> PerlinF;
+
+//Both precisions are compiled once, in the file that defines PERLIN_IMP
+extern template class BasicPerlin<double>;
+extern template class BasicPerlin<float>;
+
+//Lane-generic pieces of the 2D kernel, see simd.h for the lane types
+template <typename L>
+inline typename L::V fade_lanes(typename L::V t) {
+	return L::mul(L::mul(L::mul(t, t), t),
+		L::add(L::mul(t, L::sub(L::mul(t, L::set1(6)), L::set1(15))), L::set1(10)));
+}
+
+template <typename L>
+inline typename L::V lerp_lanes(typename L::V t, typename L::V a, typename L::V b) {
+	return L::add(a, L::mul(t, L::sub(b, a)));
+}
+
+//Same as Perlin::grad(hash, x, y, z)
+template <typename L>
+inline typename L::V grad3_lanes(typename L::I hash, typename L::V x, typename L::V y, typename L::V z) {
+	typename L::V u = L::select(L::itest(hash, 8), y, x);
+	typename L::V v = L::select(L::ieq(L::iand(hash, 12), 0), y,
+		L::select(L::ieq(L::iand(hash, 13), 12), x, z));
+	return L::add(L::negate_if(L::itest(hash, 1), u), L::negate_if(L::itest(hash, 2), v));
+}
+
+//Same as Perlin::grad(hash, x, y, 0)
+template <typename L>
+inline typename L::V grad2_lanes(typename L::I hash, typename L::V x, typename L::V y) {
+	return grad3_lanes<L>(hash, x, y, L::zero());
+}
+
+//Perlin::noise(x, y, z), one sample per lane
+template <typename L>
+inline typename L::V noise3_lanes(const uint8_t* p, typename L::V x, typename L::V y, typename L::V z) {
+	typedef typename L::V V;
+	typedef typename L::I I;
+	V fx = L::floor(x);
+	V fy = L::floor(y);
+	V fz = L::floor(z);
+	I X = L::iand(L::to_int(fx), 255);
+	I Y = L::iand(L::to_int(fy), 255);
+	I Z = L::iand(L::to_int(fz), 255);
+	x = L::sub(x, fx);
+	y = L::sub(y, fy);
+	z = L::sub(z, fz);
+	V u = fade_lanes<L>(x);
+	V v = fade_lanes<L>(y);
+	V w = fade_lanes<L>(z);
+	I A = L::iadd(L::gather(p, X), Y);
+	I B = L::iadd(L::gather(p, L::iadd(X, 1)), Y);
+	I AA = L::iadd(L::gather(p, A), Z), AB = L::iadd(L::gather(p, L::iadd(A, 1)), Z);
+	I BA = L::iadd(L::gather(p, B), Z), BB = L::iadd(L::gather(p, L::iadd(B, 1)), Z);
+	V one = L::set1(1);
+	V x1 = L::sub(x, one);
+	V y1 = L::sub(y, one);
+	V z1 = L::sub(z, one);
+	return lerp_lanes<L>(w, lerp_lanes<L>(v, lerp_lanes<L>(u, grad3_lanes<L>(L::gather(p, AA), x, y, z),
+		grad3_lanes<L>(L::gather(p, BA), x1, y, z)),
+		lerp_lanes<L>(u, grad3_lanes<L>(L::gather(p, AB), x, y1, z),
+			grad3_lanes<L>(L::gather(p, BB), x1, y1, z))),
+		lerp_lanes<L>(v, lerp_lanes<L>(u, grad3_lanes<L>(L::gather(p, L::iadd(AA, 1)), x, y, z1),
+			grad3_lanes<L>(L::gather(p, L::iadd(BA, 1)), x1, y, z1)),
+			lerp_lanes<L>(u, grad3_lanes<L>(L::gather(p, L::iadd(AB, 1)), x, y1, z1),
+				grad3_lanes<L>(L::gather(p, L::iadd(BB, 1)), x1, y1, z1))));
+}
+
+//The z = 0 slice of Perlin::noise. With z = 0 the third fade is 0, so the
+//upper layer of the 3D lerp drops out and only four corners remain.
+template <typename L>
+inline typename L::V noise2_lanes(const uint8_t* p, typename L::V x, typename L::V y) {
+	typedef typename L::V V;
+	typedef typename L::I I;
+	V fx = L::floor(x);
+	V fy = L::floor(y);
+	I X = L::iand(L::to_int(fx), 255);
+	I Y = L::iand(L::to_int(fy), 255);
+	x = L::sub(x, fx);
+	y = L::sub(y, fy);
+	V u = fade_lanes<L>(x);
+	V v = fade_lanes<L>(y);
+	I A = L::iadd(L::gather(p, X), Y);
+	I B = L::iadd(L::gather(p, L::iadd(X, 1)), Y);
+	I AA = L::gather(p, A), AB = L::gather(p, L::iadd(A, 1));
+	I BA = L::gather(p, B), BB = L::gather(p, L::iadd(B, 1));
+	V one = L::set1(1);
+	V x1 = L::sub(x, one);
+	V y1 = L::sub(y, one);
+	return lerp_lanes<L>(v, lerp_lanes<L>(u, grad2_lanes<L>(L::gather(p, AA), x, y),
+		grad2_lanes<L>(L::gather(p, BA), x1, y)),
+		lerp_lanes<L>(u, grad2_lanes<L>(L::gather(p, AB), x, y1),
+			grad2_lanes<L>(L::gather(p, BB), x1, y1)));
+}
+
+//Derivative of fade: 30t^2(t - 1)^2
+template <typename L>
+inline typename L::V fade_deriv_lanes(typename L::V t) {
+	return L::mul(L::mul(L::mul(t, t), L::set1(30)),
+		L::add(L::mul(t, L::sub(t, L::set1(2))), L::set1(1)));
+}
+
+//The gradient vector grad2_lanes dots with the offset: each component is -1, 0 or 1
+template <typename L>
+inline void grad2_vector_lanes(typename L::I hash, typename L::V &gx, typename L::V &gy) {
+	typedef typename L::V V;
+	typedef typename L::M M;
+	V one = L::set1(1);
+	V zero = L::zero();
+	V s1 = L::negate_if(L::itest(hash, 1), one);
+	V s2 = L::negate_if(L::itest(hash, 2), one);
+	M u_is_y = L::itest(hash, 8);
+	M v_is_y = L::ieq(L::iand(hash, 12), 0);
+	M v_is_x = L::ieq(L::iand(hash, 13), 12);
+	gx = L::add(L::select(u_is_y, zero, s1), L::select(v_is_x, s2, zero));
+	gy = L::add(L::select(u_is_y, s1, zero), L::select(v_is_y, s2, zero));
+}
+
+//noise2_lanes plus d/dx and d/dy. Writing the corner values as a, b, c, d:
+//  d/dx = lerp(v, lerp(u, ga.x, gb.x), lerp(u, gc.x, gd.x)) + u'(x) * lerp(v, b - a, d - c)
+//  d/dy = lerp(v, lerp(u, ga.y, gb.y), lerp(u, gc.y, gd.y)) + v'(y) * lerp(u, c - a, d - b)
+//The value itself is computed exactly as noise2_lanes does.
+template <typename L>
+inline typename L::V noise2_deriv_lanes(const uint8_t* p, typename L::V x, typename L::V y,
+	typename L::V &dx, typename L::V &dy) {
+	typedef typename L::V V;
+	typedef typename L::I I;
+	V fx = L::floor(x);
+	V fy = L::floor(y);
+	I X = L::iand(L::to_int(fx), 255);
+	I Y = L::iand(L::to_int(fy), 255);
+	x = L::sub(x, fx);
+	y = L::sub(y, fy);
+	V u = fade_lanes<L>(x);
+	V v = fade_lanes<L>(y);
+	I A = L::iadd(L::gather(p, X), Y);
+	I B = L::iadd(L::gather(p, L::iadd(X, 1)), Y);
+	I ha = L::gather(p, L::gather(p, A));
+	I hb = L::gather(p, L::gather(p, B));
+	I hc = L::gather(p, L::gather(p, L::iadd(A, 1)));
+	I hd = L::gather(p, L::gather(p, L::iadd(B, 1)));
+	V one = L::set1(1);
+	V x1 = L::sub(x, one);
+	V y1 = L::sub(y, one);
+	V a = grad2_lanes<L>(ha, x, y);
+	V b = grad2_lanes<L>(hb, x1, y);
+	V c = grad2_lanes<L>(hc, x, y1);
+	V d = grad2_lanes<L>(hd, x1, y1);
+	V gax, gay, gbx, gby, gcx, gcy, gdx, gdy;
+	grad2_vector_lanes<L>(ha, gax, gay);
+	grad2_vector_lanes<L>(hb, gbx, gby);
+	grad2_vector_lanes<L>(hc, gcx, gcy);
+	grad2_vector_lanes<L>(hd, gdx, gdy);
+	dx = L::add(lerp_lanes<L>(v, lerp_lanes<L>(u, gax, gbx), lerp_lanes<L>(u, gcx, gdx)),
+		L::mul(fade_deriv_lanes<L>(x), lerp_lanes<L>(v, L::sub(b, a), L::sub(d, c))));
+	dy = L::add(lerp_lanes<L>(v, lerp_lanes<L>(u, gay, gby), lerp_lanes<L>(u, gcy, gdy)),
+		L::mul(fade_deriv_lanes<L>(y), lerp_lanes<L>(u, L::sub(c, a), L::sub(d, b))));
+	return lerp_lanes<L>(v, lerp_lanes<L>(u, a, b), lerp_lanes<L>(u, c, d));
+}
+
+#ifdef PERLIN_IMP
+
+template <typename T>
+BasicPerlin<T>::BasicPerlin(uint64_t seed) :
+	perm(seed == PERLIN_DEFAULT_SEED ? PERLIN_DEFAULT_PERMUTATION : make_permutation(seed)), seed_value(seed) {
+}
+
+template <typename T>
+T BasicPerlin<T>::fade(T t) {
 	return t * t * t * (t * (t * 6 - 15) + 10);
 }
 
-double Perlin::grad(int hash, double x, double y, double z) {
+template <typename T>
+T BasicPerlin<T>::grad(int hash, T x, T y, T z) {
 	int h = hash & 15/*0b1111*/;
-	double u = h < 8/*0b1000*/ ? x : y;
-	double v = h < 4/*0b0100*/ ? y : h == 12/*0b1100*/ || h == 14/*0b1110*/ ? x : z;
+	T u = h < 8/*0b1000*/ ? x : y;
+	T v = h < 4/*0b0100*/ ? y : h == 12/*0b1100*/ || h == 14/*0b1110*/ ? x : z;
 	return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
 }
 
 //Linear Interpolate
-double Perlin::lerp(double t, double a, double b) {
+template <typename T>
+T BasicPerlin<T>::lerp(T t, T a, T b) {
 	return a + t * (b - a);
 }
 
-double Perlin::noise(double x, double y, double z) {
-	int X = (int)floor(x) & 255;
-	int Y = (int)floor(y) & 255;
-	int Z = (int)floor(z) & 255;
-	x -= floor(x);
-	y -= floor(y);
-	z -= floor(z);
-	double u = fade(x);
-	double v = fade(y);
-	double w = fade(z);
+template <typename T>
+T BasicPerlin<T>::noise(T x, T y, T z) {
+	const uint8_t* p = perm.p;
+	int X = (int)std::floor(x) & 255;
+	int Y = (int)std::floor(y) & 255;
+	int Z = (int)std::floor(z) & 255;
+	x -= std::floor(x);
+	y -= std::floor(y);
+	z -= std::floor(z);
+	T u = fade(x);
+	T v = fade(y);
+	T w = fade(z);
 	int A = p[X] + Y, AA = p[A] + Z, AB = p[A + 1] + Z;
 	int B = p[X + 1] + Y, BA = p[B] + Z, BB = p[B + 1] + Z;
 	return lerp(w, lerp(v, lerp(u, grad(p[AA], x, y, z),
@@ -78,7 +312,29 @@ double Perlin::noise(double x, double y, double z) {
 				grad(p[BB + 1], x - 1, y - 1, z - 1))));
 }
 
-double Perlin::noise(double x, double y) {
-	return noise(x, y, 0);
+//Dedicated 2D kernel: four gradients and three lerps instead of the eight
+//and seven noise(x, y, 0) would spend. Gives the same values as the z = 0
+//slice, so existing worlds are unchanged.
+template <typename T>
+T BasicPerlin<T>::noise(T x, T y) {
+	return noise2_lanes<ScalarLanes<T> >(perm.p, x, y);
 }
+
+template <typename T>
+T BasicPerlin<T>::noise_deriv(T x, T y, T &dx, T &dy) {
+	return noise2_deriv_lanes<ScalarLanes<T> >(perm.p, x, y, dx, dy);
+}
+
+template <typename T>
+void BasicPerlin<T>::noise_batch(const T* xs, const T* ys, T* out, int n) {
+	noise2_batch(perm.p, xs, ys, out, static_cast<size_t>(n));
+}
+
+template <typename T>
+void BasicPerlin<T>::noise_batch(const T* xs, const T* ys, const T* zs, T* out, int n) {
+	noise3_batch(perm.p, xs, ys, zs, out, static_cast<size_t>(n));
+}
+
+template class BasicPerlin<double>;
+template class BasicPerlin<float>;
 #endif
\ No newline at end of file
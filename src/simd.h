@@ -0,0 +1,267 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(SIMD_LANES_SSE41) || defined(SIMD_LANES_AVX2) || defined(SIMD_LANES_AVX512)
+#include <immintrin.h>
+#endif
+
+//Lane types for the batched noise kernels. Each one wraps a register width
+//behind the same set of static functions so a kernel is written once as a
+//template and instantiated per width:
+//
+//  V  - a register of T (float or double)   I - matching register of int32 lanes
+//  M  - per-lane mask (result of compares, input of select)
+//
+//Gathers read from byte tables (see PermutationTable); the wide ones load 32
+//bits at each byte offset and mask, so tables need 3 bytes of tail padding.
+//
+//Every lane type does the exact same arithmetic in the same order as the
+//scalar code, so batch results match BasicPerlin<T>::noise sample for sample.
+//
+//Only ScalarLanes is visible by default. Each kernels_*.cpp defines one of
+//SIMD_LANES_SSE41 / SIMD_LANES_AVX2 / SIMD_LANES_AVX512 before including this
+//and is compiled with that instruction set; cpu_dispatch.hpp picks between
+//them at runtime.
+
+template <typename T>
+struct ScalarLanes {
+    typedef T V;
+    typedef int I;
+    typedef bool M;
+    static const int WIDTH = 1;
+
+    static V load(const T* p) { return *p; }
+    static void store(T* p, V v) { *p = v; }
+    static V set1(T d) { return d; }
+    static V zero() { return T(0); }
+
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+    static V floor(V a) { return std::floor(a); }
+    static V abs(V a) { return std::fabs(a); }
+
+    static I to_int(V a) { return (int)a; }
+    static I iadd(I a, I b) { return a + b; }
+    static I iand(I a, int c) { return a & c; }
+    static I gather(const uint8_t* table, I idx) { return table[idx]; }
+
+    static M ieq(I a, int c) { return a == c; }
+    static M itest(I a, int bit) { return (a & bit) != 0; }
+    static M lt(V a, V b) { return a < b; }
+    static V select(M m, V a, V b) { return m ? a : b; }
+    static V negate_if(M m, V a) { return m ? -a : a; }
+};
+
+#if defined(SIMD_LANES_SSE41)
+struct Sse41LanesD {
+    typedef __m128d V;
+    typedef __m128i I; //only the low two int32 lanes are meaningful
+    typedef __m128d M;
+    static const int WIDTH = 2;
+
+    static V load(const double* p) { return _mm_loadu_pd(p); }
+    static void store(double* p, V v) { _mm_storeu_pd(p, v); }
+    static V set1(double d) { return _mm_set1_pd(d); }
+    static V zero() { return _mm_setzero_pd(); }
+
+    static V add(V a, V b) { return _mm_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm_mul_pd(a, b); }
+    static V floor(V a) { return _mm_floor_pd(a); }
+    static V abs(V a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a); }
+
+    static I to_int(V a) { return _mm_cvttpd_epi32(a); }
+    static I iadd(I a, I b) { return _mm_add_epi32(a, b); }
+    static I iadd(I a, int c) { return _mm_add_epi32(a, _mm_set1_epi32(c)); }
+    static I iand(I a, int c) { return _mm_and_si128(a, _mm_set1_epi32(c)); }
+    static I gather(const uint8_t* table, I idx) {
+        return _mm_set_epi32(0, 0, table[_mm_extract_epi32(idx, 1)], table[_mm_extract_epi32(idx, 0)]);
+    }
+
+    static M widen(I m) { return _mm_castsi128_pd(_mm_cvtepi32_epi64(m)); }
+    static M ieq(I a, int c) { return widen(_mm_cmpeq_epi32(a, _mm_set1_epi32(c))); }
+    static M itest(I a, int bit) { return ieq(iand(a, bit), bit); }
+    static M lt(V a, V b) { return _mm_cmplt_pd(a, b); }
+    static V select(M m, V a, V b) { return _mm_blendv_pd(b, a, m); }
+    static V negate_if(M m, V a) { return _mm_xor_pd(a, _mm_and_pd(m, _mm_set1_pd(-0.0))); }
+};
+
+struct Sse41LanesF {
+    typedef __m128 V;
+    typedef __m128i I;
+    typedef __m128 M;
+    static const int WIDTH = 4;
+
+    static V load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, V v) { _mm_storeu_ps(p, v); }
+    static V set1(float d) { return _mm_set1_ps(d); }
+    static V zero() { return _mm_setzero_ps(); }
+
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+    static V floor(V a) { return _mm_floor_ps(a); }
+    static V abs(V a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+
+    static I to_int(V a) { return _mm_cvttps_epi32(a); }
+    static I iadd(I a, I b) { return _mm_add_epi32(a, b); }
+    static I iadd(I a, int c) { return _mm_add_epi32(a, _mm_set1_epi32(c)); }
+    static I iand(I a, int c) { return _mm_and_si128(a, _mm_set1_epi32(c)); }
+    static I gather(const uint8_t* table, I idx) {
+        return _mm_set_epi32(
+            table[_mm_extract_epi32(idx, 3)], table[_mm_extract_epi32(idx, 2)],
+            table[_mm_extract_epi32(idx, 1)], table[_mm_extract_epi32(idx, 0)]);
+    }
+
+    static M ieq(I a, int c) { return _mm_castsi128_ps(_mm_cmpeq_epi32(a, _mm_set1_epi32(c))); }
+    static M itest(I a, int bit) { return ieq(iand(a, bit), bit); }
+    static M lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+    static V select(M m, V a, V b) { return _mm_blendv_ps(b, a, m); }
+    static V negate_if(M m, V a) { return _mm_xor_ps(a, _mm_and_ps(m, _mm_set1_ps(-0.0f))); }
+};
+#endif
+
+#if defined(SIMD_LANES_AVX2)
+struct Avx2LanesD {
+    typedef __m256d V;
+    typedef __m128i I;
+    typedef __m256d M;
+    static const int WIDTH = 4;
+
+    static V load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, V v) { _mm256_storeu_pd(p, v); }
+    static V set1(double d) { return _mm256_set1_pd(d); }
+    static V zero() { return _mm256_setzero_pd(); }
+
+    static V add(V a, V b) { return _mm256_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+    static V floor(V a) { return _mm256_floor_pd(a); }
+    static V abs(V a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+
+    static I to_int(V a) { return _mm256_cvttpd_epi32(a); }
+    static I iadd(I a, I b) { return _mm_add_epi32(a, b); }
+    static I iadd(I a, int c) { return _mm_add_epi32(a, _mm_set1_epi32(c)); }
+    static I iand(I a, int c) { return _mm_and_si128(a, _mm_set1_epi32(c)); }
+    static I gather(const uint8_t* table, I idx) {
+        return _mm_and_si128(_mm_i32gather_epi32((const int*)table, idx, 1), _mm_set1_epi32(0xFF));
+    }
+
+    static M widen(I m) { return _mm256_castsi256_pd(_mm256_cvtepi32_epi64(m)); }
+    static M ieq(I a, int c) { return widen(_mm_cmpeq_epi32(a, _mm_set1_epi32(c))); }
+    static M itest(I a, int bit) { return ieq(iand(a, bit), bit); }
+    static M lt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    static V select(M m, V a, V b) { return _mm256_blendv_pd(b, a, m); }
+    static V negate_if(M m, V a) { return _mm256_xor_pd(a, _mm256_and_pd(m, _mm256_set1_pd(-0.0))); }
+};
+
+struct Avx2LanesF {
+    typedef __m256 V;
+    typedef __m256i I;
+    typedef __m256 M;
+    static const int WIDTH = 8;
+
+    static V load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+    static V set1(float d) { return _mm256_set1_ps(d); }
+    static V zero() { return _mm256_setzero_ps(); }
+
+    static V add(V a, V b) { return _mm256_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+    static V floor(V a) { return _mm256_floor_ps(a); }
+    static V abs(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+
+    static I to_int(V a) { return _mm256_cvttps_epi32(a); }
+    static I iadd(I a, I b) { return _mm256_add_epi32(a, b); }
+    static I iadd(I a, int c) { return _mm256_add_epi32(a, _mm256_set1_epi32(c)); }
+    static I iand(I a, int c) { return _mm256_and_si256(a, _mm256_set1_epi32(c)); }
+    static I gather(const uint8_t* table, I idx) {
+        return _mm256_and_si256(_mm256_i32gather_epi32((const int*)table, idx, 1), _mm256_set1_epi32(0xFF));
+    }
+
+    static M ieq(I a, int c) { return _mm256_castsi256_ps(_mm256_cmpeq_epi32(a, _mm256_set1_epi32(c))); }
+    static M itest(I a, int bit) { return ieq(iand(a, bit), bit); }
+    static M lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static V select(M m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+    static V negate_if(M m, V a) { return _mm256_xor_ps(a, _mm256_and_ps(m, _mm256_set1_ps(-0.0f))); }
+};
+#endif
+
+#if defined(SIMD_LANES_AVX512)
+struct Avx512LanesD {
+    typedef __m512d V;
+    typedef __m256i I;
+    typedef __mmask8 M;
+    static const int WIDTH = 8;
+
+    static V load(const double* p) { return _mm512_loadu_pd(p); }
+    static void store(double* p, V v) { _mm512_storeu_pd(p, v); }
+    static V set1(double d) { return _mm512_set1_pd(d); }
+    static V zero() { return _mm512_setzero_pd(); }
+
+    static V add(V a, V b) { return _mm512_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm512_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm512_mul_pd(a, b); }
+    static V floor(V a) { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+    static V abs(V a) { return _mm512_abs_pd(a); }
+
+    static I to_int(V a) { return _mm512_cvttpd_epi32(a); }
+    static I iadd(I a, I b) { return _mm256_add_epi32(a, b); }
+    static I iadd(I a, int c) { return _mm256_add_epi32(a, _mm256_set1_epi32(c)); }
+    static I iand(I a, int c) { return _mm256_and_si256(a, _mm256_set1_epi32(c)); }
+    static I gather(const uint8_t* table, I idx) {
+        return _mm256_and_si256(_mm256_i32gather_epi32((const int*)table, idx, 1), _mm256_set1_epi32(0xFF));
+    }
+
+    //Compares on the 256-bit int lanes, packed into a mask register (no AVX512VL needed)
+    static M ieq(I a, int c) {
+        return (M)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, _mm256_set1_epi32(c))));
+    }
+    static M itest(I a, int bit) { return ieq(iand(a, bit), bit); }
+    static M lt(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+    static V select(M m, V a, V b) { return _mm512_mask_blend_pd(m, b, a); }
+    static V negate_if(M m, V a) {
+        __m512i bits = _mm512_castpd_si512(a);
+        return _mm512_castsi512_pd(_mm512_mask_xor_epi64(bits, m, bits, _mm512_set1_epi64((long long)0x8000000000000000ull)));
+    }
+};
+
+struct Avx512LanesF {
+    typedef __m512 V;
+    typedef __m512i I;
+    typedef __mmask16 M;
+    static const int WIDTH = 16;
+
+    static V load(const float* p) { return _mm512_loadu_ps(p); }
+    static void store(float* p, V v) { _mm512_storeu_ps(p, v); }
+    static V set1(float d) { return _mm512_set1_ps(d); }
+    static V zero() { return _mm512_setzero_ps(); }
+
+    static V add(V a, V b) { return _mm512_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm512_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+    static V floor(V a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+    static V abs(V a) { return _mm512_abs_ps(a); }
+
+    static I to_int(V a) { return _mm512_cvttps_epi32(a); }
+    static I iadd(I a, I b) { return _mm512_add_epi32(a, b); }
+    static I iadd(I a, int c) { return _mm512_add_epi32(a, _mm512_set1_epi32(c)); }
+    static I iand(I a, int c) { return _mm512_and_si512(a, _mm512_set1_epi32(c)); }
+    static I gather(const uint8_t* table, I idx) {
+        return _mm512_and_si512(_mm512_i32gather_epi32(idx, (const void*)table, 1), _mm512_set1_epi32(0xFF));
+    }
+
+    static M ieq(I a, int c) { return _mm512_cmpeq_epi32_mask(a, _mm512_set1_epi32(c)); }
+    static M itest(I a, int bit) { return _mm512_test_epi32_mask(a, _mm512_set1_epi32(bit)); }
+    static M lt(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static V select(M m, V a, V b) { return _mm512_mask_blend_ps(m, b, a); }
+    static V negate_if(M m, V a) {
+        __m512i bits = _mm512_castps_si512(a);
+        return _mm512_castsi512_ps(_mm512_mask_xor_epi32(bits, m, bits, _mm512_set1_epi32((int)0x80000000u)));
+    }
+};
+#endif
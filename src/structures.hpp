@@ -0,0 +1,264 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "heightcache.hpp"
+#include "terrain.hpp"
+
+//Structures built of blocks on top of the terrain: voxel trees, and stone
+//ruins laid out by wave function collapse (see wfc.hpp).
+//
+//The world is cut into STRUCTURE_REGION_SIZE squares. What stands in a
+//region, and where, is a pure function of the world seed and the region's
+//coordinates, and every structure fits inside its own region. So a chunk
+//finds the blocks that reach into it by building just the regions it
+//overlaps, on its own thread, without waiting for or regenerating its
+//neighbours, and two chunks either side of a tree always agree on it.
+//Built regions are kept in a small per-thread cache, since the chunks
+//sharing a region are usually built one after another.
+
+#define STRUCTURE_REGION_SIZE 64
+//Regions each thread keeps, a power of two; enough for the far view's
+//tree billboards
+#define STRUCTURE_CACHE 64
+
+enum StructureType {
+    STRUCTURE_TREE,
+    STRUCTURE_RUIN
+};
+
+struct StructureBlock {
+    int x, y, z;        //world block, centred on these coordinates
+    int block;          //BlockTypes value
+};
+
+struct Structure {
+    StructureType type;
+    int x, y, z;        //where it stands, y the first block above the ground
+    int x0, z0, x1, z1; //footprint, x1 and z1 exclusive
+    std::vector<StructureBlock> blocks;
+};
+
+struct StructureRegion {
+    uint64_t seed;
+    int rx, rz;
+    bool filled;
+    std::vector<Structure> structures;
+};
+
+//Region (rx, rz) for seed, from this thread's cache or built now
+const StructureRegion &structure_region(uint64_t seed, int rx, int rz);
+
+//Appends every structure block with x in [x0, x1) and z in [z0, z1)
+void structure_blocks_in(uint64_t seed, int x0, int z0, int x1, int z1, std::vector<StructureBlock> &out);
+
+#ifdef STRUCTURES_IMP
+
+#include <algorithm>
+#include <cmath>
+
+#include "hashrng.hpp"
+#include "wfc.hpp"
+
+//Trees per region before dropping the ones on stone or in a ruin
+const int STRUCTURE_TREES_MIN = 6;
+const int STRUCTURE_TREES_MAX = 14;
+const int TREE_CANOPY_RADIUS = 2;
+const float RUIN_CHANCE = 0.25f;
+//Ruin footprint and height in blocks
+const int RUIN_SIZE = 13;
+const int RUIN_HEIGHT = 5;
+
+thread_local StructureRegion STRUCTURE_REGIONS[STRUCTURE_CACHE];
+
+enum RuinTile {
+    RUIN_AIR,
+    RUIN_WALL_X,    //wall running along x
+    RUIN_WALL_Z,
+    RUIN_PILLAR     //where walls end or meet
+};
+
+//Walls run in straight lines and end in pillars, may stop at any height but
+//never float, and leave air beside them
+WfcRules make_ruin_rules() {
+    WfcRules rules;
+    rules.add_tile(WFC_EMPTY, 3.0f);
+    rules.add_tile(STONE, 1.0f);
+    rules.add_tile(STONE, 1.0f);
+    rules.add_tile(STONE, 0.3f);
+    rules.allow_sides(RUIN_AIR, RUIN_AIR);
+    rules.allow(RUIN_WALL_X, RUIN_WALL_X, WFC_RIGHT);
+    rules.allow(RUIN_WALL_X, RUIN_PILLAR, WFC_RIGHT);
+    rules.allow(RUIN_PILLAR, RUIN_WALL_X, WFC_RIGHT);
+    rules.allow(RUIN_WALL_X, RUIN_AIR, WFC_FORWARD);
+    rules.allow(RUIN_AIR, RUIN_WALL_X, WFC_FORWARD);
+    rules.allow(RUIN_WALL_Z, RUIN_WALL_Z, WFC_FORWARD);
+    rules.allow(RUIN_WALL_Z, RUIN_PILLAR, WFC_FORWARD);
+    rules.allow(RUIN_PILLAR, RUIN_WALL_Z, WFC_FORWARD);
+    rules.allow(RUIN_WALL_Z, RUIN_AIR, WFC_RIGHT);
+    rules.allow(RUIN_AIR, RUIN_WALL_Z, WFC_RIGHT);
+    rules.allow(RUIN_PILLAR, RUIN_AIR, WFC_RIGHT);
+    rules.allow(RUIN_AIR, RUIN_PILLAR, WFC_RIGHT);
+    rules.allow(RUIN_PILLAR, RUIN_AIR, WFC_FORWARD);
+    rules.allow(RUIN_AIR, RUIN_PILLAR, WFC_FORWARD);
+    for(int t = RUIN_AIR; t <= RUIN_PILLAR; ++t) {
+        rules.allow(t, RUIN_AIR, WFC_UP);
+        if(t != RUIN_AIR) {
+            rules.allow(t, t, WFC_UP);
+        }
+    }
+    return rules;
+}
+
+const WfcRules RUIN_RULES = make_ruin_rules();
+
+//A random spot in the region at least margin blocks in from its edges
+void structure_anchor(uint64_t seed, int rx, int rz, int index, int margin, int &x, int &z) {
+    int span = STRUCTURE_REGION_SIZE - 2 * margin;
+    uint64_t hash = hash_mix64(cell_hash(seed, rx, rz, RNG_STREAM_STRUCTURE_SITE) + static_cast<uint64_t>(index));
+    x = rx * STRUCTURE_REGION_SIZE + margin + static_cast<int>(hash % span);
+    z = rz * STRUCTURE_REGION_SIZE + margin + static_cast<int>((hash >> 32) % span);
+}
+
+void build_tree(uint64_t seed, Structure &tree) {
+    int trunk = 4 + static_cast<int>(cell_hash(seed, tree.x, tree.z, RNG_STREAM_TREE_HEIGHT) % 3);
+    for(int y = 0; y < trunk; ++y) {
+        tree.blocks.push_back({ tree.x, tree.y + y, tree.z, STONE });
+    }
+    int r = TREE_CANOPY_RADIUS;
+    for(int dx = -r; dx <= r; ++dx) {
+        for(int dy = -r; dy <= r; ++dy) {
+            for(int dz = -r; dz <= r; ++dz) {
+                if(dx * dx + dy * dy + dz * dz > r * r + 1 || (dx == 0 && dz == 0 && dy < 0)) {
+                    continue;
+                }
+                tree.blocks.push_back({ tree.x + dx, tree.y + trunk + dy, tree.z + dz, GRASS });
+            }
+        }
+    }
+}
+
+//Lays the walls out by WFC and props them up on footings down to the ground
+void build_ruin(uint64_t seed, Structure &ruin) {
+    WfcGrid grid;
+    grid.reset(RUIN_RULES, RUIN_SIZE, RUIN_HEIGHT, RUIN_SIZE);
+    if(!wfc_solve(RUIN_RULES, grid, cell_hash(seed, ruin.x, ruin.z, RNG_STREAM_RUIN))) {
+        return;
+    }
+
+    std::vector<float> xs, zs, heights(RUIN_SIZE * RUIN_SIZE);
+    for(int x = 0; x < RUIN_SIZE; ++x) {
+        for(int z = 0; z < RUIN_SIZE; ++z) {
+            xs.push_back(static_cast<float>(ruin.x0 + x));
+            zs.push_back(static_cast<float>(ruin.z0 + z));
+        }
+    }
+    noise_wrap_batch(xs.data(), zs.data(), heights.data(), xs.size());
+
+    for(int x = 0; x < RUIN_SIZE; ++x) {
+        for(int z = 0; z < RUIN_SIZE; ++z) {
+            if(grid.block(RUIN_RULES, x, 0, z) == WFC_EMPTY) {
+                continue;
+            }
+            //First block above the column's surface block
+            int ground = static_cast<int>(std::floor(heights[x * RUIN_SIZE + z])) + 1;
+            for(int y = ground; y < ruin.y; ++y) {
+                ruin.blocks.push_back({ ruin.x0 + x, y, ruin.z0 + z, STONE });
+            }
+            for(int y = 0; y < RUIN_HEIGHT; ++y) {
+                int block = grid.block(RUIN_RULES, x, y, z);
+                if(block != WFC_EMPTY) {
+                    ruin.blocks.push_back({ ruin.x0 + x, ruin.y + y, ruin.z0 + z, block });
+                }
+            }
+        }
+    }
+}
+
+void fill_structure_region(StructureRegion &region, uint64_t seed, int rx, int rz) {
+    region.seed = seed;
+    region.rx = rx;
+    region.rz = rz;
+    region.filled = true;
+    region.structures.clear();
+
+    //Candidate sites first, so the ground under all of them is sampled in one batch
+    std::vector<Structure> sites;
+    if(cell_random(seed, rx, rz, RNG_STREAM_RUIN) < RUIN_CHANCE) {
+        Structure ruin{};
+        ruin.type = STRUCTURE_RUIN;
+        structure_anchor(seed, rx, rz, 0, RUIN_SIZE / 2 + 1, ruin.x, ruin.z);
+        sites.push_back(ruin);
+    }
+    int span = STRUCTURE_TREES_MAX - STRUCTURE_TREES_MIN + 1;
+    int trees = STRUCTURE_TREES_MIN + static_cast<int>(cell_hash(seed, rx, rz, RNG_STREAM_TREES) % span);
+    for(int t = 0; t < trees; ++t) {
+        Structure tree{};
+        tree.type = STRUCTURE_TREE;
+        structure_anchor(seed, rx, rz, t + 1, TREE_CANOPY_RADIUS, tree.x, tree.z);
+        sites.push_back(tree);
+    }
+
+    std::vector<float> xs, zs;
+    for(const Structure &site : sites) {
+        xs.push_back(static_cast<float>(site.x));
+        zs.push_back(static_cast<float>(site.z));
+    }
+    std::vector<float> heights(sites.size());
+    std::vector<float> materials(sites.size());
+    terrain_sample_batch(xs.data(), zs.data(), heights.data(), materials.data(), sites.size());
+
+    for(size_t s = 0; s < sites.size(); ++s) {
+        Structure &site = sites[s];
+        //On top of the surface block, which chunks put at floor(height)
+        site.y = static_cast<int>(std::floor(heights[s])) + 1;
+        int reach = site.type == STRUCTURE_RUIN ? RUIN_SIZE / 2 : TREE_CANOPY_RADIUS;
+        site.x0 = site.x - reach;
+        site.z0 = site.z - reach;
+        site.x1 = site.x + reach + 1;
+        site.z1 = site.z + reach + 1;
+        if(site.type == STRUCTURE_TREE) {
+            //Trees only grow on grass, and not inside a ruin
+            bool blocked = static_cast<int>(materials[s]) != GRASS;
+            for(const Structure &placed : region.structures) {
+                blocked = blocked || (placed.type == STRUCTURE_RUIN && site.x1 > placed.x0 && site.x0 < placed.x1 &&
+                    site.z1 > placed.z0 && site.z0 < placed.z1);
+            }
+            if(blocked) {
+                continue;
+            }
+            build_tree(seed, site);
+        } else {
+            build_ruin(seed, site);
+        }
+        region.structures.push_back(std::move(site));
+    }
+}
+
+const StructureRegion &structure_region(uint64_t seed, int rx, int rz) {
+    StructureRegion &region = STRUCTURE_REGIONS[cell_hash(seed, rx, rz, 0) & (STRUCTURE_CACHE - 1)];
+    if(!region.filled || region.rx != rx || region.rz != rz || region.seed != seed) {
+        fill_structure_region(region, seed, rx, rz);
+    }
+    return region;
+}
+
+void structure_blocks_in(uint64_t seed, int x0, int z0, int x1, int z1, std::vector<StructureBlock> &out) {
+    for(int rx = floor_div(x0, STRUCTURE_REGION_SIZE); rx <= floor_div(x1 - 1, STRUCTURE_REGION_SIZE); ++rx) {
+        for(int rz = floor_div(z0, STRUCTURE_REGION_SIZE); rz <= floor_div(z1 - 1, STRUCTURE_REGION_SIZE); ++rz) {
+            for(const Structure &structure : structure_region(seed, rx, rz).structures) {
+                if(structure.x1 <= x0 || structure.x0 >= x1 || structure.z1 <= z0 || structure.z0 >= z1) {
+                    continue;
+                }
+                for(const StructureBlock &block : structure.blocks) {
+                    if(block.x >= x0 && block.x < x1 && block.z >= z0 && block.z < z1) {
+                        out.push_back(block);
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "perlin.h"
+#include "worldgen.hpp"
+
+extern PerlinF p;
+extern uint64_t WORLD_SEED;
+
+//The terrain formula, see worldgen.hpp. Starts out as DEFAULT_TERRAIN_GRAPH;
+//main loads TERRAIN_GRAPH_PATH over it so it can change without a rebuild.
+extern WorldGraph TERRAIN_GRAPH;
+extern const char* DEFAULT_TERRAIN_GRAPH;
+#define TERRAIN_GRAPH_PATH "src/assets/worldgen/terrain.graph"
+
+//What a block is made of
+enum BlockTypes {
+    STONE, GRASS
+};
+
+//Outputs of the terrain graph, in the order run() takes them
+enum TerrainOutput {
+    TERRAIN_HEIGHT,     //surface height at (x, z)
+    TERRAIN_MATERIAL    //BlockTypes value of the surface there
+};
+
+//Replaces TERRAIN_GRAPH with the graph at path. Call before any chunk is built.
+bool load_terrain_graph(const char* path);
+
+//Reseeds the terrain generator. Call before any chunk is built.
+void set_world_seed(uint64_t seed);
+
+//Height of the terrain surface at world (x, z)
+float noise_wrap(float x, float z);
+
+//noise_wrap for n points at once, out[i] = noise_wrap(xs[i], zs[i])
+void noise_wrap_batch(const float* xs, const float* zs, float* out, size_t n);
+
+//Heights and surface materials for n points in one pass; either may be NULL
+void terrain_sample_batch(const float* xs, const float* zs, float* heights, float* materials, size_t n);
+
+//noise_wrap plus the slope of the surface, dh/dx and dh/dz, in one evaluation
+float noise_wrap_deriv(float x, float z, float &dhdx, float &dhdz);
+void noise_wrap_deriv_batch(const float* xs, const float* zs, float* out, float* dhdxs, float* dhdzs, size_t n);
+
+//Largest difference between noise_wrap and the same formula evaluated in
+//double precision, over a steps x steps grid spanning [-extent, extent]
+float noise_wrap_precision_error(float extent, int steps);
+
+//How far the float heightfield may drift from the double reference, in blocks
+const float NOISE_WRAP_TOLERANCE = 0.01f;
+
+#ifdef TERRAIN_IMP
+
+PerlinF p;
+uint64_t WORLD_SEED = PERLIN_DEFAULT_SEED;
+
+const char* DEFAULT_TERRAIN_GRAPH =
+    "broad = noise x z 50.3 30\n"
+    "big = noise x z 150.9 90\n"
+    "hills = add broad big\n"
+    "scale = biome x z scale\n"
+    "offset = biome x z offset\n"
+    "stone_line = biome x z stone_line\n"
+    "scaled = mul hills scale\n"
+    "landform = add scaled offset\n"
+    "eroded = erosion x z\n"
+    "height = add landform eroded\n"
+    "above = sub height stone_line\n"
+    "material = select above 0 0 1\n";
+
+const std::vector<std::string> TERRAIN_OUTPUTS = { "height", "material" };
+
+WorldGraph make_default_terrain_graph() {
+    WorldGraph graph;
+    graph.parse(DEFAULT_TERRAIN_GRAPH, "DEFAULT_TERRAIN_GRAPH", TERRAIN_OUTPUTS);
+    return graph;
+}
+
+WorldGraph TERRAIN_GRAPH = make_default_terrain_graph();
+
+bool load_terrain_graph(const char* path) {
+    return TERRAIN_GRAPH.load(path, TERRAIN_OUTPUTS);
+}
+
+float noise_wrap(float x, float z) {
+    float outputs[2];
+    TERRAIN_GRAPH.sample(p, x, z, outputs);
+    return outputs[0];
+}
+
+void set_world_seed(uint64_t seed) {
+    WORLD_SEED = seed;
+    p = PerlinF(seed);
+}
+
+void noise_wrap_batch(const float* xs, const float* zs, float* out, size_t n) {
+    terrain_sample_batch(xs, zs, out, NULL, n);
+}
+
+void terrain_sample_batch(const float* xs, const float* zs, float* heights, float* materials, size_t n) {
+    float* outputs[] = { heights, materials };
+    TERRAIN_GRAPH.run(p, xs, zs, n, outputs);
+}
+
+float noise_wrap_deriv(float x, float z, float &dhdx, float &dhdz) {
+    float height;
+    noise_wrap_deriv_batch(&x, &z, &height, &dhdx, &dhdz, 1);
+    return height;
+}
+
+void noise_wrap_deriv_batch(const float* xs, const float* zs, float* out, float* dhdxs, float* dhdzs, size_t n) {
+    float* outputs[] = { out, NULL };
+    float* dxs[] = { dhdxs, NULL };
+    float* dzs[] = { dhdzs, NULL };
+    TERRAIN_GRAPH.run(p, xs, zs, n, outputs, dxs, dzs);
+}
+
+float noise_wrap_precision_error(float extent, int steps) {
+    Perlin reference(WORLD_SEED);
+
+    float worst = 0.0f;
+    for(int a = 0; a < steps; ++a) {
+        for(int b = 0; b < steps; ++b) {
+            float x = -extent + (2.0f * extent * a) / steps;
+            float z = -extent + (2.0f * extent * b) / steps;
+            double expected = TERRAIN_GRAPH.reference(reference, x, z, TERRAIN_HEIGHT);
+            float error = static_cast<float>(std::fabs(expected - noise_wrap(x, z)));
+            if(error > worst) {
+                worst = error;
+            }
+        }
+    }
+    return worst;
+}
+
+#endif
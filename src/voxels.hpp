@@ -0,0 +1,286 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "heightcache.hpp"
+#include "terrain.hpp"
+
+//Block storage for chunks. A box of voxels keeps a palette of the block
+//types in it and one bit-packed palette index per voxel, so its size goes
+//with how many kinds of block it holds rather than with what they are: a
+//16 x 64 x 16 section of stone and air is 2 KB where bytes would be 16 KB.
+//
+//Indices are 1, 2, 4 or 8 bits wide, the narrowest that fits the palette,
+//so none straddles two words and get and set are a shift and a mask.
+//Setting a block type the palette hasn't seen widens the indices when they
+//run out of room. Palette entries nothing uses any more are reused.
+
+//No block
+const int16_t BLOCK_AIR = -1;
+
+//Palette entries at the widest indices
+#define VOXEL_PALETTE_MAX 256
+
+class PaletteVoxels {
+public:
+    PaletteVoxels();
+    //width x height x depth voxels, all block
+    PaletteVoxels(int width, int height, int depth, int16_t block = BLOCK_AIR);
+
+    int width() const { return size_x; }
+    int height() const { return size_y; }
+    int depth() const { return size_z; }
+
+    //Voxels of a column are next to each other, bottom up
+    size_t index(int x, int y, int z) const { return (static_cast<size_t>(x) * size_z + z) * size_y + y; }
+
+    int16_t get(int x, int y, int z) const { return palette[read(index(x, y, z))]; }
+    //False if block would be the palette's VOXEL_PALETTE_MAX + 1th type
+    bool set(int x, int y, int z, int16_t block);
+    //Sets y in [y0, y1) of column (x, z)
+    bool fill_column(int x, int z, int y0, int y1, int16_t block);
+
+    int bits() const { return index_bits; }
+    //Block types in use
+    size_t types() const;
+    //Memory held for the indices and palette
+    size_t bytes() const;
+
+private:
+    uint32_t read(size_t i) const {
+        size_t bit = i * index_bits;
+        return static_cast<uint32_t>(words[bit >> 6] >> (bit & 63)) & mask;
+    }
+    void write(size_t i, uint32_t value) {
+        size_t bit = i * index_bits;
+        uint64_t &word = words[bit >> 6];
+        word = (word & ~(static_cast<uint64_t>(mask) << (bit & 63))) | (static_cast<uint64_t>(value) << (bit & 63));
+    }
+    //Palette index for block, added if need be, or -1 if the palette is full
+    int entry(int16_t block);
+    void widen();
+
+    int size_x, size_y, size_z;
+    int index_bits;
+    uint32_t mask;
+    std::vector<uint64_t> words;
+    std::vector<int16_t> palette;
+    std::vector<uint32_t> uses;     //voxels using each palette entry
+};
+
+//A chunk's blocks as a stack of PaletteVoxels sections, each section_height
+//tall, from section first upwards. Below the lowest section is solid stone
+//and above the highest is air, so only the part around the surface is kept.
+//x and z are relative to the chunk, y is the world's.
+//
+//Alongside the blocks each section keeps one bit per voxel of whether it is
+//solid, a word per column with bit y - the section's bottom set for a block
+//at y. Sections are at most 64 tall so a column fits in one word, and
+//asking whether a block is solid is a shift and an and rather than a
+//palette lookup or a terrain sample. Whole columns can be tested against
+//their neighbours at once, 64 faces at a time.
+struct ChunkVoxels {
+    int width, section_height, depth;
+    int first;      //section covering y in [first * section_height, (first + 1) * section_height)
+    std::vector<PaletteVoxels> sections;
+    //[(section * width + x) * depth + z], kept up to date by set and fill_column
+    std::vector<uint64_t> solid_columns;
+
+    //Sections first to last inclusive, all air. section_height is at most 64.
+    void reset(int width, int section_height, int depth, int first, int last);
+    int16_t get(int x, int y, int z) const;
+    bool solid(int x, int y, int z) const {
+        int section = floor_div(y, section_height) - first;
+        if(section < 0) {
+            return true;
+        }
+        if(section >= static_cast<int>(sections.size())) {
+            return false;
+        }
+        return (column(section, x, z) >> (y - (first + section) * section_height)) & 1;
+    }
+    //Solid bits of column (x, z) in the section'th section from the bottom
+    uint64_t column(int section, int x, int z) const {
+        return solid_columns[(static_cast<size_t>(section) * width + x) * depth + z];
+    }
+    //Adds sections to reach y if need be
+    bool set(int x, int y, int z, int16_t block);
+    //Sets y in [y0, y1) of column (x, z), leaving out what is outside the sections
+    bool fill_column(int x, int z, int y0, int y1, int16_t block);
+    size_t bytes() const;
+};
+
+#ifdef VOXELS_IMP
+
+#include <algorithm>
+
+PaletteVoxels::PaletteVoxels() : PaletteVoxels(0, 0, 0) {
+}
+
+PaletteVoxels::PaletteVoxels(int width, int height, int depth, int16_t block)
+    : size_x(width), size_y(height), size_z(depth), index_bits(1), mask(1) {
+    size_t count = static_cast<size_t>(width) * height * depth;
+    words.assign((count + 63) / 64, 0);
+    palette.push_back(block);
+    uses.push_back(static_cast<uint32_t>(count));
+}
+
+int PaletteVoxels::entry(int16_t block) {
+    int free = -1;
+    for(size_t e = 0; e < palette.size(); ++e) {
+        if(palette[e] == block && uses[e] > 0) {
+            return static_cast<int>(e);
+        }
+        if(uses[e] == 0 && free < 0) {
+            free = static_cast<int>(e);
+        }
+    }
+    if(free >= 0) {
+        palette[free] = block;
+        return free;
+    }
+    if(palette.size() >= VOXEL_PALETTE_MAX) {
+        return -1;
+    }
+    palette.push_back(block);
+    uses.push_back(0);
+    if(palette.size() > (static_cast<size_t>(1) << index_bits)) {
+        widen();
+    }
+    return static_cast<int>(palette.size() - 1);
+}
+
+void PaletteVoxels::widen() {
+    int bits = index_bits * 2;
+    size_t count = static_cast<size_t>(size_x) * size_y * size_z;
+    std::vector<uint64_t> wider((count * bits + 63) / 64, 0);
+    for(size_t i = 0; i < count; ++i) {
+        size_t bit = i * bits;
+        wider[bit >> 6] |= static_cast<uint64_t>(read(i)) << (bit & 63);
+    }
+    words.swap(wider);
+    index_bits = bits;
+    mask = (1u << bits) - 1;
+}
+
+bool PaletteVoxels::set(int x, int y, int z, int16_t block) {
+    size_t i = index(x, y, z);
+    uint32_t old = read(i);
+    if(palette[old] == block) {
+        return true;
+    }
+    int e = entry(block);
+    if(e < 0) {
+        return false;
+    }
+    uses[old]--;
+    uses[e]++;
+    write(i, static_cast<uint32_t>(e));
+    return true;
+}
+
+bool PaletteVoxels::fill_column(int x, int z, int y0, int y1, int16_t block) {
+    if(y0 >= y1) {
+        return true;
+    }
+    int e = entry(block);
+    if(e < 0) {
+        return false;
+    }
+    size_t column = index(x, 0, z);
+    for(int y = y0; y < y1; ++y) {
+        uint32_t old = read(column + y);
+        uses[old]--;
+        write(column + y, static_cast<uint32_t>(e));
+    }
+    uses[e] += static_cast<uint32_t>(y1 - y0);
+    return true;
+}
+
+size_t PaletteVoxels::types() const {
+    size_t count = 0;
+    for(uint32_t u : uses) {
+        count += u > 0;
+    }
+    return count;
+}
+
+size_t PaletteVoxels::bytes() const {
+    return words.size() * sizeof(uint64_t) + palette.size() * (sizeof(int16_t) + sizeof(uint32_t));
+}
+
+void ChunkVoxels::reset(int width, int section_height, int depth, int first, int last) {
+    this->width = width;
+    this->section_height = section_height;
+    this->depth = depth;
+    this->first = first;
+    sections.assign(last - first + 1, PaletteVoxels(width, section_height, depth));
+    solid_columns.assign(sections.size() * width * depth, 0);
+}
+
+//Bits [y0, y1) of a column word
+uint64_t column_bits(int y0, int y1) {
+    uint64_t below_y1 = y1 >= 64 ? ~0ull : (1ull << y1) - 1;
+    return below_y1 & ~((1ull << y0) - 1);
+}
+
+int16_t ChunkVoxels::get(int x, int y, int z) const {
+    int section = floor_div(y, section_height) - first;
+    if(section < 0) {
+        return STONE;
+    }
+    if(section >= static_cast<int>(sections.size())) {
+        return BLOCK_AIR;
+    }
+    return sections[section].get(x, y - (first + section) * section_height, z);
+}
+
+bool ChunkVoxels::set(int x, int y, int z, int16_t block) {
+    int section = floor_div(y, section_height) - first;
+    size_t area = static_cast<size_t>(width) * depth;
+    while(section < 0) {
+        sections.insert(sections.begin(), PaletteVoxels(width, section_height, depth, STONE));
+        solid_columns.insert(solid_columns.begin(), area, column_bits(0, section_height));
+        first--;
+        section++;
+    }
+    while(section >= static_cast<int>(sections.size())) {
+        sections.push_back(PaletteVoxels(width, section_height, depth));
+        solid_columns.insert(solid_columns.end(), area, 0);
+    }
+    int local = y - (first + section) * section_height;
+    if(!sections[section].set(x, local, z, block)) {
+        return false;
+    }
+    uint64_t &mask = solid_columns[(section * area) + static_cast<size_t>(x) * depth + z];
+    mask = block == BLOCK_AIR ? mask & ~(1ull << local) : mask | (1ull << local);
+    return true;
+}
+
+bool ChunkVoxels::fill_column(int x, int z, int y0, int y1, int16_t block) {
+    bool filled = true;
+    for(size_t s = 0; s < sections.size(); ++s) {
+        int base = (first + static_cast<int>(s)) * section_height;
+        int low = std::max(y0 - base, 0);
+        int high = std::min(y1 - base, section_height);
+        if(low >= high || !sections[s].fill_column(x, z, low, high, block)) {
+            filled = filled && low >= high;
+            continue;
+        }
+        uint64_t &mask = solid_columns[(s * width + x) * depth + z];
+        mask = block == BLOCK_AIR ? mask & ~column_bits(low, high) : mask | column_bits(low, high);
+    }
+    return filled;
+}
+
+size_t ChunkVoxels::bytes() const {
+    size_t total = 0;
+    for(const PaletteVoxels &section : sections) {
+        total += section.bytes();
+    }
+    return total + solid_columns.size() * sizeof(uint64_t);
+}
+
+#endif
@@ -0,0 +1,454 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Wave function collapse over a 3D grid of cells, for block and structure
+//layouts. Each tile is one block (a BlockTypes value, or WFC_EMPTY to leave
+//the voxel alone) with a weight, and WfcRules says which tiles may sit next
+//to which on each side.
+//
+//Every cell starts able to be any tile, its domain, kept as a bitset. The
+//solver repeatedly collapses the cell with the fewest options left to one
+//tile, then propagates: a neighbour may only keep tiles that something still
+//in this cell allows on that side, which is the OR of the chosen side's
+//allowed sets over this cell's domain, ANDed into the neighbour's. Cells
+//whose domains shrank go on a worklist until nothing changes. Those are
+//whole-word AND/OR over WFC_WORDS words, which the compiler vectorizes.
+//
+//Naive WFC scans every cell to find the next one to collapse, which is
+//quadratic in the cell count. Here candidates sit in one bucket per option
+//count; the next cell is a random one from the lowest bucket, and entries
+//gone stale because their cell narrowed again are dropped as they come up,
+//so finding it costs O(1) and a solve is linear plus propagation.
+//
+//Every random choice is a hash of the seed and the cell (see hashrng.hpp),
+//so a grid solves the same way on any thread. wfc_solve_regions solves many
+//independent grids across threads, each seeded from its own coordinates.
+
+//Domain words; up to 64 * WFC_WORDS tiles
+#define WFC_WORDS 2
+#define WFC_MAX_TILES (64 * WFC_WORDS)
+//Fresh starts after a contradiction before a solve gives up
+#define WFC_MAX_ATTEMPTS 8
+
+//Tile block value for "leave whatever is there"
+const int WFC_EMPTY = -1;
+
+enum WfcDirection {
+    WFC_LEFT,       //-x
+    WFC_RIGHT,      //+x
+    WFC_DOWN,       //-y
+    WFC_UP,         //+y
+    WFC_BACK,       //-z
+    WFC_FORWARD,    //+z
+    WFC_DIRECTIONS
+};
+
+//The side facing back the other way
+inline int wfc_opposite(int direction) {
+    return direction ^ 1;
+}
+
+struct WfcDomain {
+    uint64_t bits[WFC_WORDS];
+
+    static WfcDomain none();
+    //Tiles 0 to count - 1
+    static WfcDomain all(int count);
+    static WfcDomain only(int tile);
+
+    bool test(int tile) const { return (bits[tile >> 6] >> (tile & 63)) & 1; }
+    void set(int tile) { bits[tile >> 6] |= 1ull << (tile & 63); }
+    int count() const;
+    bool empty() const;
+    //Lowest tile in the domain, or -1
+    int first() const;
+
+    WfcDomain &operator&=(const WfcDomain &other);
+    WfcDomain &operator|=(const WfcDomain &other);
+    bool operator==(const WfcDomain &other) const;
+    bool operator!=(const WfcDomain &other) const { return !(*this == other); }
+};
+
+struct WfcTile {
+    int block;      //BlockTypes value, or WFC_EMPTY
+    float weight;   //how often it is picked, relative to the other options
+};
+
+class WfcRules {
+public:
+    //Returns the new tile's index, or -1 past WFC_MAX_TILES
+    int add_tile(int block, float weight);
+    //b may sit on side direction of a (so a on the opposite side of b)
+    void allow(int a, int b, int direction);
+    void allow_sides(int a, int b);     //on any of the four horizontal sides
+    void allow_all(int a, int b);       //on any side
+
+    int tile_count() const { return static_cast<int>(tiles.size()); }
+    const WfcTile &tile(int t) const { return tiles[t]; }
+    //Tiles a cell holding tile t allows on its side direction
+    const WfcDomain &allowed(int t, int direction) const { return allowed_sets[direction][t]; }
+
+private:
+    std::vector<WfcTile> tiles;
+    std::vector<WfcDomain> allowed_sets[WFC_DIRECTIONS];
+};
+
+class WfcGrid {
+public:
+    WfcGrid();
+    //Every cell able to be any of rules' tiles, nothing solved
+    void reset(const WfcRules &rules, int width, int height, int depth);
+
+    //Narrows cell (x, y, z) to domain before solving, for fixed ground,
+    //doorways and the like. Propagation happens in wfc_solve.
+    void restrict(int x, int y, int z, const WfcDomain &domain);
+
+    int index(int x, int y, int z) const { return (y * depth + z) * width + x; }
+    //Solved tile at (x, y, z), -1 before a successful solve
+    int tile(int x, int y, int z) const { return tiles[index(x, y, z)]; }
+    //Block of the solved tile at (x, y, z), or WFC_EMPTY
+    int block(const WfcRules &rules, int x, int y, int z) const;
+
+    int width, height, depth;
+    std::vector<WfcDomain> constraints;     //starting domains, restored on each attempt
+    std::vector<int> tiles;
+    int attempts;                           //by the last solve, 0 if it never ran
+};
+
+//Collapses every cell of grid. Returns false, leaving tiles at -1, if
+//WFC_MAX_ATTEMPTS tries in a row all hit a cell with no options left.
+bool wfc_solve(const WfcRules &rules, WfcGrid &grid, uint64_t seed);
+
+//A grid to be solved on its own, seeded from its coordinates (in whatever
+//units the caller places regions by)
+struct WfcRegion {
+    int x, y, z;
+    WfcGrid grid;
+    bool solved;
+};
+
+//wfc_solve for each region on threads threads. Results don't depend on the
+//thread count.
+void wfc_solve_regions(const WfcRules &rules, std::vector<WfcRegion> &regions, uint64_t seed, int threads);
+
+#ifdef WFC_IMP
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <thread>
+
+#include "hashrng.hpp"
+
+WfcDomain WfcDomain::none() {
+    WfcDomain domain;
+    for(int w = 0; w < WFC_WORDS; ++w) {
+        domain.bits[w] = 0;
+    }
+    return domain;
+}
+
+WfcDomain WfcDomain::all(int count) {
+    WfcDomain domain = none();
+    for(int w = 0; w < WFC_WORDS; ++w) {
+        int left = count - w * 64;
+        domain.bits[w] = left >= 64 ? ~0ull : (left > 0 ? (1ull << left) - 1 : 0);
+    }
+    return domain;
+}
+
+WfcDomain WfcDomain::only(int tile) {
+    WfcDomain domain = none();
+    domain.set(tile);
+    return domain;
+}
+
+int WfcDomain::count() const {
+    int total = 0;
+    for(int w = 0; w < WFC_WORDS; ++w) {
+        total += std::popcount(bits[w]);
+    }
+    return total;
+}
+
+bool WfcDomain::empty() const {
+    uint64_t any = 0;
+    for(int w = 0; w < WFC_WORDS; ++w) {
+        any |= bits[w];
+    }
+    return any == 0;
+}
+
+int WfcDomain::first() const {
+    for(int w = 0; w < WFC_WORDS; ++w) {
+        if(bits[w] != 0) {
+            return w * 64 + std::countr_zero(bits[w]);
+        }
+    }
+    return -1;
+}
+
+WfcDomain &WfcDomain::operator&=(const WfcDomain &other) {
+    for(int w = 0; w < WFC_WORDS; ++w) {
+        bits[w] &= other.bits[w];
+    }
+    return *this;
+}
+
+WfcDomain &WfcDomain::operator|=(const WfcDomain &other) {
+    for(int w = 0; w < WFC_WORDS; ++w) {
+        bits[w] |= other.bits[w];
+    }
+    return *this;
+}
+
+bool WfcDomain::operator==(const WfcDomain &other) const {
+    uint64_t differ = 0;
+    for(int w = 0; w < WFC_WORDS; ++w) {
+        differ |= bits[w] ^ other.bits[w];
+    }
+    return differ == 0;
+}
+
+int WfcRules::add_tile(int block, float weight) {
+    if(tile_count() >= WFC_MAX_TILES) {
+        return -1;
+    }
+    tiles.push_back({ block, weight });
+    for(int d = 0; d < WFC_DIRECTIONS; ++d) {
+        allowed_sets[d].push_back(WfcDomain::none());
+    }
+    return tile_count() - 1;
+}
+
+void WfcRules::allow(int a, int b, int direction) {
+    allowed_sets[direction][a].set(b);
+    allowed_sets[wfc_opposite(direction)][b].set(a);
+}
+
+void WfcRules::allow_sides(int a, int b) {
+    allow(a, b, WFC_LEFT);
+    allow(a, b, WFC_RIGHT);
+    allow(a, b, WFC_BACK);
+    allow(a, b, WFC_FORWARD);
+}
+
+void WfcRules::allow_all(int a, int b) {
+    for(int d = 0; d < WFC_DIRECTIONS; ++d) {
+        allow(a, b, d);
+    }
+}
+
+WfcGrid::WfcGrid() : width(0), height(0), depth(0), attempts(0) {
+
+}
+
+void WfcGrid::reset(const WfcRules &rules, int w, int h, int d) {
+    width = w;
+    height = h;
+    depth = d;
+    constraints.assign(static_cast<size_t>(w) * h * d, WfcDomain::all(rules.tile_count()));
+    tiles.assign(constraints.size(), -1);
+    attempts = 0;
+}
+
+void WfcGrid::restrict(int x, int y, int z, const WfcDomain &domain) {
+    constraints[index(x, y, z)] &= domain;
+}
+
+int WfcGrid::block(const WfcRules &rules, int x, int y, int z) const {
+    int t = tile(x, y, z);
+    return t >= 0 ? rules.tile(t).block : WFC_EMPTY;
+}
+
+//Scratch one solve needs, kept per thread so solving many regions doesn't allocate
+struct WfcScratch {
+    std::vector<WfcDomain> domains;
+    std::vector<int> worklist;
+    std::vector<uint8_t> queued;
+    //buckets[n]: cells that had n options when added
+    std::vector<std::vector<int>> buckets;
+    int lowest;     //no bucket below this has entries
+
+    void add_candidate(int cell, int options) {
+        buckets[options].push_back(cell);
+        lowest = std::min(lowest, options);
+    }
+};
+
+thread_local WfcScratch WFC_SCRATCH;
+
+//Neighbours of cell on each side, -1 off the grid
+void wfc_neighbours(const WfcGrid &grid, int cell, int* neighbours) {
+    int layer = grid.width * grid.depth;
+    int x = cell % grid.width;
+    int z = cell / grid.width % grid.depth;
+    int y = cell / layer;
+    neighbours[WFC_LEFT] = x > 0 ? cell - 1 : -1;
+    neighbours[WFC_RIGHT] = x + 1 < grid.width ? cell + 1 : -1;
+    neighbours[WFC_DOWN] = y > 0 ? cell - layer : -1;
+    neighbours[WFC_UP] = y + 1 < grid.height ? cell + layer : -1;
+    neighbours[WFC_BACK] = z > 0 ? cell - grid.width : -1;
+    neighbours[WFC_FORWARD] = z + 1 < grid.depth ? cell + grid.width : -1;
+}
+
+//Works through the worklist. False on a contradiction.
+bool wfc_propagate(const WfcRules &rules, const WfcGrid &grid, WfcScratch &scratch) {
+    std::vector<WfcDomain> &domains = scratch.domains;
+    while(!scratch.worklist.empty()) {
+        int cell = scratch.worklist.back();
+        scratch.worklist.pop_back();
+        scratch.queued[cell] = 0;
+        const WfcDomain &domain = domains[cell];
+        int neighbours[WFC_DIRECTIONS];
+        wfc_neighbours(grid, cell, neighbours);
+        for(int d = 0; d < WFC_DIRECTIONS; ++d) {
+            int neighbour = neighbours[d];
+            if(neighbour < 0) {
+                continue;
+            }
+            WfcDomain supported = WfcDomain::none();
+            for(int w = 0; w < WFC_WORDS; ++w) {
+                for(uint64_t bits = domain.bits[w]; bits != 0; bits &= bits - 1) {
+                    supported |= rules.allowed(w * 64 + std::countr_zero(bits), d);
+                }
+            }
+            WfcDomain narrowed = domains[neighbour];
+            narrowed &= supported;
+            if(narrowed == domains[neighbour]) {
+                continue;
+            }
+            if(narrowed.empty()) {
+                return false;
+            }
+            domains[neighbour] = narrowed;
+            int options = narrowed.count();
+            if(options > 1) {
+                scratch.add_candidate(neighbour, options);
+            }
+            if(!scratch.queued[neighbour]) {
+                scratch.queued[neighbour] = 1;
+                scratch.worklist.push_back(neighbour);
+            }
+        }
+    }
+    return true;
+}
+
+//Picks one tile of domain by weight
+int wfc_choose(const WfcRules &rules, const WfcDomain &domain, float roll) {
+    float total = 0.0f;
+    for(int t = 0; t < rules.tile_count(); ++t) {
+        if(domain.test(t)) {
+            total += rules.tile(t).weight;
+        }
+    }
+    float pick = roll * total;
+    int last = -1;
+    for(int t = 0; t < rules.tile_count(); ++t) {
+        if(!domain.test(t)) {
+            continue;
+        }
+        last = t;
+        if(pick < rules.tile(t).weight) {
+            return t;
+        }
+        pick -= rules.tile(t).weight;
+    }
+    return last;
+}
+
+bool wfc_attempt(const WfcRules &rules, WfcGrid &grid, WfcScratch &scratch, uint64_t seed) {
+    size_t cells = grid.constraints.size();
+    scratch.domains = grid.constraints;
+    scratch.queued.assign(cells, 1);
+    scratch.worklist.clear();
+    scratch.buckets.resize(rules.tile_count() + 1);
+    for(std::vector<int> &bucket : scratch.buckets) {
+        bucket.clear();
+    }
+    scratch.lowest = rules.tile_count() + 1;
+    //Every cell once up front, so the starting constraints reach the whole grid
+    for(size_t c = cells; c-- > 0;) {
+        scratch.worklist.push_back(static_cast<int>(c));
+        int options = scratch.domains[c].count();
+        if(options == 0) {
+            return false;
+        }
+        if(options > 1) {
+            scratch.add_candidate(static_cast<int>(c), options);
+        }
+    }
+    if(!wfc_propagate(rules, grid, scratch)) {
+        return false;
+    }
+
+    for(uint32_t step = 0;; ++step) {
+        while(scratch.lowest < static_cast<int>(scratch.buckets.size()) && scratch.buckets[scratch.lowest].empty()) {
+            scratch.lowest++;
+        }
+        if(scratch.lowest >= static_cast<int>(scratch.buckets.size())) {
+            break;
+        }
+        //A random entry, so cells with as many options aren't taken in scan order
+        std::vector<int> &bucket = scratch.buckets[scratch.lowest];
+        size_t pick = cell_hash(seed, static_cast<int32_t>(step), 0, RNG_STREAM_WFC_ORDER) % bucket.size();
+        int cell = bucket[pick];
+        bucket[pick] = bucket.back();
+        bucket.pop_back();
+        WfcDomain &domain = scratch.domains[cell];
+        //Stale: the cell has narrowed since, and a newer entry is in a lower bucket
+        if(domain.count() != scratch.lowest) {
+            continue;
+        }
+        int chosen = wfc_choose(rules, domain, cell_random(seed, cell, 0, RNG_STREAM_WFC_CHOICE));
+        domain = WfcDomain::only(chosen);
+        scratch.queued[cell] = 1;
+        scratch.worklist.push_back(cell);
+        if(!wfc_propagate(rules, grid, scratch)) {
+            return false;
+        }
+    }
+
+    for(size_t c = 0; c < cells; ++c) {
+        grid.tiles[c] = scratch.domains[c].first();
+    }
+    return true;
+}
+
+bool wfc_solve(const WfcRules &rules, WfcGrid &grid, uint64_t seed) {
+    WfcScratch &scratch = WFC_SCRATCH;
+    for(grid.attempts = 1; grid.attempts <= WFC_MAX_ATTEMPTS; ++grid.attempts) {
+        if(wfc_attempt(rules, grid, scratch, hash_mix64(seed + static_cast<uint64_t>(grid.attempts)))) {
+            return true;
+        }
+    }
+    grid.attempts = WFC_MAX_ATTEMPTS;
+    std::fill(grid.tiles.begin(), grid.tiles.end(), -1);
+    return false;
+}
+
+void wfc_solve_regions(const WfcRules &rules, std::vector<WfcRegion> &regions, uint64_t seed, int threads) {
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for(size_t r = next++; r < regions.size(); r = next++) {
+            WfcRegion &region = regions[r];
+            uint64_t region_seed = cell_hash(seed ^ static_cast<uint64_t>(static_cast<uint32_t>(region.y)),
+                region.x, region.z, RNG_STREAM_WFC_REGION);
+            region.solved = wfc_solve(rules, region.grid, region_seed);
+        }
+    };
+    std::vector<std::thread> workers;
+    for(int t = 1; t < threads; ++t) {
+        workers.emplace_back(work);
+    }
+    work();
+    for(std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+#endif
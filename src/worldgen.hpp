@@ -0,0 +1,840 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "perlin.h"
+#include "fractal.hpp"
+#include "biome.hpp"
+#include "erosion.hpp"
+
+//Worldgen graphs: a text file of named nodes, one per line,
+//
+//    name = op arg arg ...
+//
+//where each arg is an earlier node, x or z (the sample position), or a number.
+//
+//    noise  X Z scale amplitude    Perlin at (X, Z) / scale, times amplitude
+//    ridged X Z scale amplitude    the same with each sample folded to (1 - |n|)^2
+//    add A B
+//    sub A B                       A - B
+//    mul A B
+//    clamp A lo hi                 lo and hi are numbers
+//    select A threshold B C        A > threshold ? B : C, threshold is a number
+//    warp A F strength             A + F * strength, for offsetting X or Z by another node
+//    biome X Z param               biome parameter at (X, Z), blended across borders:
+//                                  offset, scale or stone_line (see biome.hpp)
+//    erosion X Z                   baked erosion delta at (X, Z), 0 where nothing is baked (see erosion.hpp)
+//
+//Everything after a # is a comment.
+//
+//Loading compiles the graph into a flat list of ops over sample buffers.
+//Constants are folded and nodes the outputs don't need are dropped. A chain
+//of noise nodes added together on the same coordinates becomes one
+//FractalNoise, so it runs through the fused multi-octave kernel. run() then
+//executes the list a block of samples at a time, each op a tight loop over
+//the block, so per-op dispatch costs once per WORLDGEN_BLOCK samples rather
+//than once per sample.
+
+#define WORLDGEN_BLOCK 256
+
+enum WorldGenOpCode {
+    WG_X,
+    WG_Z,
+    WG_CONST,
+    WG_NOISE,
+    WG_ADD,
+    WG_ADD_CONST,
+    WG_SUB,
+    WG_MUL,
+    WG_MUL_CONST,
+    WG_CLAMP,
+    WG_SELECT,
+    WG_WARP,
+    WG_BIOME,
+    WG_EROSION
+};
+
+//A graph node while compiling, and an op once compiled. Sources are node
+//indices while compiling and buffer slots after.
+struct WorldGenOp {
+    WorldGenOpCode code;
+    int src[3];
+    float k0;
+    float k1;
+    int param;              //WG_BIOME: which BiomeParam
+    FractalNoise fractal;   //WG_NOISE: the octaves summed at (src[0], src[1])
+};
+
+class WorldGraph {
+public:
+    WorldGraph();
+
+    //Parses and compiles source, keeping the nodes named in outputs. On an
+    //error prints it (prefixed with name) and leaves this graph unchanged.
+    bool parse(const std::string &source, const char* name, const std::vector<std::string> &outputs);
+    bool load(const char* path, const std::vector<std::string> &outputs);
+
+    size_t op_count() const { return ops.size(); }
+
+    //outputs[o][i] = output o at (xs[i], zs[i]), for the outputs passed to
+    //parse(). Entries of outputs may be NULL to skip them. If dxs and dzs are
+    //given, dxs[o] and dzs[o] also get d/dx and d/dz of each output.
+    void run(const PerlinF &perlin, const float* xs, const float* zs, size_t n,
+        float* const* outputs, float* const* dxs = NULL, float* const* dzs = NULL) const;
+
+    //outputs[o] = output o at (x, z), the same as run() gives, but one op at
+    //a time without any per-block setup, for lone lookups
+    void sample(const PerlinF &perlin, float x, float z, float* outputs) const;
+
+    //One output at one point, evaluated op by op in double precision
+    double reference(Perlin &perlin, double x, double z, int output) const;
+
+private:
+    std::vector<WorldGenOp> ops;
+    std::vector<int> output_slots;
+    int slot_count;
+
+    void run_block(const PerlinF &perlin, const float* const* in, size_t count, size_t stride,
+        float* values, float* dxs, float* dzs) const;
+};
+
+#ifdef WORLDGEN_IMP
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+//Per-thread sample buffers for run(), so chunk threads never share or reallocate them
+thread_local std::vector<float> WORLDGEN_SCRATCH;
+thread_local std::vector<const float*> WORLDGEN_INPUTS;
+//Every biome parameter for the block, and for the nudged positions derivatives need
+thread_local float WORLDGEN_BIOME[5][BIOME_PARAM_COUNT][WORLDGEN_BLOCK];
+
+//Fills WORLDGEN_BIOME[0] for (xs, zs) and, with derivs, [1] to [4] for xs
+//and zs each nudged by -+WORLDGEN_BIOME_STEP
+void worldgen_biome_block(uint64_t seed, const float* xs, const float* zs, size_t count, bool derivs);
+
+WorldGraph::WorldGraph() : slot_count(0) {
+
+}
+
+WorldGenOp make_worldgen_op(WorldGenOpCode code, int a = -1, int b = -1, int c = -1) {
+    WorldGenOp op;
+    op.code = code;
+    op.src[0] = a;
+    op.src[1] = b;
+    op.src[2] = c;
+    op.k0 = 0.0f;
+    op.k1 = 0.0f;
+    op.param = 0;
+    return op;
+}
+
+bool parse_worldgen_number(const std::string &token, float &value) {
+    char* end = NULL;
+    value = std::strtof(token.c_str(), &end);
+    return !token.empty() && *end == '\0';
+}
+
+int worldgen_arg_count(WorldGenOpCode code) {
+    switch(code) {
+    case WG_NOISE:
+    case WG_ADD:
+    case WG_SUB:
+    case WG_MUL:
+    case WG_WARP:
+    case WG_BIOME:
+    case WG_EROSION:
+        return 2;
+    case WG_CLAMP:
+        return 1;
+    case WG_SELECT:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+//Folds an op whose sources are all constants into one
+bool fold_worldgen_constant(std::vector<WorldGenOp> &nodes, WorldGenOp &op) {
+    int count = worldgen_arg_count(op.code);
+    if(op.code == WG_NOISE || op.code == WG_BIOME || op.code == WG_EROSION || count == 0) {
+        return false;
+    }
+    float v[3];
+    for(int s = 0; s < count; ++s) {
+        if(nodes[op.src[s]].code != WG_CONST) {
+            return false;
+        }
+        v[s] = nodes[op.src[s]].k0;
+    }
+    float result = 0.0f;
+    switch(op.code) {
+    case WG_ADD:
+        result = v[0] + v[1];
+        break;
+    case WG_SUB:
+        result = v[0] - v[1];
+        break;
+    case WG_MUL:
+        result = v[0] * v[1];
+        break;
+    case WG_CLAMP:
+        result = v[0] < op.k0 ? op.k0 : (v[0] > op.k1 ? op.k1 : v[0]);
+        break;
+    case WG_SELECT:
+        result = v[0] > op.k0 ? v[1] : v[2];
+        break;
+    case WG_WARP:
+        result = v[0] + v[1] * op.k0;
+        break;
+    default:
+        return false;
+    }
+    op = make_worldgen_op(WG_CONST);
+    op.k0 = result;
+    return true;
+}
+
+void mark_worldgen_live(const std::vector<WorldGenOp> &nodes, std::vector<int> &uses, std::vector<bool> &live, int node) {
+    if(live[node]) {
+        return;
+    }
+    live[node] = true;
+    for(int s = 0; s < 3; ++s) {
+        if(nodes[node].src[s] >= 0) {
+            uses[nodes[node].src[s]]++;
+            mark_worldgen_live(nodes, uses, live, nodes[node].src[s]);
+        }
+    }
+}
+
+bool WorldGraph::parse(const std::string &source, const char* name, const std::vector<std::string> &outputs) {
+    //Nodes 0 and 1 are the sample position
+    std::vector<WorldGenOp> nodes;
+    std::map<std::string, int> names;
+    nodes.push_back(make_worldgen_op(WG_X));
+    nodes.push_back(make_worldgen_op(WG_Z));
+    names["x"] = 0;
+    names["z"] = 1;
+
+    std::istringstream lines(source);
+    std::string line;
+    int line_number = 0;
+    while(std::getline(lines, line)) {
+        line_number++;
+        size_t comment = line.find('#');
+        if(comment != std::string::npos) {
+            line.erase(comment);
+        }
+        std::istringstream words(line);
+        std::vector<std::string> tokens;
+        std::string token;
+        while(words >> token) {
+            tokens.push_back(token);
+        }
+        if(tokens.empty()) {
+            continue;
+        }
+
+        std::string error;
+        if(tokens.size() < 3 || tokens[1] != "=") {
+            error = "expected: name = op args";
+        } else if(names.count(tokens[0])) {
+            error = "node " + tokens[0] + " is already defined";
+        }
+
+        //Node or number; numbers become constant nodes
+        auto operand = [&](const std::string &token) {
+            auto found = names.find(token);
+            if(found != names.end()) {
+                return found->second;
+            }
+            float value;
+            if(!parse_worldgen_number(token, value)) {
+                if(error.empty()) {
+                    error = "unknown node " + token;
+                }
+                return -1;
+            }
+            WorldGenOp constant = make_worldgen_op(WG_CONST);
+            constant.k0 = value;
+            nodes.push_back(constant);
+            return static_cast<int>(nodes.size() - 1);
+        };
+        auto number = [&](const std::string &token) {
+            float value = 0.0f;
+            if(!parse_worldgen_number(token, value) && error.empty()) {
+                error = "expected a number, got " + token;
+            }
+            return value;
+        };
+
+        WorldGenOp op = make_worldgen_op(WG_CONST);
+        if(error.empty()) {
+            const std::string &code = tokens[2];
+            size_t args = tokens.size() - 3;
+            size_t expected = 0;
+            if(code == "noise" || code == "ridged") {
+                expected = 4;
+                if(args == expected) {
+                    op = make_worldgen_op(WG_NOISE, operand(tokens[3]), operand(tokens[4]));
+                    op.fractal.mode = code == "noise" ? FRACTAL_FBM : FRACTAL_RIDGED;
+                    op.fractal.add_octave(1.0f / number(tokens[5]), number(tokens[6]));
+                }
+            } else if(code == "add" || code == "sub" || code == "mul") {
+                expected = 2;
+                if(args == expected) {
+                    WorldGenOpCode binary = code == "add" ? WG_ADD : (code == "sub" ? WG_SUB : WG_MUL);
+                    op = make_worldgen_op(binary, operand(tokens[3]), operand(tokens[4]));
+                }
+            } else if(code == "clamp") {
+                expected = 3;
+                if(args == expected) {
+                    op = make_worldgen_op(WG_CLAMP, operand(tokens[3]));
+                    op.k0 = number(tokens[4]);
+                    op.k1 = number(tokens[5]);
+                }
+            } else if(code == "select") {
+                expected = 4;
+                if(args == expected) {
+                    op = make_worldgen_op(WG_SELECT, operand(tokens[3]), operand(tokens[5]), operand(tokens[6]));
+                    op.k0 = number(tokens[4]);
+                }
+            } else if(code == "warp") {
+                expected = 3;
+                if(args == expected) {
+                    op = make_worldgen_op(WG_WARP, operand(tokens[3]), operand(tokens[4]));
+                    op.k0 = number(tokens[5]);
+                }
+            } else if(code == "biome") {
+                expected = 3;
+                if(args == expected) {
+                    op = make_worldgen_op(WG_BIOME, operand(tokens[3]), operand(tokens[4]));
+                    if(!parse_biome_param(tokens[5].c_str(), op.param) && error.empty()) {
+                        error = "unknown biome parameter " + tokens[5];
+                    }
+                }
+            } else if(code == "erosion") {
+                expected = 2;
+                if(args == expected) {
+                    op = make_worldgen_op(WG_EROSION, operand(tokens[3]), operand(tokens[4]));
+                }
+            } else {
+                error = "unknown op " + code;
+            }
+            if(error.empty() && args != expected) {
+                error = code + " takes " + std::to_string(expected) + " arguments";
+            }
+        }
+
+        if(!error.empty()) {
+            std::cerr << name << ":" << line_number << ": " << error << std::endl;
+            return false;
+        }
+        fold_worldgen_constant(nodes, op);
+        nodes.push_back(op);
+        names[tokens[0]] = static_cast<int>(nodes.size() - 1);
+    }
+
+    std::vector<int> output_nodes;
+    for(const std::string &output : outputs) {
+        auto found = names.find(output);
+        if(found == names.end()) {
+            std::cerr << name << ": missing output node " << output << std::endl;
+            return false;
+        }
+        output_nodes.push_back(found->second);
+    }
+
+    std::vector<int> uses(nodes.size(), 0);
+    std::vector<bool> live(nodes.size(), false);
+    for(int node : output_nodes) {
+        uses[node]++;
+        mark_worldgen_live(nodes, uses, live, node);
+    }
+
+    //Operations against a constant use the immediate forms
+    for(WorldGenOp &op : nodes) {
+        if(op.code == WG_ADD || op.code == WG_MUL) {
+            int constant = nodes[op.src[1]].code == WG_CONST ? 1 : (nodes[op.src[0]].code == WG_CONST ? 0 : -1);
+            if(constant >= 0) {
+                op.k0 = nodes[op.src[constant]].k0;
+                op.src[0] = op.src[1 - constant];
+                op.src[1] = -1;
+                op.code = op.code == WG_ADD ? WG_ADD_CONST : WG_MUL_CONST;
+            }
+        }
+        //A - k is A + -k, exactly
+        if(op.code == WG_SUB && nodes[op.src[1]].code == WG_CONST) {
+            op.k0 = -nodes[op.src[1]].k0;
+            op.src[1] = -1;
+            op.code = WG_ADD_CONST;
+        }
+    }
+
+    //add(A, B) where A is noise (maybe already fused) and B is one more octave
+    //on the same coordinates and mode becomes a single noise op with B's
+    //octave appended. The fused kernel sums octaves left to right, which is
+    //exactly A + B, so fusing never changes the result.
+    for(WorldGenOp &op : nodes) {
+        if(op.code != WG_ADD) {
+            continue;
+        }
+        const WorldGenOp &a = nodes[op.src[0]];
+        const WorldGenOp &b = nodes[op.src[1]];
+        if(a.code == WG_NOISE && b.code == WG_NOISE && uses[op.src[0]] == 1 && uses[op.src[1]] == 1 &&
+            a.src[0] == b.src[0] && a.src[1] == b.src[1] && a.fractal.mode == b.fractal.mode &&
+            b.fractal.octave_count == 1 && a.fractal.octave_count < FRACTAL_MAX_OCTAVES) {
+            WorldGenOp fused = a;
+            fused.fractal.add_octave(b.fractal.octaves[0].frequency, b.fractal.octaves[0].amplitude);
+            op = fused;
+        }
+    }
+
+    //Emit what the outputs still reach, one buffer slot per node
+    std::fill(uses.begin(), uses.end(), 0);
+    std::fill(live.begin(), live.end(), false);
+    for(int node : output_nodes) {
+        mark_worldgen_live(nodes, uses, live, node);
+    }
+    std::vector<int> slots(nodes.size(), -1);
+    std::vector<WorldGenOp> compiled;
+    for(size_t node = 0; node < nodes.size(); ++node) {
+        if(!live[node]) {
+            continue;
+        }
+        WorldGenOp op = nodes[node];
+        for(int s = 0; s < 3; ++s) {
+            if(op.src[s] >= 0) {
+                op.src[s] = slots[op.src[s]];
+            }
+        }
+        slots[node] = static_cast<int>(compiled.size());
+        compiled.push_back(op);
+    }
+
+    ops = compiled;
+    slot_count = static_cast<int>(compiled.size());
+    output_slots.clear();
+    for(int node : output_nodes) {
+        output_slots.push_back(slots[node]);
+    }
+    return true;
+}
+
+bool WorldGraph::load(const char* path, const std::vector<std::string> &outputs) {
+    std::ifstream file(path);
+    if(!file.is_open()) {
+        std::cerr << "Couldn't open worldgen graph " << path << std::endl;
+        return false;
+    }
+    std::stringstream source;
+    source << file.rdbuf();
+    return parse(source.str(), path, outputs);
+}
+
+//Biome parameters change over tens of blocks, so their slopes are taken by
+//central differences this far apart
+const float WORLDGEN_BIOME_STEP = 0.25f;
+
+void worldgen_biome_block(uint64_t seed, const float* xs, const float* zs, size_t count, bool derivs) {
+    float* params[BIOME_PARAM_COUNT];
+    for(int p = 0; p < BIOME_PARAM_COUNT; ++p) {
+        params[p] = WORLDGEN_BIOME[0][p];
+    }
+    biome_sample_batch(seed, xs, zs, params, count);
+    if(!derivs) {
+        return;
+    }
+    float nudged_x[WORLDGEN_BLOCK];
+    float nudged_z[WORLDGEN_BLOCK];
+    for(int d = 0; d < 4; ++d) {
+        float step = d % 2 == 0 ? -WORLDGEN_BIOME_STEP : WORLDGEN_BIOME_STEP;
+        for(size_t i = 0; i < count; ++i) {
+            nudged_x[i] = d < 2 ? xs[i] + step : xs[i];
+            nudged_z[i] = d < 2 ? zs[i] : zs[i] + step;
+        }
+        for(int p = 0; p < BIOME_PARAM_COUNT; ++p) {
+            params[p] = WORLDGEN_BIOME[d + 1][p];
+        }
+        biome_sample_batch(seed, nudged_x, nudged_z, params, count);
+    }
+}
+
+void WorldGraph::run_block(const PerlinF &perlin, const float* const* in, size_t count, size_t stride,
+    float* values, float* dxs, float* dzs) const {
+    //The wide kernels pad a short tail out to a whole register, which for a
+    //lone sample costs far more than the scalar kernel's identical result
+    const NoiseKernels &kernels = count == 1 ? *noise_kernels_scalar() : noise_kernels();
+    bool derivs = dxs != NULL;
+    //Position WORLDGEN_BIOME was last filled for, so biome ops on the same
+    //coordinates share one lookup
+    const float* biome_x = NULL;
+    const float* biome_z = NULL;
+    for(size_t o = 0; o < ops.size(); ++o) {
+        const WorldGenOp &op = ops[o];
+        float* v = values + o * stride;
+        const float* a = op.src[0] >= 0 ? in[op.src[0]] : NULL;
+        const float* b = op.src[1] >= 0 ? in[op.src[1]] : NULL;
+        const float* c = op.src[2] >= 0 ? in[op.src[2]] : NULL;
+        float* vdx = derivs ? dxs + o * stride : NULL;
+        float* vdz = derivs ? dzs + o * stride : NULL;
+        const float* adx = derivs && a ? dxs + op.src[0] * stride : NULL;
+        const float* adz = derivs && a ? dzs + op.src[0] * stride : NULL;
+        const float* bdx = derivs && b ? dxs + op.src[1] * stride : NULL;
+        const float* bdz = derivs && b ? dzs + op.src[1] * stride : NULL;
+        const float* cdx = derivs && c ? dxs + op.src[2] * stride : NULL;
+        const float* cdz = derivs && c ? dzs + op.src[2] * stride : NULL;
+
+        switch(op.code) {
+        case WG_X:
+        case WG_Z:
+        case WG_CONST:
+            //Read in place or filled once per run()
+            break;
+        case WG_NOISE:
+            if(!derivs) {
+                kernels.fractal(perlin.table(), op.fractal, a, b, v, count);
+            } else {
+                //The kernel gives the slope against its own inputs; chain it through them
+                kernels.fractal_deriv(perlin.table(), op.fractal, a, b, v, vdx, vdz, count);
+                for(size_t i = 0; i < count; ++i) {
+                    float nu = vdx[i];
+                    float nw = vdz[i];
+                    vdx[i] = nu * adx[i] + nw * bdx[i];
+                    vdz[i] = nu * adz[i] + nw * bdz[i];
+                }
+            }
+            break;
+        case WG_ADD:
+            for(size_t i = 0; i < count; ++i) {
+                v[i] = a[i] + b[i];
+            }
+            if(derivs) {
+                for(size_t i = 0; i < count; ++i) {
+                    vdx[i] = adx[i] + bdx[i];
+                    vdz[i] = adz[i] + bdz[i];
+                }
+            }
+            break;
+        case WG_ADD_CONST:
+            for(size_t i = 0; i < count; ++i) {
+                v[i] = a[i] + op.k0;
+            }
+            if(derivs) {
+                for(size_t i = 0; i < count; ++i) {
+                    vdx[i] = adx[i];
+                    vdz[i] = adz[i];
+                }
+            }
+            break;
+        case WG_SUB:
+            for(size_t i = 0; i < count; ++i) {
+                v[i] = a[i] - b[i];
+            }
+            if(derivs) {
+                for(size_t i = 0; i < count; ++i) {
+                    vdx[i] = adx[i] - bdx[i];
+                    vdz[i] = adz[i] - bdz[i];
+                }
+            }
+            break;
+        case WG_MUL:
+            for(size_t i = 0; i < count; ++i) {
+                v[i] = a[i] * b[i];
+            }
+            if(derivs) {
+                for(size_t i = 0; i < count; ++i) {
+                    vdx[i] = adx[i] * b[i] + a[i] * bdx[i];
+                    vdz[i] = adz[i] * b[i] + a[i] * bdz[i];
+                }
+            }
+            break;
+        case WG_MUL_CONST:
+            for(size_t i = 0; i < count; ++i) {
+                v[i] = a[i] * op.k0;
+            }
+            if(derivs) {
+                for(size_t i = 0; i < count; ++i) {
+                    vdx[i] = adx[i] * op.k0;
+                    vdz[i] = adz[i] * op.k0;
+                }
+            }
+            break;
+        case WG_CLAMP:
+            for(size_t i = 0; i < count; ++i) {
+                v[i] = a[i] < op.k0 ? op.k0 : (a[i] > op.k1 ? op.k1 : a[i]);
+            }
+            if(derivs) {
+                for(size_t i = 0; i < count; ++i) {
+                    bool inside = a[i] >= op.k0 && a[i] <= op.k1;
+                    vdx[i] = inside ? adx[i] : 0.0f;
+                    vdz[i] = inside ? adz[i] : 0.0f;
+                }
+            }
+            break;
+        case WG_SELECT:
+            for(size_t i = 0; i < count; ++i) {
+                v[i] = a[i] > op.k0 ? b[i] : c[i];
+            }
+            if(derivs) {
+                for(size_t i = 0; i < count; ++i) {
+                    vdx[i] = a[i] > op.k0 ? bdx[i] : cdx[i];
+                    vdz[i] = a[i] > op.k0 ? bdz[i] : cdz[i];
+                }
+            }
+            break;
+        case WG_WARP:
+            for(size_t i = 0; i < count; ++i) {
+                v[i] = a[i] + b[i] * op.k0;
+            }
+            if(derivs) {
+                for(size_t i = 0; i < count; ++i) {
+                    vdx[i] = adx[i] + bdx[i] * op.k0;
+                    vdz[i] = adz[i] + bdz[i] * op.k0;
+                }
+            }
+            break;
+        case WG_BIOME:
+            if(a != biome_x || b != biome_z) {
+                worldgen_biome_block(perlin.seed(), a, b, count, derivs);
+                biome_x = a;
+                biome_z = b;
+            }
+            std::copy(WORLDGEN_BIOME[0][op.param], WORLDGEN_BIOME[0][op.param] + count, v);
+            if(derivs) {
+                //Slope against the op's own inputs, chained through them like noise
+                const float* lo_x = WORLDGEN_BIOME[1][op.param];
+                const float* hi_x = WORLDGEN_BIOME[2][op.param];
+                const float* lo_z = WORLDGEN_BIOME[3][op.param];
+                const float* hi_z = WORLDGEN_BIOME[4][op.param];
+                for(size_t i = 0; i < count; ++i) {
+                    float du = (hi_x[i] - lo_x[i]) / (2.0f * WORLDGEN_BIOME_STEP);
+                    float dw = (hi_z[i] - lo_z[i]) / (2.0f * WORLDGEN_BIOME_STEP);
+                    vdx[i] = du * adx[i] + dw * bdx[i];
+                    vdz[i] = du * adz[i] + dw * bdz[i];
+                }
+            }
+            break;
+        case WG_EROSION:
+            if(derivs) {
+                float du[WORLDGEN_BLOCK];
+                float dw[WORLDGEN_BLOCK];
+                erosion_sample_batch(EROSION_MAP, a, b, v, du, dw, count);
+                for(size_t i = 0; i < count; ++i) {
+                    vdx[i] = du[i] * adx[i] + dw[i] * bdx[i];
+                    vdz[i] = du[i] * adz[i] + dw[i] * bdz[i];
+                }
+            } else {
+                erosion_sample_batch(EROSION_MAP, a, b, v, NULL, NULL, count);
+            }
+            break;
+        }
+    }
+}
+
+void WorldGraph::run(const PerlinF &perlin, const float* xs, const float* zs, size_t n,
+    float* const* outputs, float* const* dxs, float* const* dzs) const {
+    bool derivs = dxs != NULL && dzs != NULL;
+    //Slots are as wide as the widest block this call runs, so a single
+    //sample only ever touches one float per slot
+    size_t stride = n < WORLDGEN_BLOCK ? n : WORLDGEN_BLOCK;
+    size_t slot_floats = static_cast<size_t>(slot_count) * stride;
+    std::vector<float> &scratch = WORLDGEN_SCRATCH;
+    if(scratch.size() < slot_floats * (derivs ? 3 : 1)) {
+        scratch.resize(slot_floats * (derivs ? 3 : 1));
+    }
+    float* values = scratch.data();
+    float* value_dxs = derivs ? values + slot_floats : NULL;
+    float* value_dzs = derivs ? values + 2 * slot_floats : NULL;
+
+    //Where each op reads its sources from: x and z straight from the caller's
+    //arrays, everything else from its scratch slot
+    std::vector<const float*> &in = WORLDGEN_INPUTS;
+    in.resize(slot_count);
+    for(int o = 0; o < slot_count; ++o) {
+        in[o] = values + o * stride;
+    }
+
+    //Constants and the slopes of x and z don't change from block to block
+    for(int o = 0; o < slot_count; ++o) {
+        const WorldGenOp &op = ops[o];
+        if(op.code != WG_CONST && op.code != WG_X && op.code != WG_Z) {
+            continue;
+        }
+        std::fill(values + o * stride, values + (o + 1) * stride, op.k0);
+        if(derivs) {
+            std::fill(value_dxs + o * stride, value_dxs + (o + 1) * stride, op.code == WG_X ? 1.0f : 0.0f);
+            std::fill(value_dzs + o * stride, value_dzs + (o + 1) * stride, op.code == WG_Z ? 1.0f : 0.0f);
+        }
+    }
+
+    for(size_t base = 0; base < n; base += WORLDGEN_BLOCK) {
+        size_t count = n - base < WORLDGEN_BLOCK ? n - base : WORLDGEN_BLOCK;
+        for(int o = 0; o < slot_count; ++o) {
+            if(ops[o].code == WG_X) {
+                in[o] = xs + base;
+            } else if(ops[o].code == WG_Z) {
+                in[o] = zs + base;
+            }
+        }
+        run_block(perlin, in.data(), count, stride, values, value_dxs, value_dzs);
+        for(size_t o = 0; o < output_slots.size(); ++o) {
+            int slot = output_slots[o];
+            if(outputs[o] != NULL) {
+                std::copy(in[slot], in[slot] + count, outputs[o] + base);
+            }
+            if(derivs && dxs[o] != NULL) {
+                std::copy(value_dxs + slot * stride, value_dxs + slot * stride + count, dxs[o] + base);
+            }
+            if(derivs && dzs[o] != NULL) {
+                std::copy(value_dzs + slot * stride, value_dzs + slot * stride + count, dzs[o] + base);
+            }
+        }
+    }
+}
+
+void WorldGraph::sample(const PerlinF &perlin, float x, float z, float* outputs) const {
+    const NoiseKernels &kernels = *noise_kernels_scalar();
+    std::vector<float> &v = WORLDGEN_SCRATCH;
+    if(v.size() < ops.size()) {
+        v.resize(ops.size());
+    }
+    //Biome parameters for the sources last looked up, as in run_block
+    float biome[BIOME_PARAM_COUNT];
+    int biome_a = -1;
+    int biome_b = -1;
+    for(size_t o = 0; o < ops.size(); ++o) {
+        const WorldGenOp &op = ops[o];
+        float a = op.src[0] >= 0 ? v[op.src[0]] : 0.0f;
+        float b = op.src[1] >= 0 ? v[op.src[1]] : 0.0f;
+        float c = op.src[2] >= 0 ? v[op.src[2]] : 0.0f;
+        switch(op.code) {
+        case WG_X:
+            v[o] = x;
+            break;
+        case WG_Z:
+            v[o] = z;
+            break;
+        case WG_CONST:
+            v[o] = op.k0;
+            break;
+        case WG_NOISE:
+            kernels.fractal(perlin.table(), op.fractal, &a, &b, &v[o], 1);
+            break;
+        case WG_ADD:
+            v[o] = a + b;
+            break;
+        case WG_ADD_CONST:
+            v[o] = a + op.k0;
+            break;
+        case WG_SUB:
+            v[o] = a - b;
+            break;
+        case WG_MUL:
+            v[o] = a * b;
+            break;
+        case WG_MUL_CONST:
+            v[o] = a * op.k0;
+            break;
+        case WG_CLAMP:
+            v[o] = a < op.k0 ? op.k0 : (a > op.k1 ? op.k1 : a);
+            break;
+        case WG_SELECT:
+            v[o] = a > op.k0 ? b : c;
+            break;
+        case WG_WARP:
+            v[o] = a + b * op.k0;
+            break;
+        case WG_BIOME:
+            if(op.src[0] != biome_a || op.src[1] != biome_b) {
+                float* params[BIOME_PARAM_COUNT];
+                for(int p = 0; p < BIOME_PARAM_COUNT; ++p) {
+                    params[p] = biome + p;
+                }
+                biome_sample_batch(perlin.seed(), &a, &b, params, 1);
+                biome_a = op.src[0];
+                biome_b = op.src[1];
+            }
+            v[o] = biome[op.param];
+            break;
+        case WG_EROSION:
+            erosion_sample_batch(EROSION_MAP, &a, &b, &v[o], NULL, NULL, 1);
+            break;
+        }
+    }
+    for(size_t o = 0; o < output_slots.size(); ++o) {
+        outputs[o] = v[output_slots[o]];
+    }
+}
+
+double WorldGraph::reference(Perlin &perlin, double x, double z, int output) const {
+    std::vector<double> v(ops.size());
+    for(size_t o = 0; o < ops.size(); ++o) {
+        const WorldGenOp &op = ops[o];
+        double a = op.src[0] >= 0 ? v[op.src[0]] : 0.0;
+        double b = op.src[1] >= 0 ? v[op.src[1]] : 0.0;
+        double c = op.src[2] >= 0 ? v[op.src[2]] : 0.0;
+        switch(op.code) {
+        case WG_X:
+            v[o] = x;
+            break;
+        case WG_Z:
+            v[o] = z;
+            break;
+        case WG_CONST:
+            v[o] = op.k0;
+            break;
+        case WG_NOISE:
+            v[o] = 0.0;
+            for(int k = 0; k < op.fractal.octave_count; ++k) {
+                const NoiseOctave &octave = op.fractal.octaves[k];
+                double n = perlin.noise(a * octave.frequency, b * octave.frequency);
+                if(op.fractal.mode == FRACTAL_RIDGED) {
+                    n = (1.0 - std::fabs(n)) * (1.0 - std::fabs(n));
+                }
+                v[o] += n * octave.amplitude;
+            }
+            break;
+        case WG_ADD:
+            v[o] = a + b;
+            break;
+        case WG_ADD_CONST:
+            v[o] = a + op.k0;
+            break;
+        case WG_SUB:
+            v[o] = a - b;
+            break;
+        case WG_MUL:
+            v[o] = a * b;
+            break;
+        case WG_MUL_CONST:
+            v[o] = a * op.k0;
+            break;
+        case WG_CLAMP:
+            v[o] = a < op.k0 ? op.k0 : (a > op.k1 ? op.k1 : a);
+            break;
+        case WG_SELECT:
+            v[o] = a > op.k0 ? b : c;
+            break;
+        case WG_WARP:
+            v[o] = a + b * op.k0;
+            break;
+        case WG_BIOME:
+            v[o] = biome_param_reference(perlin.seed(), a, b, op.param);
+            break;
+        case WG_EROSION:
+            v[o] = erosion_reference(EROSION_MAP, a, b);
+            break;
+        }
+    }
+    return v[output_slots[output]];
+}
+
+#endif